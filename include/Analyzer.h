@@ -0,0 +1,88 @@
+#ifndef ANALYZER_H
+#define ANALYZER_H
+
+#include "Quirks.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Static analysis of a game without running it: which of its bytes are code
+// and which are data, the basic blocks of the code and how they connect, and
+// which subroutines call which.
+//
+// Code is found by recursive descent from 0x200, decoding instructions the
+// way the emulator does under the game's quirk profile and following
+// fallthroughs, jumps, calls (assumed to return), both ways out of skips and
+// the entries of BNNN jump tables. A path ends at a return, EXIT or an
+// unknown opcode (the CPU stays on those). Data is what I points at when a
+// DXYN, FX33, FX55, FX65, 5XY2/5XY3 or F002 uses it and I was set by ANNN or
+// F000 NNNN earlier in the same block; I isn't tracked across blocks.
+
+// What a ROM byte was found to be, both if code is also read or written as
+// data (self-modifying games)
+enum rom_byte_use {
+    ROM_BYTE_UNKNOWN = 0,
+    ROM_BYTE_CODE = 1,
+    ROM_BYTE_DATA = 2,
+};
+
+enum block_edge_kind {
+    // To the next instruction: no jump, after a skip that isn't taken, or
+    // back from a call
+    EDGE_FALLTHROUGH,
+    EDGE_JUMP,
+    // Past the next instruction when a skip is taken
+    EDGE_SKIP,
+    EDGE_CALL,
+    // BNNN to an entry of its jump table
+    EDGE_JUMP_TABLE,
+};
+
+struct BlockEdge {
+    uint16_t target;
+    block_edge_kind kind;
+};
+
+struct BasicBlock {
+    uint16_t start;
+    // Address of the last instruction, and just past it
+    uint16_t last;
+    uint16_t end;
+    uint16_t instructions;
+    std::vector<BlockEdge> successors;
+};
+
+struct Subroutine {
+    uint16_t entry;
+    // Starts of the blocks reachable from the entry without calling
+    std::vector<uint16_t> blocks;
+    // Entries of the subroutines it calls
+    std::vector<uint16_t> calls;
+};
+
+struct RomAnalysis {
+    quirk_profile profile = QUIRKS_DEFAULT;
+    // rom_byte_use bits, one entry per ROM byte (address 0x200 + index)
+    std::vector<uint8_t> bytes;
+    // Sorted by start. Blocks of instructions decoded at odd offsets may
+    // overlap others.
+    std::vector<BasicBlock> blocks;
+    // Sorted by entry, the game itself (0x200) first
+    std::vector<Subroutine> subroutines;
+    // Jumps and calls that lead out of the ROM (into the interpreter area,
+    // past the end)
+    std::vector<uint16_t> external_targets;
+    // Instructions that are unknown opcodes under the profile
+    std::vector<uint16_t> unknown_opcodes;
+    // BNNN instructions
+    std::vector<uint16_t> indirect_jumps;
+
+    // Index of the block starting at `address`, -1 if there is none.
+    int block_at(uint16_t address) const;
+};
+
+// Analyzes `size` bytes of `rom` as loaded at 0x200 under `profile`.
+void analyze_rom(const unsigned char *rom, size_t size, quirk_profile profile,
+                 RomAnalysis &analysis);
+
+#endif
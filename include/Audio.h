@@ -0,0 +1,98 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include <SDL2/SDL.h>
+#include <atomic>
+#include <stdint.h>
+
+// Sound for one 60 Hz tick, as the emulation thread left it.
+struct AudioTick {
+    // Sound timer running
+    uint8_t on;
+    // Play `pattern` at `pitch` (XO-CHIP) instead of the built-in tone
+    uint8_t use_pattern;
+    uint8_t pitch;
+    uint8_t pattern[16];
+};
+
+// Beeper on an SDL audio device.
+//
+// The emulation thread pushes the sound state of every 60 Hz tick into a
+// lock-free queue (`push_tick()`), and the SDL callback plays each tick for
+// exactly 1/60 s worth of samples, so the beep starts and stops on the tick
+// the sound timer does. The callback only reads the queue's atomics and
+// precomputed tables: it never allocates, locks or waits for the CPU thread.
+//
+// Playback starts once `prime_ticks` ticks are queued, which absorbs the
+// jitter between the emulator's clock and the sound card's. If the queue
+// runs dry anyway the callback counts an underrun and plays silence until
+// it's primed again; if ticks pile up past `max_backlog` (the callback fell
+// behind) the oldest are skipped to keep the latency bounded.
+class Chip8Audio {
+private:
+    static const uint32_t queue_capacity = 64;
+    // Ticks (1/60 s each) queued before playback (re)starts, and allowed to
+    // wait in the queue
+    static const uint32_t prime_ticks = 2;
+    static const uint32_t max_backlog = 6;
+    static const int sample_rate = 48000;
+    // Built-in tone
+    static const int tone_hz = 440;
+    static const int16_t volume = 3000;
+
+    AudioTick ticks[queue_capacity];
+    alignas(64) std::atomic<uint32_t> head{0};
+    alignas(64) std::atomic<uint32_t> tail{0};
+    std::atomic<uint64_t> underruns{0};
+    std::atomic<uint64_t> skipped{0};
+    std::atomic<uint64_t> callbacks{0};
+
+    // Owned by the callback
+    AudioTick current = {};
+    int tick_samples_left = 0;
+    int tick_remainder = 0;
+    // Waiting for `prime_ticks` ticks, nothing counts as an underrun then
+    bool priming = true;
+    // One period of the tone, indexed by the top 8 bits of `tone_phase`
+    int16_t tone_table[256];
+    uint32_t tone_phase = 0;
+    uint32_t tone_step;
+    // Pattern position in 7.25 fixed point (128 samples per pattern), and
+    // how far it moves per output sample for every FX3A pitch
+    uint32_t pattern_phase = 0;
+    uint32_t pattern_steps[256];
+
+    SDL_AudioDeviceID device = 0;
+    int rate = sample_rate;
+
+    static void callback(void *user, Uint8 *stream, int len);
+    // Takes the next tick off the queue (or counts an underrun).
+    void next_tick();
+    // Writes `count` mono samples.
+    void render(int16_t *out, int count);
+
+public:
+    // Opens the default output device with `buffer_samples` samples per
+    // callback (smaller is lower latency and more underruns). Prints an
+    // error and stays silent if no device can be opened.
+    Chip8Audio(int buffer_samples);
+    ~Chip8Audio();
+
+    bool is_open() { return device != 0; }
+
+    // Emulation thread, once per 60 Hz tick. `pattern` is the XO-CHIP audio
+    // pattern (16 bytes) or nullptr for the built-in tone.
+    void push_tick(bool on, const unsigned char *pattern, unsigned char pitch);
+
+    // Times the callback found the queue empty in the middle of playback.
+    uint64_t get_underruns() {
+        return underruns.load(std::memory_order_relaxed);
+    }
+    // Ticks dropped because the queue was full or to catch up.
+    uint64_t get_skipped() { return skipped.load(std::memory_order_relaxed); }
+    uint64_t get_callbacks() {
+        return callbacks.load(std::memory_order_relaxed);
+    }
+};
+
+#endif
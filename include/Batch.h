@@ -0,0 +1,44 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "Chip8.h"
+#include "Quirks.h"
+
+// Settings for a headless batch run over a directory of games.
+struct BatchOptions {
+    // Directory searched (non recursively) for .ch8 files.
+    const char *rom_dir = nullptr;
+    // Tab separated summary, one line per run.
+    const char *summary_path = "batch_summary.tsv";
+    // Instructions executed per run.
+    unsigned long cycle_budget = 1000000;
+    // Emulated CPU speed, sets how many instructions run between two 60 Hz
+    // timer ticks.
+    unsigned int instructions_per_second = 700;
+    // Independent runs of every game, each with its own seed.
+    unsigned int runs_per_rom = 1;
+    // Worker threads, 0 for one per core.
+    unsigned int threads = 0;
+    // Base seed, runs derive their own seed from it.
+    unsigned int seed = 1;
+    engine_type engine = ENGINE_INTERPRETER;
+    // Picks each game's quirk profile by ROM hash, nullptr runs everything
+    // with QUIRKS_DEFAULT.
+    const QuirkTable *quirk_table = nullptr;
+    // Binary trace of all runs (see Trace.h), nullptr for none. Records are
+    // tagged with the run's line number in the summary.
+    const char *trace_path = nullptr;
+    // Per-run profiles (see Profile.h) are written to PREFIX-N.json and
+    // PREFIX-N.csv, N being the run's line number in the summary. nullptr for
+    // none.
+    const char *profile_prefix = nullptr;
+};
+
+// Runs every game in `options.rom_dir` without a window, spreading the runs
+// over all cores. Each run gets its own Chip8 instance, random seed and cycle
+// budget. The summary records the framebuffer hash, the number of cycles
+// executed and the number of unknown opcodes for every run.
+// Returns 0 on success.
+int run_batch(const BatchOptions &options);
+
+#endif
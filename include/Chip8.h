@@ -1,13 +1,141 @@
 #ifndef CHIP8_H
 #define CHIP8_H
 
+#include "Framebuffer.h"
+#include "Quirks.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+class Chip8;
+class Chip8Jit;
+struct OpcodeKindTable;
+class Profile;
+class RomImage;
+struct SaveState;
+class TraceRing;
+
+// CPU cores that can run a game. The interpreter is the reference.
+enum engine_type {
+    ENGINE_INTERPRETER,
+    ENGINE_JIT,
+    ENGINE_THREADED, // see `Chip8::run_threaded()`
+};
+
+// Which instruction an opcode decodes to, one per handler. The SUPER-CHIP and
+// XO-CHIP ones only come out of the extended decode table (see OpcodeTable.h).
+enum opcode_kind {
+    OP_00E0,
+    OP_00EE,
+    OP_1NNN,
+    OP_2NNN,
+    OP_3XNN,
+    OP_4XNN,
+    OP_5XY0,
+    OP_6XNN,
+    OP_7XNN,
+    OP_8XY0,
+    OP_8XY1,
+    OP_8XY2,
+    OP_8XY3,
+    OP_8XY4,
+    OP_8XY5,
+    OP_8XY6,
+    OP_8XY7,
+    OP_8XYE,
+    OP_9XY0,
+    OP_ANNN,
+    OP_BNNN,
+    OP_CXNN,
+    OP_DXYN,
+    OP_EX9E,
+    OP_EXA1,
+    OP_FX07,
+    OP_FX0A,
+    OP_FX15,
+    OP_FX18,
+    OP_FX1E,
+    OP_FX29,
+    OP_FX33,
+    OP_FX55,
+    OP_FX65,
+    // SUPER-CHIP
+    OP_00CN,
+    OP_00FB,
+    OP_00FC,
+    OP_00FD,
+    OP_00FE,
+    OP_00FF,
+    OP_FX30,
+    OP_FX75,
+    OP_FX85,
+    // XO-CHIP
+    OP_00DN,
+    OP_5XY2,
+    OP_5XY3,
+    OP_F000,
+    OP_FN01,
+    OP_F002,
+    OP_FX3A,
+    OP_UNKNOWN,
+    OP_KIND_COUNT,
+};
+
+// An opcode that has already been decoded. The handler and operand fields are
+// extracted once, the first time the instruction at an address is executed, so
+// that later executions can skip straight to the handler.
+struct Instruction {
+    // Member function that executes the instruction, nullptr if the cache
+    // entry hasn't been decoded yet (or was invalidated by a memory write).
+    void (Chip8::*handler)(const Instruction &ins);
+    unsigned short opcode;
+    unsigned short nnn; // lowest 12 bits (address)
+    unsigned char nn;   // lowest 8 bits (constant)
+    unsigned char n;    // lowest 4 bits
+    unsigned char x;    // register index in bits 8-11
+    unsigned char y;    // register index in bits 4-7
+    unsigned char kind; // opcode_kind
+};
+
+// Why the CPU is currently not executing instructions.
+enum halt_state {
+    HALT_NONE,       // running normally
+    HALT_WAIT_KEY,   // FX0A is waiting for a key press
+    HALT_WAIT_TIMER, // spinning in a loop that only a timer tick can end
+    HALT_FAULT,      // a call overflowed or a return underflowed the stack,
+                     // stays until the machine is reset
+};
+
 class Chip8 {
+    // The recompiler and the lockstep batch read and write the registers
+    // directly.
+    friend class Chip8Jit;
+    friend class LockstepBatch;
+
 private:
     // each opcode is 2 bytes which is represented with an unsigned short.
     unsigned short opcode;
 
     // Chip-8 has 4K of memory in total.
-    unsigned char memory[4096];
+    //* XO-CHIP has 64K, so that's what is mapped. Addresses through I are
+    //* masked with `memory_mask` (0xFFF unless the profile is XO-CHIP), the
+    //* program counter always stays in the first 4K.
+    static const size_t memory_size = 0x10000;
+    unsigned char *memory = nullptr;
+    unsigned short memory_mask = 0xFFF;
+    // Shared image of the game `memory` is a copy-on-write mapping of (see
+    // RomImage.h), nullptr if `memory` is a private allocation.
+    RomImage *image = nullptr;
+    // Whether the SUPER-CHIP big font is part of the image
+    bool image_big_font = false;
+    // Nothing was written since the image was mapped
+    bool memory_pristine = false;
+    // One bit per `dirty_page_size` bytes of memory, set when the page was
+    // written since the last `save_snapshot()`. Small pages, so that a
+    // single write doesn't make `reset_to_snapshot()` restore the whole 4K
+    // of code.
+    static const size_t dirty_page_size = 0x100;
+    uint64_t dirty_pages[memory_size / dirty_page_size / 64];
 
     // CPU registers, from V0-VE with the 16th register being the 'carry flag'.
     // Eight bits is one byte so we can use an unsigned char.
@@ -21,7 +149,25 @@ private:
 
     // Graphics buffer. Chip-8 supports a height of 64 pixels and a width of 32
     // pixels.
-    unsigned char gfx[64 * 32];
+    //* Stored as one bit per pixel, packed into words per row. The most
+    //* significant bit is the leftmost pixel, the same order as the bits of a
+    //* sprite byte, so a sprite row can be drawn with a single shift and XOR.
+    //* See Framebuffer.h for the hi-res and XO-CHIP plane layout.
+    Framebuffer gfx;
+    // One bit per gfx row, set when the row changed since the screen was last
+    // updated so the window only has to convert and upload those rows.
+    uint64_t dirty_rows = 0;
+    // Planes that drawing, clearing and scrolling apply to, bit n is plane
+    // n. Only XO-CHIP's FN01 selects anything but plane 0.
+    unsigned char plane_mask = 1;
+    // SUPER-CHIP "RPL user flags" saved and restored by FX75/FX85.
+    unsigned char flags[16];
+    // XO-CHIP sound: 128 one bit samples loaded by F002, played back at a
+    // rate set by FX3A (see `get_audio_pattern()`).
+    unsigned char audio_pattern[16];
+    unsigned char pitch = 64;
+    // Set once F002 ran, until then the plain beep plays.
+    bool audio_pattern_loaded = false;
 
     unsigned char sound_timer;
     unsigned char delay_timer;
@@ -55,11 +201,18 @@ private:
     //* associated key is pressed and switch back to 0 if unpressed
     //* Note: At initialization, all values in key should be set to 0.
 
-    //? to avoid confusion, shouldn't key be a list of booleans instead of
-    //? unsigned characters?
-    //? The values are only going to be either on (pressed) or off (unpressed).
-    bool key[16];
-    // unsigned char key[16];
+    //* One bit per key, bit n is set while key n is pressed. A single 16 bit
+    //* value so that the window thread can hand over the whole keypad at once
+    //* (see `set_keys()`).
+    uint16_t keys = 0;
+
+    // Idle state, see `halt_state`. While halted `emulate_cycle()` does
+    // nothing and `run()` returns straight away.
+    halt_state halted = HALT_NONE;
+    // Register FX0A stores the pressed key in.
+    unsigned char wait_key_register = 0;
+    // Instruction slots skipped while halted.
+    unsigned long idle_cycles = 0;
 
     // When gfx is updated, draw_flag is set to true and
     // updates the screen.
@@ -67,50 +220,262 @@ private:
 
     int file_size = 0;
 
-    const unsigned char chip8_fontset[80] = {
-        0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
-        0x20, 0x60, 0x20, 0x20, 0x70, // 1
-        0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
-        0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
-        0x90, 0x90, 0xF0, 0x10, 0x10, // 4
-        0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
-        0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
-        0xF0, 0x10, 0x20, 0x40, 0x40, // 7
-        0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
-        0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
-        0xF0, 0x90, 0xF0, 0x90, 0x90, // A
-        0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
-        0xF0, 0x80, 0x80, 0x80, 0xF0, // C
-        0xE0, 0x90, 0x90, 0x90, 0xE0, // D
-        0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
-        0xF0, 0x80, 0xF0, 0x80, 0x80  // F
-    };
+    // State of this instance's random number generator (CXNN).
+    unsigned int rng_state = 1;
+    // Number of executed opcodes that didn't decode to an instruction.
+    unsigned long unknown_opcodes = 0;
+    // Where trace points write to (see Trace.h), nullptr when not tracing.
+    TraceRing *trace_ring = nullptr;
+    // Counters for the profiler (see Profile.h), nullptr when not profiling.
+    Profile *profile = nullptr;
+
+    // SUPER-CHIP 8x10 digits (and XO-CHIP's A-F), at big_font_address.
+    static const unsigned short big_font_address = 0x50;
+    static const unsigned char big_fontset[160];
+
+    // 4x5 digits 0-F at 0
+    static const unsigned char chip8_fontset[80];
+
+    // Decoded instructions keyed by address. Filled lazily by
+    // `emulate_cycle()` and invalidated whenever FX33/FX55 write into memory
+    // that may hold code.
+    Instruction decode_cache[4096];
+
+    // Recompiler to notify about memory writes, nullptr when only the
+    // interpreter is used.
+    Chip8Jit *jit = nullptr;
+
+    typedef void (Chip8::*Handler)(const Instruction &ins);
+    // Handler for each opcode_kind, one table per quirk_profile.
+    static const Handler handler_tables[QUIRK_PROFILE_COUNT][OP_KIND_COUNT];
+    // Instruction set variant (see Quirks.h), its handler table and the
+    // opcode table it decodes with.
+    quirk_profile quirks = QUIRKS_DEFAULT;
+    const Handler *handlers = handler_tables[QUIRKS_DEFAULT];
+    const OpcodeKindTable *kind_table = nullptr;
+
+    // Builds the decoded form of an opcode.
+    Instruction decode(unsigned short op);
+    // Drops every decoded instruction (used after loading a new game).
+    void flush_decode_cache();
+    // Points `memory` at the shared image of the fonts (plus the big font if
+    // `big_font`) and `size` bytes of `rom` at 0x200, or at a private copy if
+    // images aren't available. The previous memory is let go afterwards, so
+    // `rom` may point into it.
+    void attach_image(const unsigned char *rom, size_t size, bool big_font);
+    void release_memory();
+    // Writes a byte to memory and drops any decoded instruction overlapping
+    // the written address.
+    void write_memory(unsigned short address, unsigned char value);
+    void mark_dirty(unsigned short address) {
+        size_t page = address / dirty_page_size;
+        dirty_pages[page / 64] |= (uint64_t)1 << (page % 64);
+    }
+    void mark_all_dirty() { memset(dirty_pages, 0xFF, sizeof(dirty_pages)); }
+    // Everything in a save state but memory.
+    void restore_registers(const SaveState &state);
+    // Next value from this instance's random number generator.
+    unsigned char random_byte();
+    // true if the instructions at `address` are FX07 followed by a 3XNN/4XNN
+    // on the same register, i.e. a loop polling the delay timer.
+    bool is_delay_poll(unsigned short address);
+    // How far a skip instruction moves the program counter when it skips:
+    // past itself and the next instruction, which is 4 bytes long if it's
+    // XO-CHIP's F000 NNNN.
+    template <class Quirks>
+    unsigned short skip_distance() {
+        if (Quirks::xo_chip && memory[(prog_counter + 2) & 0xFFF] == 0xF0 &&
+            memory[(prog_counter + 3) & 0xFFF] == 0x00)
+            return 6;
+        return 4;
+    }
+    // Applies a scroll kernel (see Framebuffer.h) to every selected plane.
+    template <class Scroll>
+    void scroll_planes(Scroll scroll);
+
+    // Opcode handlers, one per instruction. Those whose behaviour depends on
+    // the quirk profile are templates over its policy.
+    void op_00E0(const Instruction &ins);
+    void op_00EE(const Instruction &ins);
+    void op_1NNN(const Instruction &ins);
+    void op_2NNN(const Instruction &ins);
+    template <class Quirks>
+    void op_3XNN(const Instruction &ins);
+    template <class Quirks>
+    void op_4XNN(const Instruction &ins);
+    template <class Quirks>
+    void op_5XY0(const Instruction &ins);
+    void op_6XNN(const Instruction &ins);
+    void op_7XNN(const Instruction &ins);
+    void op_8XY0(const Instruction &ins);
+    template <class Quirks>
+    void op_8XY1(const Instruction &ins);
+    template <class Quirks>
+    void op_8XY2(const Instruction &ins);
+    template <class Quirks>
+    void op_8XY3(const Instruction &ins);
+    void op_8XY4(const Instruction &ins);
+    void op_8XY5(const Instruction &ins);
+    template <class Quirks>
+    void op_8XY6(const Instruction &ins);
+    void op_8XY7(const Instruction &ins);
+    template <class Quirks>
+    void op_8XYE(const Instruction &ins);
+    template <class Quirks>
+    void op_9XY0(const Instruction &ins);
+    void op_ANNN(const Instruction &ins);
+    template <class Quirks>
+    void op_BNNN(const Instruction &ins);
+    void op_CXNN(const Instruction &ins);
+    template <class Quirks>
+    void op_DXYN(const Instruction &ins);
+    template <class Quirks>
+    void op_EX9E(const Instruction &ins);
+    template <class Quirks>
+    void op_EXA1(const Instruction &ins);
+    void op_FX07(const Instruction &ins);
+    void op_FX0A(const Instruction &ins);
+    void op_FX15(const Instruction &ins);
+    void op_FX18(const Instruction &ins);
+    void op_FX1E(const Instruction &ins);
+    void op_FX29(const Instruction &ins);
+    void op_FX33(const Instruction &ins);
+    template <class Quirks>
+    void op_FX55(const Instruction &ins);
+    template <class Quirks>
+    void op_FX65(const Instruction &ins);
+    // SUPER-CHIP
+    void op_00CN(const Instruction &ins);
+    void op_00FB(const Instruction &ins);
+    void op_00FC(const Instruction &ins);
+    void op_00FD(const Instruction &ins);
+    void op_00FE(const Instruction &ins);
+    void op_00FF(const Instruction &ins);
+    void op_FX30(const Instruction &ins);
+    void op_FX75(const Instruction &ins);
+    void op_FX85(const Instruction &ins);
+    // XO-CHIP
+    void op_00DN(const Instruction &ins);
+    void op_5XY2(const Instruction &ins);
+    void op_5XY3(const Instruction &ins);
+    void op_F000(const Instruction &ins);
+    void op_FN01(const Instruction &ins);
+    void op_F002(const Instruction &ins);
+    void op_FX3A(const Instruction &ins);
+    void op_unknown(const Instruction &ins);
+    // `run_threaded()` for one quirk profile.
+    template <class Quirks>
+    unsigned long run_threaded_with(unsigned long count);
 
 public:
+    Chip8() = default;
+    ~Chip8();
+    // Memory is a mapping owned by the instance
+    Chip8(const Chip8 &) = delete;
+    Chip8 &operator=(const Chip8 &) = delete;
+
     // Gets emulator read to load game.
     void initialize();
-    // Read game from filesystem and load into memory array.
-    void load_game(const char *exec_path);
+    // Read game from filesystem and load into memory array. Returns false if
+    // the file couldn't be opened.
+    bool load_game(const char *exec_path);
+    // Loads a game that is already in memory (e.g. generated), same as
+    // `load_game()` otherwise.
+    void load_rom(const unsigned char *data, size_t size);
+    // FNV-1a hash of the loaded game, to tell games apart. Call before
+    // running, the game may overwrite itself.
+    unsigned long long rom_hash();
+    // Switches to the instruction set variant `profile` (see Quirks.h),
+    // dropping everything decoded or translated for the previous one.
+    void set_quirks(quirk_profile profile);
+    quirk_profile get_quirks() { return quirks; }
+    // Seeds the random number generator used by CXNN.
+    void seed(unsigned int value);
+    // Executes one instruction.
     void emulate_cycle();
+    // Executes `count` instructions, returns the number executed. Stops
+    // early if the CPU halts; the skipped instructions still count as
+    // executed (fast-forward) and are added to the idle cycles.
+    unsigned long run(unsigned long count);
+    // Same as `run()` on the threaded interpreter core: table lookup and
+    // computed-goto dispatch instead of the decode cache. Profiling hooks are
+    // not called.
+    unsigned long run_threaded(unsigned long count);
+    // Copies the whole machine into `state`, header and checksum included.
+    void save_state(SaveState &state);
+    // Replaces the machine with `state`. Returns false (and changes nothing)
+    // if the header, checksum or any register is invalid.
+    bool load_state(const SaveState &state);
+    // `save_state()` into `snapshot`, and from now on keeps track of the
+    // memory written so that `reset_to_snapshot()` can undo just that.
+    void save_snapshot(SaveState &snapshot);
+    // Goes back to `snapshot`, which has to be the last one this instance
+    // saved: registers and screen are copied, but only the memory pages
+    // written since and the instructions decoded from them are restored,
+    // instead of everything `initialize()` or `load_state()` clear. For
+    // running many short executions from one starting point (fuzzing).
+    void reset_to_snapshot(const SaveState &snapshot);
+    // Writes `size` bytes to memory from `address` on, as the game storing
+    // them would (anything decoded there is dropped). Stops at the end of
+    // memory.
+    void patch_memory(unsigned short address, const unsigned char *bytes,
+                      size_t size);
+    // The byte at `address`, for looking at game variables (scores, lives).
+    unsigned char read_memory(unsigned short address) {
+        return memory[address];
+    }
+    // Address of the next instruction.
+    unsigned short get_prog_counter() { return prog_counter; }
+    // Halt state, and instruction slots skipped while halted.
+    halt_state get_halt_state() { return halted; }
+    unsigned long get_idle_cycles() { return idle_cycles; }
+    // Counts the delay and sound timers down by one step. Must be called at
+    // 60 Hz of emulated time.
+    void update_timers();
     // Bitmasks values in gfx to &= 0x00, sets `draw_flag` to true.
+    //* Only the planes in `plane_mask`.
     void gfx_clear();
     void gfx_draw_all();
-    // Returns gfx array to help update SDL window.
-    unsigned char *get_gfx();
+    // Returns gfx rows to help update SDL window (see `gfx` for the layout).
+    const Framebuffer &get_gfx();
+    // Rows changed since the last `clear_dirty_rows()`, bit n is row n.
+    uint64_t get_dirty_rows() { return dirty_rows; }
+    void clear_dirty_rows() { dirty_rows = 0; }
+    // XO-CHIP audio pattern (16 bytes, most significant bit first) and
+    // its playback rate, 4000 * 2^((pitch - 64) / 48) samples per second.
+    //* nullptr until the game loaded a pattern.
+    const unsigned char *get_audio_pattern() {
+        return audio_pattern_loaded ? audio_pattern : nullptr;
+    }
+    unsigned char get_pitch() { return pitch; }
+    // The sound plays while the sound timer is non-zero.
+    unsigned char get_sound_timer() { return sound_timer; }
+    // FNV-1a hash of the display, for comparing runs.
+    //* Covers what's visible: plane 0 in the current resolution, plus plane
+    //* 1 if anything was drawn there. A low resolution game hashes the same
+    //* as before hi-res existed.
+    unsigned long long gfx_hash();
     // Draw flags getters/setters
     bool get_draw_flag();
     void set_draw_flag(bool boolean);
+    // Number of unknown opcodes executed since initialize().
+    unsigned long get_unknown_opcodes() { return unknown_opcodes; }
+    // Sends this instance's trace records to `ring`, nullptr to stop. Only
+    // has an effect in builds with CHIP8_TRACE_LEVEL > 0.
+    void attach_trace(TraceRing *ring) { trace_ring = ring; }
+    // Counts into `counters` from now on, nullptr to stop. Only has an
+    // effect in builds with CHIP8_PROFILE.
+    void attach_profile(Profile *counters) { profile = counters; }
+    // Writes the attached profile to PREFIX.json and PREFIX.csv. Returns
+    // false if there's no profile or a file couldn't be written.
+    bool write_profile(const char *prefix);
+    // Attaches a recompiler that has to hear about self-modifying writes.
+    void attach_jit(Chip8Jit *recompiler) { jit = recompiler; }
 
-    //* Pass in array of keys from Chip8Window class and loop through the 16 keys
-    //* and switch their states depending if that key is pressed.
-    //* NOTE: Wondering if I need to work out key-mapping or if the opcode key
-    //* buffer will be enough by itself.
-
-
-    void set_key(int address) {
-        if (address > 0 && address < 16)
-            key[address] = 1;
-    }
+    //* Pass in the mask of pressed keys from Chip8Window (bit n is key n, see
+    //* the key mapping above), replacing the previous state of all 16 keys.
+    //* A newly pressed key also ends an FX0A wait.
+    void set_keys(uint16_t mask);
 
     // Debugging
     void read_binary_opcodes();
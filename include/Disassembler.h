@@ -0,0 +1,11 @@
+#ifndef DISASSEMBLER_H
+#define DISASSEMBLER_H
+
+#include <stddef.h>
+
+// Writes the assembly form of `opcode` (e.g. "LD V3, 0x1F") into `out`,
+// truncated to `size` bytes. Unknown opcodes come out as "DW 0xNNNN".
+// Returns the length of the text.
+int disassemble(unsigned short opcode, char *out, size_t size);
+
+#endif
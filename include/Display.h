@@ -0,0 +1,164 @@
+#ifndef DISPLAY_H
+#define DISPLAY_H
+
+#include "Framebuffer.h"
+#include "Scaler.h"
+#include <array>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Where the frames of a running game go, and where its input comes from.
+//
+// The SDL window (Chip8Window, Graphics.h) is one implementation. The others
+// are headless: they have no input, want every emulated frame rather than the
+// newest one at the present rate (`wants_every_frame()`), and are fed as fast
+// as the emulator runs.
+class Display {
+public:
+    // Save-state hotkeys: F5 saves, F9 loads.
+    enum state_request {
+        STATE_REQUEST_NONE,
+        STATE_REQUEST_SAVE,
+        STATE_REQUEST_LOAD,
+    };
+
+protected:
+    uint32_t color_on   = 0xc18652;
+    uint32_t color_off  = 0xd7c2b0;
+    // XO-CHIP pixels set in plane 1 only, and in both planes
+    uint32_t color_plane2 = 0x8a5a44;
+    uint32_t color_both   = 0x4f3a2e;
+    // uint32_t color_on   = 0xFFFFFF;
+    // uint32_t color_off  = 0x000000;
+    // Cleared when the window is closed or an output fails
+    bool running = true;
+
+    // Indexed by plane 0 bit | plane 1 bit << 1, like expand_pixels()
+    std::array<uint32_t, 4> get_palette() const {
+        return {{color_off, color_on, color_plane2, color_both}};
+    }
+
+public:
+    virtual ~Display() {}
+
+    // Handles pending input events (window, keyboard).
+    virtual void handle_input() {}
+
+    // Shows `gfx`. `dirty_rows` has bit n set if row n changed since the last
+    // call (see `Chip8::get_dirty_rows()`).
+    virtual void update_screen_with_buffer(const Framebuffer &gfx,
+                                           uint64_t dirty_rows) = 0;
+
+    // true for outputs that record every frame (files, pipes): they are
+    // given each 60 Hz frame in order, unthrottled, instead of the newest
+    // one at --present-hz.
+    virtual bool wants_every_frame() { return false; }
+
+    bool is_running() { return running; }
+
+    // Mask of the CHIP-8 keys currently held, for `Chip8::set_keys()`.
+    virtual uint16_t get_keys() { return 0; }
+
+    // true while the rewind key is held.
+    virtual bool is_rewinding() { return false; }
+
+    // Save-state hotkey pressed since the last call, STATE_REQUEST_NONE if
+    // there was none.
+    virtual state_request take_state_request() { return STATE_REQUEST_NONE; }
+};
+
+// Throws every frame away. Runs a game headless at full speed (benchmarks,
+// movies).
+class NullDisplay : public Display {
+public:
+    void update_screen_with_buffer(const Framebuffer &, uint64_t) override {}
+    bool wants_every_frame() override { return true; }
+};
+
+// A frame scaled to 128x64 times `scale` and packed for a file, kept up to
+// date row by row: only the rows a frame changed are converted again.
+class PackedFrame {
+public:
+    enum pixel_format {
+        // 3 bytes per pixel, R G B
+        FORMAT_RGB24,
+        // Planar Y, Cb, Cr at full resolution (BT.601, Y4M's C444)
+        FORMAT_YUV444,
+    };
+
+private:
+    pixel_format format;
+    FrameScaler scaler;
+    // One gfx row scaled, before packing
+    std::vector<uint32_t> scaled;
+
+public:
+    const int width;
+    const int height;
+    // Pixels, after `header_size` bytes left for a per-frame header
+    std::vector<uint8_t> data;
+    const size_t header_size;
+
+    PackedFrame(pixel_format format, scale_filter filter, int scale,
+                const uint32_t palette[4], size_t header_size);
+
+    void update(const Framebuffer &gfx, uint64_t dirty_rows);
+    const uint8_t *pixels() const { return data.data() + header_size; }
+};
+
+// Writes a PPM or PNG picture of every `every`th frame to
+// PREFIX-NNNNNN.ppm/.png, NNNNNN being the frame number (from 1). With
+// `every` 0 only the last frame is written, when the display is closed.
+class SnapshotDisplay : public Display {
+private:
+    std::string prefix;
+    bool png;
+    unsigned long every;
+    unsigned long frames = 0;
+    PackedFrame frame;
+
+    bool write(const char *path);
+
+public:
+    SnapshotDisplay(const char *prefix, bool png, unsigned long every,
+                    scale_filter filter, int scale);
+    ~SnapshotDisplay();
+
+    void update_screen_with_buffer(const Framebuffer &gfx,
+                                   uint64_t dirty_rows) override;
+    bool wants_every_frame() override { return true; }
+};
+
+// Streams every frame as raw video to a file or pipe ("-" for stdout, which
+// sends everything else printed to stderr):
+// YUV4MPEG2 (4:4:4, 60 fps, which ffmpeg and mpv read as is) or headerless
+// RGB24 (`-f rawvideo -pix_fmt rgb24 -s WxH -r 60`). Each frame is packed
+// in place behind its header and goes out with a single write(); an output
+// that fails (closed pipe, full disk) stops the game.
+class StreamDisplay : public Display {
+private:
+    int fd = -1;
+    PackedFrame frame;
+
+    bool write_all(const uint8_t *bytes, size_t size);
+
+public:
+    StreamDisplay(const char *path, bool y4m, scale_filter filter, int scale);
+    ~StreamDisplay();
+
+    bool is_open() { return fd >= 0; }
+    void update_screen_with_buffer(const Framebuffer &gfx,
+                                   uint64_t dirty_rows) override;
+    bool wants_every_frame() override { return true; }
+};
+
+// Opens the display --display names: `sdl` (the window), `null`,
+// `ppm:PREFIX`, `png:PREFIX`, `y4m:FILE` or `rgb:FILE`. `scale` 0 picks the
+// default, 8 for the window and 1 for everything else; `snapshot_every` is
+// for ppm/png. Prints an error and returns nullptr if the name is unknown or
+// the output can't be opened.
+Display *open_display(const char *spec, scale_filter filter, int scale,
+                      unsigned long snapshot_every);
+
+#endif
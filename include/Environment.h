@@ -0,0 +1,155 @@
+#ifndef ENVIRONMENT_H
+#define ENVIRONMENT_H
+
+// C API for running many copies of one game as environments for a trainer
+// (reinforcement learning), possibly in another process.
+//
+// Observations are never returned or copied out. Every `chip8_env_reset()`
+// and `chip8_env_step()` writes the screen, chosen memory bytes and a done
+// flag of every environment straight into a ring of slots in memory the
+// caller provides, typically a memfd_create()/shm_open() mapping that the
+// trainer maps as well:
+//
+//     size_t size = chip8_env_ring_size(envs, slots, watches);
+//     int fd = memfd_create("chip8-env", 0);
+//     ftruncate(fd, size);
+//     void *ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+//                       fd, 0);
+//     chip8_env *env = chip8_env_create(&config, ring, size);
+//
+// Each call fills the next slot and then publishes it by incrementing
+// `published` in the ring header. Slot contents stay valid until
+// `slot_count` more calls reuse the slot. Rows of the screen that didn't
+// change since a slot was last written are not written again.
+//
+// The environments run on lockstep batches (see Lockstep.h), so copies on
+// the same path share the work of register instructions.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// "C8EV"
+#define CHIP8_ENV_RING_MAGIC 0x56453843u
+#define CHIP8_ENV_RING_VERSION 1u
+
+// At the start of the ring, filled in by chip8_env_create().
+typedef struct chip8_env_ring_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t env_count;
+    uint32_t slot_count;
+    // Memory bytes in every observation
+    uint32_t watch_count;
+    // Bytes from one observation to the next within a slot
+    uint32_t observation_size;
+    // Bytes from one slot to the next, and from the start of the ring to
+    // slot 0
+    uint64_t slot_size;
+    uint64_t slots_offset;
+    // Resets and steps written so far. Number n (from 1) is in slot
+    // (n - 1) % slot_count. Read with acquire ordering, e.g.
+    // __atomic_load_n(&header->published, __ATOMIC_ACQUIRE).
+    uint64_t published;
+} chip8_env_ring_header;
+
+// At the start of every slot, followed by one observation per environment
+// at sizeof(chip8_env_slot_header) + env * observation_size.
+typedef struct chip8_env_slot_header {
+    // Which reset or step the slot holds (see `published`)
+    uint64_t number;
+    // Frames the environments ran for it, 0 for a reset
+    uint32_t frames;
+    uint32_t reserved;
+} chip8_env_slot_header;
+
+// One environment after a reset or step, followed by `watch_count` memory
+// bytes (see chip8_env_watched()).
+typedef struct chip8_env_observation {
+    // The screen in Framebuffer's layout (see Framebuffer.h): planes of 64
+    // rows, a row is two words of 64 pixels, the leftmost in the most
+    // significant bit. Only the top-left 64x32 pixels are used unless
+    // `hires` is set.
+    uint64_t planes[2][64][2];
+    uint8_t hires;
+    // Set once the game faulted or ran `max_episode_frames` frames since
+    // its last reset, until it is reset again
+    uint8_t done;
+    // The CPU's halt_state (see Chip8.h)
+    uint8_t halted;
+    uint8_t reserved;
+    // Frames run since the last reset
+    uint32_t episode_frame;
+} chip8_env_observation;
+
+typedef struct chip8_env_config {
+    const unsigned char *rom;
+    size_t rom_size;
+    uint32_t env_count;
+    // A quirk_profile (see Quirks.h), 0 is QUIRKS_DEFAULT
+    uint32_t profile;
+    // Emulated CPU speed, 0 for 700
+    uint32_t instructions_per_second;
+    // Slots in the ring, at least 1
+    uint32_t slot_count;
+    // Threads stepping the environments, each owning an equal share of
+    // them. 0 or 1 steps them all on the calling thread.
+    uint32_t threads;
+    // Episode length in frames after which `done` is set, 0 for no limit
+    uint32_t max_episode_frames;
+    // Addresses whose bytes are copied into every observation (score,
+    // lives, ...), `watch_count` of them
+    const uint16_t *watch_addresses;
+    uint32_t watch_count;
+} chip8_env_config;
+
+typedef struct chip8_env chip8_env;
+
+// Bytes of ring memory chip8_env_create() needs.
+size_t chip8_env_ring_size(uint32_t env_count, uint32_t slot_count,
+                           uint32_t watch_count);
+// `config->env_count` copies of the ROM writing into `ring` (`ring_size`
+// bytes, 64 byte aligned). Environment n starts seeded with n + 1; nothing
+// is published before the first reset or step. Returns NULL, with a
+// message on stderr, if the config is invalid or the ring too small.
+chip8_env *chip8_env_create(const chip8_env_config *config, void *ring,
+                            size_t ring_size);
+void chip8_env_destroy(chip8_env *env);
+// Restarts environment n with seed `seeds[n]`, only those with
+// `selected[n]` non-zero unless `selected` is NULL, and publishes a slot
+// with every environment's observation. Returns the slot's number.
+uint64_t chip8_env_reset(chip8_env *env, const uint32_t *seeds,
+                         const uint8_t *selected);
+// Runs `frame_skip` (at least 1) frames on every environment, n holding
+// keys `key_masks[n]` (bit k is key k), and publishes a slot with their
+// observations. Returns the slot's number, 0 if `frame_skip` is 0.
+uint64_t chip8_env_step(chip8_env *env, const uint16_t *key_masks,
+                        uint32_t frame_skip);
+
+// Environment `index`'s observation for reset or step `number`.
+static inline const chip8_env_observation *
+chip8_env_observation_at(const void *ring, uint64_t number, uint32_t index) {
+    const chip8_env_ring_header *header = (const chip8_env_ring_header *)ring;
+    const unsigned char *slot =
+        (const unsigned char *)ring + header->slots_offset +
+        (number - 1) % header->slot_count * header->slot_size;
+    return (const chip8_env_observation *)(slot +
+                                           sizeof(chip8_env_slot_header) +
+                                           (size_t)index *
+                                               header->observation_size);
+}
+
+// The watched memory bytes after `observation`.
+static inline const uint8_t *
+chip8_env_watched(const chip8_env_observation *observation) {
+    return (const uint8_t *)(observation + 1);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Screen contents, one bit per pixel in up to two planes (XO-CHIP draws in
+// both, everything else only in plane 0).
+//
+// Rows are 128 pixels wide, stored as two words with the leftmost pixel in the
+// most significant bit of word 0, so a sprite row can be drawn with a couple
+// of shifts and an XOR, and a whole row is one 16 byte vector. In low
+// resolution only the top-left 64x32 pixels (word 0 of rows 0-31) are used,
+// the same layout the core had before hi-res existed.
+struct Framebuffer {
+    alignas(16) uint64_t planes[2][64][2];
+    // 128x64 (SUPER-CHIP 00FF) rather than 64x32
+    bool hires;
+
+    int width() const { return hires ? 128 : 64; }
+    int height() const { return hires ? 64 : 32; }
+};
+
+// Row operations used by the CPU core on one plane (`rows` is
+// `Framebuffer::planes[p]`). They work on whole packed rows, with SSE2 where
+// the host has it; nothing here loops over pixels.
+
+// Moves the first `height` rows down (towards row `height` - 1) or up by `n`
+// rows, clearing the rows scrolled in.
+void scroll_down(uint64_t (*rows)[2], int height, int n);
+void scroll_up(uint64_t (*rows)[2], int height, int n);
+// Moves the first `height` rows right or left by `n` (1-63) pixels, clearing
+// the pixels scrolled in. Pixels pushed past `width` (64 or 128) are dropped.
+void scroll_right(uint64_t (*rows)[2], int height, int width, int n);
+void scroll_left(uint64_t (*rows)[2], int height, int width, int n);
+void clear_rows(uint64_t (*rows)[2]);
+
+// XORs the pixels `left` (0-63) and `right` (64-127) into `row`. Returns
+// non-zero if a set pixel was turned off.
+static inline uint64_t blit_row(uint64_t *row, uint64_t left,
+                                uint64_t right) {
+#if defined(__SSE2__)
+    __m128i old = _mm_load_si128((const __m128i *)row);
+    __m128i pixels = _mm_set_epi64x(right, left);
+    _mm_store_si128((__m128i *)row, _mm_xor_si128(old, pixels));
+    __m128i hit = _mm_and_si128(old, pixels);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(hit, _mm_setzero_si128())) !=
+           0xFFFF;
+#else
+    uint64_t hit = (row[0] & left) | (row[1] & right);
+    row[0] ^= left;
+    row[1] ^= right;
+    return hit;
+#endif
+}
+
+#endif
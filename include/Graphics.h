@@ -1,9 +1,14 @@
 #ifndef GRAPHICS_H
 #define GRAPHICS_H
 
+#include "Display.h"
+#include "Framebuffer.h"
+#include "Scaler.h"
 #include <SDL2/SDL.h>
+#include <stdint.h>
 
-class Chip8Window {
+// The SDL window: the display backend for playing.
+class Chip8Window : public Display {
 private:
     SDL_Window *window = nullptr;
     SDL_Surface *surface = nullptr;
@@ -12,14 +17,23 @@ private:
     SDL_Rect dest_rect;
     SDL_Event event;
     Uint32 *pixels;
-    Uint32 color_on   = 0xc18652;
-    Uint32 color_off  = 0xd7c2b0;
-    // Uint32 color_on   = 0xFFFFFF;
-    // Uint32 color_off  = 0x000000;
-    bool running = true;
-    int width   = 64;
-    int height  = 32;
-    int scale   = 15;
+    // Keypad state, bit n is set while CHIP-8 key n is held (see
+    // key_mappings).
+    uint16_t keys = 0;
+    // Last save-state hotkey pressed, until `take_state_request()`.
+    state_request pending_state_request = STATE_REQUEST_NONE;
+    // Backspace is held (rewind)
+    bool rewinding = false;
+    // The SUPER-CHIP high resolution, low resolution pixels are drawn twice
+    // as big. The window is `scale` times that.
+    int width   = 128;
+    int height  = 64;
+    int scale   = 8;
+    // FILTER_SDL uploads a 128x64 texture and lets the renderer stretch it,
+    // the CPU filters fill a texture as big as the window.
+    int texture_width;
+    int texture_height;
+    FrameScaler *scaler;
 
     enum key_mappings {
         KEY_PRESS_1,
@@ -40,10 +54,17 @@ private:
         KEY_PRESS_V,
     };
 
-    // helper method that simply a key 
-    void input_set_key(int key_num) {
+    // helper method that simply sets or clears a key in `keys`
+    void input_set_key(int key_num, bool pressed) {
+        if (pressed)
+            keys |= 1 << key_num;
+        else
+            keys &= ~(1 << key_num);
     }
 
+    // CHIP-8 key (key_mappings) for a keyboard key, -1 if it isn't mapped.
+    int key_from_keycode(SDL_Keycode sym);
+
 public:
     /**
      * @brief Construct a new Chip 8 Window:: Chip 8 Window object.
@@ -53,8 +74,11 @@ public:
      * - Scales SDL_window properly to avoid having to view a (literal) 64x32 pixel display.
      *
      * - Pixels are mutable through the `update_gfx()` method.
+     *
+     * - `filter` and `scale` (window pixels per 128x64 pixel) pick how the
+     *   framebuffer is scaled up to the window, see Scaler.h.
      */
-    Chip8Window();
+    Chip8Window(scale_filter filter = FILTER_SDL, int scale = 8);
 
     /**
      * @brief Destroy the Chip 8 Window object
@@ -66,16 +90,29 @@ public:
      * @brief Handles standard window events (keyboard events, quitting, etc)
      *
      */
-    void handle_input();
+    void handle_input() override;
 
     void update_screen();
 
-    void update_screen_with_buffer(unsigned char *gfx);
+    // Expands the 1 bit per pixel rows from `Chip8::get_gfx()` to colors and
+    // presents them. Only the rows set in `dirty_rows` (see
+    // `Chip8::get_dirty_rows()`) are converted and uploaded (with their
+    // neighbours for Scale2x/3x), and nothing is presented if no row changed.
+    void update_screen_with_buffer(const Framebuffer &gfx,
+                                   uint64_t dirty_rows) override;
 
     void set_pixels();
 
-    // gets is_running_state
-    bool is_running();
+    uint16_t get_keys() override { return keys; }
+
+    // true while the rewind key (Backspace) is held.
+    bool is_rewinding() override { return rewinding; }
+
+    state_request take_state_request() override {
+        state_request request = pending_state_request;
+        pending_state_request = STATE_REQUEST_NONE;
+        return request;
+    }
 
     // Switches is_running bool to on or off
     void flip_game_running();
@@ -0,0 +1,85 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stddef.h>
+
+class Chip8;
+struct QuirkFlags;
+
+// Dynamic recompiler for the CHIP-8 CPU core.
+//
+// Straight-line runs of register/ALU instructions are translated into native
+// x86-64 code that works directly on the `V`, `index_register` and `memory`
+// fields of a Chip8. A block stops in front of the first instruction it can't
+// translate (jumps, calls, returns, skips, drawing, timers, ...), which is then
+// executed by the interpreter, so `Chip8::emulate_cycle()` stays the reference
+// implementation.
+//
+// Addresses that the program writes to (FX33/FX55) are never translated again
+// and always fall back to the interpreter. Blocks are translated for the
+// quirk profile the Chip8 has at the time; `Chip8::set_quirks()` resets the
+// recompiler.
+class Chip8Jit {
+private:
+    // Translated code is called as block(V, &index_register, memory) and
+    // returns the number of CHIP-8 instructions it executed.
+    typedef int (*BlockFn)(unsigned char *V, unsigned short *index_register,
+                           const unsigned char *memory);
+
+    struct Block {
+        BlockFn code;           // nullptr if the address can't be translated
+        unsigned short length;  // number of translated instructions
+        bool compiled;          // false until the address has been looked at
+    };
+
+    // Longest run of instructions translated into one block.
+    static const int max_block_length = 64;
+
+    Block blocks[4096];
+    // true for every byte that is part of a translated block
+    bool covered[4096];
+    // true for every byte the program has written to
+    bool self_modified[4096];
+
+    unsigned char *code_buffer = nullptr;
+    size_t code_capacity = 0;
+    size_t code_used = 0;
+
+    // Translates the block starting at `address`.
+    void compile(const Chip8 &chip8, unsigned short address);
+    // Appends the translation of one opcode, as it behaves under `quirks`, to
+    // the code buffer. Returns false if the opcode has to be left to the
+    // interpreter.
+    bool emit_instruction(unsigned short opcode, int executed,
+                          const QuirkFlags &quirks);
+    void emit_vf_reset(const QuirkFlags &quirks);
+    // Throws away every translated block.
+    void flush();
+
+    void emit(unsigned char byte) { code_buffer[code_used++] = byte; }
+    void emit32(unsigned int value);
+
+public:
+    Chip8Jit();
+    ~Chip8Jit();
+
+    // false if executable memory couldn't be set up (or the host isn't
+    // x86-64). `step()` then always uses the interpreter.
+    bool is_supported() { return code_buffer != nullptr; }
+
+    // Runs the block at the current program counter, or one interpreted
+    // instruction if there is no block there. Returns the number of CHIP-8
+    // instructions executed.
+    int step(Chip8 &chip8);
+    // Keeps stepping until at least `count` instructions ran. Returns the
+    // number executed, which can overshoot by the tail of the last block.
+    unsigned long run(Chip8 &chip8, unsigned long count);
+
+    // Called by Chip8 whenever the program writes to `address`.
+    void invalidate(unsigned short address);
+    // Forgets all translations and writes, for when the whole memory was
+    // replaced (loading a save state).
+    void reset();
+};
+
+#endif
@@ -0,0 +1,121 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include "Chip8.h"
+#include "Quirks.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+struct SaveState;
+
+// Many copies of one game stepped together, each with its own input
+// (reinforcement learning, search).
+//
+// The hot registers of all machines (V, I, program counter, timers, stack
+// pointer, keys, random state) are kept as structure-of-arrays, one array
+// per register with an entry per lane. Every cycle the lanes are grouped by
+// program counter, and a group whose instruction is register-only (6XNN,
+// 7XNN, 8XYN, skips, jumps, ANNN, CXNN, timers, ...) executes it for all its
+// lanes at once, 32 lanes per AVX2 vector. Everything else, and lanes that
+// wrote over the code they are running, goes through each lane's own Chip8
+// (`emulate_cycle()`), which also holds its memory, screen and stack
+// entries. A lane that falls back runs on in its machine until it gets to an
+// instruction the kernels handle again. Games that keep their lanes on the
+// same path, as most do until the inputs make them diverge, then pay for one
+// instruction per group instead of one per lane.
+//
+// Lanes behave exactly like a Chip8 driven with `set_keys()`, `run()` and
+// `update_timers()` once per frame. Tracing and profiling hooks are not
+// called.
+class LockstepBatch {
+private:
+    // Lanes per vector, and per word of the lane masks
+    static const size_t block_lanes = 32;
+
+    size_t lanes;
+    // lanes rounded up to whole blocks, the padding lanes never run
+    size_t padded;
+    QuirkFlags flags;
+    const OpcodeKindTable *kind_table;
+    unsigned long cycles_per_frame;
+    std::vector<Chip8 *> machines;
+    // Every lane right after loading, see `reset_lane()`
+    SaveState *initial = nullptr;
+    // The first 4K as loaded. Lanes run from this instead of their own
+    // memory while nothing wrote to the code they are at.
+    unsigned char code[0x1000];
+    // 256 byte pages of the first 4K that some lane wrote to (bit n is
+    // 0x100 * n), see `Chip8::dirty_pages`
+    uint16_t code_written = 0;
+
+    // Registers, one entry per lane
+    std::vector<uint8_t> V[16];
+    std::vector<uint16_t> index_register;
+    std::vector<uint16_t> prog_counter;
+    std::vector<uint16_t> opcode;
+    std::vector<uint16_t> sp;
+    std::vector<uint8_t> stack_current_size;
+    std::vector<uint8_t> delay_timer;
+    std::vector<uint8_t> sound_timer;
+    std::vector<uint8_t> halted;
+    std::vector<uint16_t> keys;
+    std::vector<uint32_t> rng_state;
+
+    // Bit per lane, a word per block: lanes that still have to execute the
+    // current cycle, and the group executing right now
+    std::vector<uint32_t> pending;
+    std::vector<uint32_t> group;
+    // Lanes that ran the next cycles already (see `run_scalar()`), bit per
+    // lane, and how many cycles each of them is ahead
+    std::vector<uint32_t> ahead_lanes;
+    std::vector<uint32_t> ahead;
+
+    unsigned long long vector_steps = 0;
+    unsigned long long scalar_steps = 0;
+
+    // Copies lane `lane`'s registers into its machine and back.
+    void to_machine(size_t lane);
+    void from_machine(size_t lane);
+    // Executes one instruction on every lane that isn't halted. Returns
+    // false if they all are.
+    bool step_cycle(unsigned long cycle);
+    // Whether the vector kernels handle the instruction at `pc`.
+    bool vectorizable(unsigned short pc);
+    // Executes the instruction at `pc` on the lanes in `group`, from block
+    // `first` on. Returns false, having done nothing, if it isn't
+    // vectorizable.
+    bool run_vector(unsigned short pc, size_t first);
+    // Runs one lane through its machine, from the instruction of `cycle` up
+    // to the next vectorizable one or the end of the frame.
+    void run_scalar(size_t lane, unsigned long cycle);
+
+public:
+    // `lanes` machines running `rom` under `profile`, lane n seeded with
+    // `seed + n`. A step is one 60 Hz frame of `instructions_per_second`.
+    LockstepBatch(size_t lanes, const unsigned char *rom, size_t size,
+                  quirk_profile profile, unsigned int seed,
+                  unsigned int instructions_per_second = 700);
+    ~LockstepBatch();
+    LockstepBatch(const LockstepBatch &) = delete;
+    LockstepBatch &operator=(const LockstepBatch &) = delete;
+
+    size_t size() { return lanes; }
+    // Runs one frame on every lane: lane n's keys become `actions[n]` (bit
+    // k is key k, as for `Chip8::set_keys()`), then it executes the frame's
+    // instructions and its timers tick once.
+    void step_batch(const uint16_t *actions);
+    // Puts lane `lane` back to where it started, with a new seed.
+    void reset_lane(size_t lane, unsigned int seed);
+    // Lane `lane`'s machine with its registers brought up to date, for
+    // reading its screen or saving its state. Changes made through it are
+    // not picked up by the batch.
+    Chip8 &get_machine(size_t lane);
+    // Lane `lane`'s halt state, without `get_machine()`'s copying.
+    halt_state get_halt_state(size_t lane) { return (halt_state)halted[lane]; }
+    // Lane instructions executed by the vector kernels and one by one.
+    unsigned long long get_vector_steps() { return vector_steps; }
+    unsigned long long get_scalar_steps() { return scalar_steps; }
+};
+
+#endif
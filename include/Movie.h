@@ -0,0 +1,65 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include "Quirks.h"
+#include <stdint.h>
+#include <vector>
+
+class Chip8;
+class Display;
+
+// Input recording ("movie") for reproducing a run exactly.
+//
+// Execution is quantized into 60 Hz frames: set the keys, run the frame's
+// share of instructions (see `Scheduler::instructions_for_tick()`), count the
+// timers down. With the same seed, ROM, quirk profile and instruction rate,
+// feeding the same key mask every frame reproduces the run bit for bit, so a
+// movie only has to store those plus framebuffer hashes to check against.
+//
+// File layout (host byte order):
+//   MovieHeader
+//   uint16_t keys[frame_count]           key mask set at the start of frame n
+//   uint64_t checkpoints[frame_count / checkpoint_interval]
+//                                        Chip8::gfx_hash() after frame
+//                                        (i + 1) * checkpoint_interval - 1
+#define MOVIE_MAGIC "C8MOVIE1"
+#define MOVIE_VERSION 1
+
+struct MovieHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t seed;
+    uint64_t rom_hash;
+    uint32_t instructions_per_second;
+    uint32_t checkpoint_interval;
+    uint32_t frame_count;
+    uint32_t quirks; // quirk_profile, 0 (QUIRKS_DEFAULT) in older movies
+};
+
+class Movie {
+public:
+    unsigned int seed = 0;
+    unsigned long long rom_hash = 0;
+    unsigned int instructions_per_second = 700;
+    unsigned int checkpoint_interval = 60;
+    quirk_profile quirks = QUIRKS_DEFAULT;
+    std::vector<uint16_t> keys;
+    std::vector<uint64_t> checkpoints;
+
+    // Appends a frame that ran with `mask` held. Call after the frame's
+    // timer update, `chip8` is hashed for the checkpoints.
+    void record_frame(uint16_t mask, Chip8 &chip8);
+
+    // Returns false if the file can't be written.
+    bool save(const char *path);
+    // Returns false if the file can't be read or isn't a movie.
+    bool load(const char *path);
+};
+
+// Runs a movie headless and as fast as possible, checking every checkpoint.
+// Every frame also goes to `display` unless it's nullptr (to record the movie
+// as video). Prints the outcome; returns 0 if every checkpoint matched.
+int replay_movie(const char *movie_path, const char *rom_path,
+                 Display *display = nullptr);
+
+#endif
@@ -0,0 +1,178 @@
+#ifndef OPCODE_TABLE_H
+#define OPCODE_TABLE_H
+
+#include "Chip8.h"
+
+// Which instruction an opcode is, worked out the same way for all engines.
+// Only the bits the interpreter has always looked at count, so e.g. every
+// 0NN0 is 00E0 and every 0NNE is 00EE.
+constexpr opcode_kind opcode_kind_of(unsigned short op) {
+    switch (op & 0xF000) {
+    case 0x0000:
+        if ((op & 0x000F) == 0x0000)
+            return OP_00E0;
+        if ((op & 0x000F) == 0x000E)
+            return OP_00EE;
+        return OP_UNKNOWN;
+    case 0x1000:
+        return OP_1NNN;
+    case 0x2000:
+        return OP_2NNN;
+    case 0x3000:
+        return OP_3XNN;
+    case 0x4000:
+        return OP_4XNN;
+    case 0x5000:
+        return OP_5XY0;
+    case 0x6000:
+        return OP_6XNN;
+    case 0x7000:
+        return OP_7XNN;
+    case 0x8000:
+        switch (op & 0x000F) {
+        case 0x0000:
+            return OP_8XY0;
+        case 0x0001:
+            return OP_8XY1;
+        case 0x0002:
+            return OP_8XY2;
+        case 0x0003:
+            return OP_8XY3;
+        case 0x0004:
+            return OP_8XY4;
+        case 0x0005:
+            return OP_8XY5;
+        case 0x0006:
+            return OP_8XY6;
+        case 0x0007:
+            return OP_8XY7;
+        case 0x000E:
+            return OP_8XYE;
+        }
+        return OP_UNKNOWN;
+    case 0x9000:
+        return OP_9XY0;
+    case 0xA000:
+        return OP_ANNN;
+    case 0xB000:
+        return OP_BNNN;
+    case 0xC000:
+        return OP_CXNN;
+    case 0xD000:
+        return OP_DXYN;
+    case 0xE000:
+        if ((op & 0x00FF) == 0x009E)
+            return OP_EX9E;
+        if ((op & 0x00FF) == 0x00A1)
+            return OP_EXA1;
+        return OP_UNKNOWN;
+    default: // 0xF000
+        switch (op & 0x00FF) {
+        case 0x0007:
+            return OP_FX07;
+        case 0x000A:
+            return OP_FX0A;
+        case 0x0015:
+            return OP_FX15;
+        case 0x0018:
+            return OP_FX18;
+        case 0x001E:
+            return OP_FX1E;
+        case 0x0029:
+            return OP_FX29;
+        case 0x0033:
+            return OP_FX33;
+        case 0x0055:
+            return OP_FX55;
+        case 0x0065:
+            return OP_FX65;
+        }
+        return OP_UNKNOWN;
+    }
+}
+
+// The same for the SUPER-CHIP and XO-CHIP instruction set, which needs the
+// 0NNN, 5XYN and FXNN groups matched exactly. Everything else decodes as
+// above.
+constexpr opcode_kind opcode_kind_of_extended(unsigned short op) {
+    switch (op & 0xF000) {
+    case 0x0000:
+        if ((op & 0xFFF0) == 0x00C0)
+            return OP_00CN;
+        if ((op & 0xFFF0) == 0x00D0)
+            return OP_00DN;
+        switch (op) {
+        case 0x00E0:
+            return OP_00E0;
+        case 0x00EE:
+            return OP_00EE;
+        case 0x00FB:
+            return OP_00FB;
+        case 0x00FC:
+            return OP_00FC;
+        case 0x00FD:
+            return OP_00FD;
+        case 0x00FE:
+            return OP_00FE;
+        case 0x00FF:
+            return OP_00FF;
+        }
+        return OP_UNKNOWN;
+    case 0x5000:
+        switch (op & 0x000F) {
+        case 0x0000:
+            return OP_5XY0;
+        case 0x0002:
+            return OP_5XY2;
+        case 0x0003:
+            return OP_5XY3;
+        }
+        return OP_UNKNOWN;
+    case 0xF000:
+        if (op == 0xF000)
+            return OP_F000;
+        if (op == 0xF002)
+            return OP_F002;
+        switch (op & 0x00FF) {
+        case 0x0001:
+            return OP_FN01;
+        case 0x0030:
+            return OP_FX30;
+        case 0x003A:
+            return OP_FX3A;
+        case 0x0075:
+            return OP_FX75;
+        case 0x0085:
+            return OP_FX85;
+        }
+        return opcode_kind_of(op);
+    default:
+        return opcode_kind_of(op);
+    }
+}
+
+// opcode_kind of every possible opcode, one lookup instead of nested
+// switches. Generated at compile time from `opcode_kind_of()` or
+// `opcode_kind_of_extended()`.
+struct OpcodeKindTable {
+    unsigned char kinds[65536];
+
+    constexpr unsigned char operator[](unsigned short op) const {
+        return kinds[op];
+    }
+};
+
+constexpr OpcodeKindTable make_opcode_kind_table(bool extended) {
+    OpcodeKindTable table = {};
+    for (unsigned int op = 0; op < 65536; op++)
+        table.kinds[op] = extended ? opcode_kind_of_extended(op)
+                                   : opcode_kind_of(op);
+    return table;
+}
+
+// Defined (and generated) once, in OpcodeTable.cpp. The quirk profile picks
+// which one a Chip8 decodes with (`Quirks::super_chip`).
+extern const OpcodeKindTable opcode_kinds;
+extern const OpcodeKindTable opcode_kinds_extended;
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "Chip8.h"
+#include <chrono>
+#include <stdio.h>
+
+// Execution profiler for the CPU core.
+//
+// Compiled in only when CHIP8_PROFILE is 1 (`make PROFILE=1`); otherwise the
+// CHIP8_PROFILE_HOOK() calls in the core expand to nothing. When compiled in,
+// an instance counts into the Profile attached with `Chip8::attach_profile()`.
+// A Profile belongs to one instance and is only touched by the thread running
+// it, so the counters are plain integers.
+//
+// Only instructions that go through `Chip8::emulate_cycle()` are counted,
+// blocks run by the JIT are not.
+#ifndef CHIP8_PROFILE
+#define CHIP8_PROFILE 0
+#endif
+
+#if CHIP8_PROFILE
+#define CHIP8_PROFILE_HOOK(profile, call)                                      \
+    do {                                                                       \
+        if ((profile) != nullptr)                                              \
+            (profile)->call;                                                   \
+    } while (0)
+#else
+#define CHIP8_PROFILE_HOOK(profile, call) ((void)0)
+#endif
+
+class Profile {
+public:
+    using profile_clock = std::chrono::steady_clock;
+
+    // Executions per opcode_kind
+    unsigned long long opcodes[OP_KIND_COUNT] = {};
+    // Executions per address (heatmap)
+    unsigned long long pcs[4096] = {};
+    // Executions at each call depth, 16 and deeper share the last slot
+    unsigned long long depths[17] = {};
+    // Per subroutine entry point: calls made to it, and instructions executed
+    // in it (not counting the subroutines it calls). Code outside any
+    // subroutine is counted under 0x200.
+    unsigned long long calls[4096] = {};
+    unsigned long long subroutine_instructions[4096] = {};
+    unsigned int max_depth = 0;
+    // DXYN executions and the time spent in them
+    unsigned long long sprites = 0;
+    unsigned long long sprite_ns = 0;
+
+    void instruction(unsigned short pc, unsigned char kind,
+                     unsigned int depth) {
+        opcodes[kind]++;
+        pcs[pc & 0xFFF]++;
+        depths[depth < 16 ? depth : 16]++;
+        subroutine_instructions[subroutine]++;
+    }
+
+    void call(unsigned short target, unsigned int depth) {
+        if (entered < 16)
+            subroutine_stack[entered] = subroutine;
+        entered++;
+        subroutine = target & 0xFFF;
+        calls[subroutine]++;
+        if (depth > max_depth)
+            max_depth = depth;
+    }
+
+    void ret() {
+        if (entered == 0)
+            return;
+        entered--;
+        subroutine = entered < 16 ? subroutine_stack[entered] : 0x200;
+    }
+
+    void sprite(profile_clock::time_point start) {
+        sprites++;
+        sprite_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         profile_clock::now() - start)
+                         .count();
+    }
+
+    // Writes everything as one JSON object.
+    void write_json(FILE *file);
+    // Writes the heatmap as CSV: address, opcode there now, executions.
+    // `memory` is the instance's memory, to look the opcodes up.
+    void write_csv(FILE *file, const unsigned char *memory);
+    // Writes PREFIX.json and PREFIX.csv, returns false if either failed.
+    bool write_files(const char *prefix, const unsigned char *memory);
+
+private:
+    // Entry points of the subroutines being run, for attributing instructions
+    unsigned short subroutine = 0x200;
+    unsigned short subroutine_stack[16] = {};
+    unsigned int entered = 0;
+};
+
+// Name of an opcode_kind, e.g. "8XY4".
+const char *opcode_kind_name(unsigned char kind);
+
+#endif
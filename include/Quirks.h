@@ -0,0 +1,137 @@
+#ifndef QUIRKS_H
+#define QUIRKS_H
+
+#include <stddef.h>
+#include <utility>
+#include <vector>
+
+// Instruction set quirks
+//
+// A handful of instructions behave differently depending on which CHIP-8
+// implementation a game was written for, and the later ones add instructions
+// of their own. Each profile below is a policy of
+// compile-time constants, and the handlers those instructions go through are
+// templates over it (see Chip8.h), so every profile gets its own instantiation
+// with the decisions folded away instead of a flag test per instruction.
+//
+// Profile of a game: `--quirks=NAME` if given, else its ROM hash looked up in
+// a QuirkTable, else QUIRKS_DEFAULT.
+
+// What this emulator has always done.
+struct QuirksDefault {
+    // 8XY6/8XYE shift VY into VX instead of shifting VX in place
+    static constexpr bool shift_vy = false;
+    // FX55/FX65 leave I pointing past the last register they touched
+    static constexpr bool increment_index = false;
+    // BNNN jumps to XNN + VX (BXNN) instead of NNN + V0
+    static constexpr bool jump_vx = false;
+    // DXYN wraps sprites around the screen edges instead of clipping them
+    static constexpr bool wrap_sprites = false;
+    // 8XY1/8XY2/8XY3 reset VF to 0
+    static constexpr bool vf_reset = false;
+    // SUPER-CHIP instructions: 128x64 hi-res, scrolling, 16x16 sprites, big
+    // font, flag registers
+    static constexpr bool super_chip = false;
+    // XO-CHIP on top of that: 64 KiB of memory, two bitplanes, audio
+    // pattern, scrolling up, register ranges, long I loads
+    static constexpr bool xo_chip = false;
+};
+
+// The original COSMAC VIP interpreter.
+struct QuirksChip8 {
+    static constexpr bool shift_vy = true;
+    static constexpr bool increment_index = true;
+    static constexpr bool jump_vx = false;
+    static constexpr bool wrap_sprites = false;
+    static constexpr bool vf_reset = true;
+    static constexpr bool super_chip = false;
+    static constexpr bool xo_chip = false;
+};
+
+// SUPER-CHIP 1.1 on the HP 48.
+struct QuirksSuperChip {
+    static constexpr bool shift_vy = false;
+    static constexpr bool increment_index = false;
+    static constexpr bool jump_vx = true;
+    static constexpr bool wrap_sprites = false;
+    static constexpr bool vf_reset = false;
+    static constexpr bool super_chip = true;
+    static constexpr bool xo_chip = false;
+};
+
+// XO-CHIP (Octo).
+struct QuirksXoChip {
+    static constexpr bool shift_vy = true;
+    static constexpr bool increment_index = true;
+    static constexpr bool jump_vx = false;
+    static constexpr bool wrap_sprites = true;
+    static constexpr bool vf_reset = false;
+    static constexpr bool super_chip = true;
+    static constexpr bool xo_chip = true;
+};
+
+// The profiles above, in the order of the handler tables. Stored in save
+// states and movies, so only ever append.
+enum quirk_profile {
+    QUIRKS_DEFAULT,
+    QUIRKS_CHIP8,
+    QUIRKS_SUPERCHIP,
+    QUIRKS_XOCHIP,
+    QUIRK_PROFILE_COUNT,
+};
+
+// The same switches as plain values, for code that only looks at them once
+// per translation (the JIT) rather than on every instruction.
+struct QuirkFlags {
+    bool shift_vy;
+    bool increment_index;
+    bool jump_vx;
+    bool wrap_sprites;
+    bool vf_reset;
+    bool super_chip;
+    bool xo_chip;
+};
+
+template <class Quirks>
+constexpr QuirkFlags quirk_flags_of() {
+    return {Quirks::shift_vy, Quirks::increment_index, Quirks::jump_vx,
+            Quirks::wrap_sprites, Quirks::vf_reset, Quirks::super_chip,
+            Quirks::xo_chip};
+}
+
+QuirkFlags quirk_flags(quirk_profile profile);
+// Name used by --quirks and in quirk tables.
+const char *quirk_profile_name(quirk_profile profile);
+// Returns false if `name` isn't a profile.
+bool parse_quirk_profile(const char *name, quirk_profile &profile);
+
+// ROM hash (`Chip8::rom_hash()`) to profile, for picking the quirks of every
+// game in a mixed library automatically.
+//
+// Table files have one game per line: the hash as 16 hex digits, whitespace,
+// the profile name, then anything (usually the game's title). Blank lines and
+// lines starting with # are skipped. The emulator prints the hash and profile
+// of every game it loads, which is the easiest way to fill one in.
+class QuirkTable {
+private:
+    // Sorted by hash for binary search
+    std::vector<std::pair<unsigned long long, quirk_profile>> entries;
+    // Overrides every lookup when set (--quirks=NAME)
+    bool forced = false;
+    quirk_profile forced_profile = QUIRKS_DEFAULT;
+
+public:
+    // Adds the games in `path`, later entries replace earlier ones. Returns
+    // false if the file can't be read; malformed lines are skipped with a
+    // warning.
+    bool load(const char *path);
+    // Adds or replaces a single game.
+    void add(unsigned long long rom_hash, quirk_profile profile);
+    // Makes every game use `profile`.
+    void force(quirk_profile profile);
+    // Profile for a game, QUIRKS_DEFAULT if the table doesn't know it.
+    quirk_profile lookup(unsigned long long rom_hash) const;
+    size_t size() const { return entries.size(); }
+};
+
+#endif
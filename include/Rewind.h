@@ -0,0 +1,78 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include "SaveState.h"
+#include <deque>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Bounded history of save states for rewinding.
+//
+// A snapshot is pushed every frame. Every `keyframe_interval`-th snapshot is
+// a keyframe, stored whole; the ones in between are stored as the XOR against
+// the latest keyframe, which is zero almost everywhere since most of memory
+// doesn't change from frame to frame. Both are run-length encoded as
+//   (zero run length, literal length, literal bytes) ...
+// with the lengths as LEB128 varints.
+//
+// Encoded snapshots live in one fixed-size byte ring. When it fills up the
+// oldest snapshots are dropped, along with deltas left without their keyframe,
+// so memory use never goes past `capacity` (plus one decoded keyframe to XOR
+// against). A snapshot too big for the whole ring drops the history instead
+// of being recorded, see `min_capacity()`.
+class RewindBuffer {
+private:
+    struct Entry {
+        size_t offset;  // in `ring`
+        size_t length;
+        bool keyframe;
+    };
+
+    std::vector<unsigned char> ring;
+    // Oldest first. The ring is filled in the same order, wrapping to the
+    // start when a snapshot doesn't fit in the space left at the end.
+    std::deque<Entry> entries;
+    size_t write_offset = 0;
+    unsigned int keyframe_interval;
+    // Snapshots pushed since the latest keyframe (0 before the first one)
+    unsigned int since_keyframe = 0;
+    // Decoded copy of the keyframe the newest deltas are based on, valid
+    // while `since_keyframe` is non-zero
+    SaveState *keyframe;
+    // Encoding scratch space
+    std::vector<unsigned char> scratch;
+
+    // Makes room for `length` bytes, dropping the oldest snapshots as needed.
+    // Returns the offset to write at.
+    size_t allocate(size_t length);
+    // Drops deltas at the front whose keyframe is gone.
+    void drop_orphans();
+    // Decodes `entry` into `state`, XORing onto it for deltas.
+    void decode(const Entry &entry, SaveState &state);
+
+public:
+    // `capacity` bytes of history, a keyframe every `keyframe_interval`
+    // snapshots.
+    RewindBuffer(size_t capacity = 256 * 1024,
+                 unsigned int keyframe_interval = 120);
+    ~RewindBuffer();
+
+    // Smallest capacity that keeps history for a game whose snapshots
+    // compress like `state` (two encoded keyframes).
+    static size_t min_capacity(const SaveState &state);
+
+    // Records the state at the end of a frame.
+    void push(const SaveState &state);
+    // Removes the newest snapshot and writes it to `state`. Returns false if
+    // there is no history left.
+    bool pop(SaveState &state);
+    // Drops all history.
+    void clear();
+
+    size_t frames() { return entries.size(); }
+    // Bytes of the ring holding snapshots
+    size_t bytes_used();
+};
+
+#endif
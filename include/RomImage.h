@@ -0,0 +1,61 @@
+#ifndef ROMIMAGE_H
+#define ROMIMAGE_H
+
+#include <stddef.h>
+
+// The memory a game starts with (fonts below 0x200, the ROM from 0x200 on),
+// built once and shared by every instance that runs it.
+//
+// An image is the whole 64 KiB address space in an in-memory file. Instances
+// map it copy-on-write (MAP_PRIVATE), so they all read the same physical
+// pages and the kernel copies a page into an instance only when the instance
+// writes to it (FX33, FX55, ...). Starting an instance is an mmap() instead
+// of clearing and filling 64 KiB, and until it writes, its memory costs
+// nothing but page table entries.
+//
+// Images are found by a hash of their contents (checked byte for byte), so
+// instances loading the same ROM from different files, or generated, still
+// share one. They are reference counted and thread-safe to acquire and
+// release.
+class RomImage {
+public:
+    static const size_t size = 0x10000;
+    // Bytes before the ROM (the interpreter area with the fonts)
+    static const size_t base_size = 0x200;
+
+private:
+    int fd = -1;
+    // The image, read-only and shared, for comparing and re-acquiring
+    const unsigned char *bytes = nullptr;
+    size_t rom_size = 0;
+    unsigned long long hash = 0;
+    // acquire()s not yet released, guarded by the registry lock
+    int users = 0;
+
+    RomImage() {}
+    ~RomImage();
+
+public:
+    RomImage(const RomImage &) = delete;
+    RomImage &operator=(const RomImage &) = delete;
+
+    // The image with `base` (base_size bytes) at 0 and `rom_size` bytes of
+    // `rom` (cut to fit) at base_size. Each acquire() needs a release().
+    // Returns nullptr if no in-memory file can be made, callers then fall
+    // back to private memory.
+    static RomImage *acquire(const unsigned char *base,
+                             const unsigned char *rom, size_t rom_size);
+    static void release(RomImage *image);
+
+    // A private copy-on-write mapping of the whole image, nullptr on failure.
+    // Give it back with unmap().
+    unsigned char *map();
+    static void unmap(unsigned char *memory);
+
+    // What the image was made of
+    const unsigned char *get_base() const { return bytes; }
+    const unsigned char *get_rom() const { return bytes + base_size; }
+    size_t get_rom_size() const { return rom_size; }
+};
+
+#endif
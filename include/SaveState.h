@@ -0,0 +1,89 @@
+#ifndef SAVE_STATE_H
+#define SAVE_STATE_H
+
+#include <stdint.h>
+
+// Save-state format
+//
+// A save state is one fixed-layout SaveState struct, written to disk as is
+// (host byte order, the header records which). The machine state is stored
+// as a few large arrays plus the registers, so saving and restoring is a
+// handful of memcpy()s, and a file can be mmap()ed and restored straight
+// from the mapping.
+//
+// Bump SAVE_STATE_VERSION whenever the layout changes; older versions are
+// rejected rather than misread.
+#define SAVE_STATE_MAGIC "C8STATE\0"
+#define SAVE_STATE_VERSION 2
+#define SAVE_STATE_BYTE_ORDER 0x01020304u
+
+struct SaveStateHeader {
+    char magic[8];       // SAVE_STATE_MAGIC
+    uint32_t version;    // SAVE_STATE_VERSION
+    uint32_t byte_order; // SAVE_STATE_BYTE_ORDER as written by the host
+    uint32_t size;       // sizeof(SaveState)
+    uint32_t reserved;
+    uint64_t checksum;   // FNV-1a of everything after the header
+};
+
+struct SaveState {
+    SaveStateHeader header;
+
+    // Large arrays first, registers after, so there's no padding to hash
+    uint8_t memory[65536];
+    uint64_t gfx[2][64][2]; // Framebuffer::planes
+    uint16_t stack[16];
+    uint8_t V[16];
+    uint8_t flags[16];
+    uint8_t audio_pattern[16];
+
+    uint16_t opcode;
+    uint16_t index_register;
+    uint16_t prog_counter;
+    uint16_t sp;
+    uint32_t stack_current_size;
+    uint32_t rng_state;
+    uint16_t keys;
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    uint8_t halted;
+    uint8_t wait_key_register;
+    uint8_t draw_flag;
+    uint8_t quirks; // quirk_profile
+    uint8_t hires;
+    uint8_t plane_mask;
+    uint8_t pitch;
+    uint8_t audio_pattern_loaded;
+    uint8_t reserved[4];
+    uint64_t idle_cycles;
+    uint64_t unknown_opcodes;
+};
+
+static_assert(sizeof(SaveState) == 32 + 65536 + 2048 + 32 + 48 + 48,
+              "SaveState must not contain padding");
+
+// FNV-1a over the state after the header.
+uint64_t save_state_checksum(const SaveState &state);
+// Checks magic, version, byte order, size and checksum.
+bool save_state_valid(const SaveState &state);
+
+// Writes `state` to `path`. Returns false on failure.
+bool write_save_state(const char *path, const SaveState &state);
+
+// Read-only mapping of a save-state file.
+class MappedSaveState {
+private:
+    const SaveState *state = nullptr;
+    // Fallback copy when the file can't be mapped
+    SaveState *copy = nullptr;
+
+public:
+    // Maps `path`, `get()` returns nullptr if it couldn't be opened or has
+    // the wrong size. The contents are checked by `Chip8::load_state()`.
+    MappedSaveState(const char *path);
+    ~MappedSaveState();
+
+    const SaveState *get() { return state; }
+};
+
+#endif
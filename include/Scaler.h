@@ -0,0 +1,95 @@
+#ifndef SCALER_H
+#define SCALER_H
+
+#include "Framebuffer.h"
+#include <stdint.h>
+
+// Turning the 1 bit per pixel framebuffer (see Framebuffer.h) into ARGB
+// pixels at window resolution, on the CPU.
+//
+// Rows are expanded to colors once at their own resolution (SSE2 or AVX2
+// when the build targets them, a table-free scalar loop otherwise) and then
+// scaled up by an integer factor, so the renderer only has to copy a texture
+// that already has the window's size instead of stretching it, which SDL's
+// software renderer does slowly.
+
+// How the window gets from framebuffer pixels to screen pixels.
+enum scale_filter {
+    FILTER_SDL,     // upload at framebuffer size, SDL_RenderCopy stretches it
+    FILTER_NEAREST, // CPU, every pixel becomes a solid block
+    FILTER_SCALE2X, // CPU, Scale2x (EPX) then nearest for the rest
+    FILTER_SCALE3X, // CPU, Scale3x then nearest for the rest
+};
+
+// Name used by --filter: sdl, nearest, scale2x or scale3x.
+const char *scale_filter_name(scale_filter filter);
+// Returns false if `name` isn't a filter.
+bool parse_scale_filter(const char *name, scale_filter &filter);
+
+// Colors of `count` (a multiple of 8) pixels of a framebuffer row, given as
+// its plane 0 and plane 1 words. `palette` is indexed by plane 0 bit | plane
+// 1 bit << 1.
+void expand_pixels(const uint64_t *plane0, const uint64_t *plane1, int count,
+                   const uint32_t palette[4], uint32_t *out);
+
+// Repeats each of the `count` pixels of `row` `factor` times.
+void scale_row_nearest(const uint32_t *row, int count, int factor,
+                       uint32_t *out);
+
+// The two (three) output rows Scale2x (Scale3x) makes of `row`, with `above`
+// and `below` its neighbours (the row itself at the screen edge). All three
+// rows must be readable one pixel before their start and one past their end.
+void scale2x_row(const uint32_t *above, const uint32_t *row,
+                 const uint32_t *below, int count, uint32_t *out0,
+                 uint32_t *out1);
+void scale3x_row(const uint32_t *above, const uint32_t *row,
+                 const uint32_t *below, int count, uint32_t *out0,
+                 uint32_t *out1, uint32_t *out2);
+
+// Scales whole frames with one filter to `output_width` (128 times the
+// scale) pixels wide. Keeps every row expanded to colors and only expands the
+// rows that changed; FILTER_SDL scales like FILTER_NEAREST.
+//
+//     uint64_t rows = scaler.update(gfx, dirty_rows);
+//     for each gfx row y set in rows:
+//         scaler.scale_row(y, out + y * scaler.get_factor() * pitch, pitch);
+class FrameScaler {
+private:
+    scale_filter filter;
+    int output_width;
+    uint32_t palette[4];
+    // Every gfx row expanded to colors, `expanded_stride` pixels apart with
+    // one pixel of padding (a copy of the edge pixel) on either side for the
+    // Scale2x/3x neighbourhoods.
+    uint32_t *expanded;
+    static const int expanded_stride = 128 + 8;
+    bool expanded_valid = false;
+    bool expanded_hires = false;
+    // Rows Scale2x/3x made of one gfx row, and one finished output row
+    uint32_t *smoothed;
+    uint32_t *line;
+    // Set by update(): size of the frame, output pixels per gfx pixel and
+    // how much of that Scale2x/3x does (the rest is nearest)
+    int columns = 64;
+    int rows = 32;
+    int factor = 1;
+    int smooth = 1;
+
+public:
+    // `palette` is indexed like expand_pixels()'.
+    FrameScaler(scale_filter filter, int output_width,
+                const uint32_t palette[4]);
+    ~FrameScaler();
+
+    // Expands the rows of `gfx` set in `dirty_rows` (all of them after a
+    // resolution switch) and returns the rows whose output changed, which
+    // includes their neighbours for Scale2x/3x.
+    uint64_t update(const Framebuffer &gfx, uint64_t dirty_rows);
+    // Output rows (and columns) per gfx row of the last update().
+    int get_factor() { return factor; }
+    // Writes the get_factor() output rows of gfx row `y`, `pitch` bytes
+    // apart. Every byte of `out` is written once and never read.
+    void scale_row(int y, uint8_t *out, int pitch);
+};
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <chrono>
+
+// Timing settings for running a game.
+struct SchedulerOptions {
+    // CPU speed. Most games expect somewhere between 500 and 1000.
+    unsigned int instructions_per_second = 700;
+    // How often the screen is presented, 0 to never present (headless).
+    unsigned int presents_per_second = 60;
+    // false for a scheduler that only paces presents (the window thread),
+    // `due_ticks()` then never reports a tick.
+    bool emulate = true;
+    // Run as fast as possible (benchmarks): never sleep and treat every 60 Hz
+    // tick as due immediately. Presents still follow the wall clock.
+    bool unthrottled = false;
+};
+
+// Fixed timestep scheduler.
+//
+// Emulated time advances in 60 Hz ticks, the rate of the delay and sound
+// timers. Each tick runs `instructions_for_tick()` instructions and then counts
+// the timers down once, so the CPU rate and the timer rate are independent of
+// each other and of how often the screen is presented.
+//
+// Deadlines are computed from a fixed start time (tick n is due at
+// start + n / 60 s), so rounding never accumulates into drift. When the host
+// falls behind, several ticks become due at once and are run back to back to
+// catch up; past `max_catch_up_ticks` the backlog is dropped instead so that a
+// long stall (window being dragged, debugger) doesn't end in a burst.
+//
+//     Scheduler scheduler(options);
+//     while (running) {
+//         scheduler.wait();
+//         for (int ticks = scheduler.due_ticks(); ticks > 0; ticks--) {
+//             chip8.run(scheduler.instructions_for_tick());
+//             chip8.update_timers();
+//         }
+//         if (scheduler.present_due())
+//             ...present...
+//     }
+class Scheduler {
+private:
+    typedef std::chrono::steady_clock clock;
+
+    SchedulerOptions options;
+
+    clock::time_point tick_start;
+    unsigned long long ticks = 0;
+    clock::time_point present_start;
+    unsigned long long presents = 0;
+
+    // Instructions per second that didn't divide evenly into ticks, carried
+    // over to the next tick.
+    unsigned int instruction_remainder = 0;
+
+    clock::time_point tick_deadline();
+    clock::time_point present_deadline();
+
+public:
+    // Rate of the delay and sound timers.
+    static const int timer_hz = 60;
+    // Most ticks run back to back when the host fell behind (100 ms).
+    static const int max_catch_up_ticks = 6;
+
+    Scheduler(const SchedulerOptions &options);
+
+    // Sleeps until the next tick or present is due. Returns immediately when
+    // unthrottled or if something is already due.
+    void wait();
+    // Number of 60 Hz ticks that are due now, and marks them as done.
+    int due_ticks();
+    // Number of instructions to run in the next tick.
+    unsigned int instructions_for_tick();
+    // true (once) when a present is due. Presents that were missed are
+    // skipped, there's no point in showing the same frame twice.
+    bool present_due();
+};
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <stddef.h>
+#include <vector>
+
+// Work-stealing pool for running a fixed set of independent tasks on every
+// core.
+//
+// Tasks are numbered 0..count-1 and handed out to the workers in contiguous
+// ranges. A worker takes tasks from the back of its own queue, and once that
+// runs dry it steals from the front of another worker's queue, so uneven task
+// lengths (a ROM that runs into an endless loop next to one that crashes after
+// a few cycles) still keep every core busy.
+class WorkStealingPool {
+private:
+    struct Worker {
+        std::mutex lock;
+        std::deque<size_t> tasks;
+    };
+
+    unsigned int thread_count;
+
+    // Next task for worker `self`, stolen from another worker if its own
+    // queue is empty. Returns false once there is nothing left anywhere.
+    bool next_task(std::vector<Worker> &workers, unsigned int self,
+                   size_t &task);
+
+public:
+    // `threads` of 0 uses one thread per hardware core.
+    WorkStealingPool(unsigned int threads = 0);
+
+    unsigned int size() { return thread_count; }
+
+    // Runs task(0) .. task(count - 1) and returns when all of them finished.
+    void run(size_t count, const std::function<void(size_t)> &task);
+};
+
+#endif
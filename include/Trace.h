@@ -0,0 +1,133 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+
+// Tracing for the CPU core.
+//
+// Trace points are compiled in according to CHIP8_TRACE_LEVEL (set with
+// `make TRACE=n`):
+//   0  nothing, every CHIP8_TRACE() expands to nothing (default)
+//   1  events: subroutine calls and returns, unknown opcodes, beeps, key
+//      changes and halts
+//   2  events plus every executed instruction
+//
+// An enabled trace point writes an 8 byte record into the instance's
+// TraceRing without locking or formatting anything. A TraceWriter thread
+// drains the rings into a binary file, which `trace_decode` (see tools/) turns
+// back into readable opcode and stack traces.
+#ifndef CHIP8_TRACE_LEVEL
+#define CHIP8_TRACE_LEVEL 0
+#endif
+
+#define TRACE_LEVEL_EVENTS 1
+#define TRACE_LEVEL_OPCODES 2
+
+#if CHIP8_TRACE_LEVEL > 0
+#define CHIP8_TRACE(level, ring, kind, pc, opcode, arg, depth)                 \
+    do {                                                                       \
+        if ((level) <= CHIP8_TRACE_LEVEL && (ring) != nullptr)                 \
+            (ring)->push((kind), (pc), (opcode), (arg), (depth));              \
+    } while (0)
+#else
+#define CHIP8_TRACE(level, ring, kind, pc, opcode, arg, depth) ((void)0)
+#endif
+
+// What a record describes. `arg` depends on the kind.
+enum trace_kind {
+    TRACE_OPCODE = 0,     // an instruction was executed
+    TRACE_CALL = 1,       // 2NNN, arg = return address pushed
+    TRACE_RETURN = 2,     // 00EE, arg = address returned to
+    TRACE_UNKNOWN = 3,    // opcode didn't decode
+    TRACE_BEEP = 4,       // sound timer ran out
+    TRACE_KEYS = 5,       // arg = new key mask
+    TRACE_HALT = 6,       // arg = halt_state entered
+};
+
+// One trace record as stored in the ring and in the file.
+struct TraceRecord {
+    uint16_t pc;
+    uint16_t opcode;
+    uint16_t arg;
+    uint8_t kind;
+    uint8_t depth; // call depth after the event
+};
+
+// Trace file layout: the magic, then chunks of
+//   uint32_t instance, uint32_t count, uint64_t dropped, TraceRecord[count]
+// where `dropped` is the number of records the instance lost so far because
+// its ring was full.
+#define TRACE_FILE_MAGIC "C8TRACE1"
+
+// Single producer, single consumer ring of trace records. The emulating
+// thread pushes, the TraceWriter thread drains. When the ring is full new
+// records are dropped (and counted) rather than ever blocking the CPU.
+class TraceRing {
+private:
+    static const uint32_t capacity = 1 << 16;
+
+    TraceRecord records[capacity];
+    alignas(64) std::atomic<uint32_t> head{0};
+    alignas(64) std::atomic<uint32_t> tail{0};
+    std::atomic<uint64_t> dropped{0};
+    uint32_t instance;
+
+public:
+    TraceRing(uint32_t instance) : instance(instance) {}
+
+    uint32_t get_instance() { return instance; }
+
+    // Producer side.
+    void push(uint8_t kind, uint16_t pc, uint16_t opcode, uint16_t arg,
+              uint8_t depth) {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == capacity) {
+            dropped.store(dropped.load(std::memory_order_relaxed) + 1,
+                          std::memory_order_relaxed);
+            return;
+        }
+        TraceRecord &record = records[h & (capacity - 1)];
+        record.pc = pc;
+        record.opcode = opcode;
+        record.arg = arg;
+        record.kind = kind;
+        record.depth = depth;
+        head.store(h + 1, std::memory_order_release);
+    }
+
+    // Consumer side: writes everything pushed so far to `file` as one chunk.
+    // Returns the number of records written.
+    uint32_t drain(FILE *file);
+};
+
+// Background thread that drains TraceRings into a file.
+class TraceWriter {
+private:
+    FILE *file = nullptr;
+    std::mutex lock; // guards `rings`, never taken by the emulating threads
+    std::vector<TraceRing *> rings;
+    std::atomic<bool> stopping{false};
+    std::thread thread;
+
+    void drain_loop();
+
+public:
+    // Opens `path` for writing, `is_open()` tells if that worked.
+    TraceWriter(const char *path);
+    // Drains whatever is left and closes the file.
+    ~TraceWriter();
+
+    bool is_open() { return file != nullptr; }
+
+    void attach(TraceRing *ring);
+    // Drains the ring one last time and forgets it. The ring can be deleted
+    // afterwards.
+    void detach(TraceRing *ring);
+};
+
+#endif
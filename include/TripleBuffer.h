@@ -0,0 +1,53 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <atomic>
+
+// Lock-free triple buffer for handing values from one producer thread to one
+// consumer thread.
+//
+// The producer always has a buffer of its own to write into and the consumer
+// always has a buffer of its own to read from, so neither ever waits for the
+// other. The third buffer sits in the middle: `publish()` swaps the freshly
+// written buffer into the middle and `consume()` swaps the middle out if it
+// holds something the consumer hasn't seen yet. Values published while the
+// consumer is busy simply replace each other, the consumer always gets the
+// newest one.
+template <typename T>
+class TripleBuffer {
+private:
+    // Set in `middle` when it holds a value the consumer hasn't taken yet.
+    static const unsigned int fresh_bit = 4;
+
+    T buffers[3];
+    // Owned by the producer.
+    unsigned int back = 0;
+    // Index of the shared buffer, plus `fresh_bit`.
+    std::atomic<unsigned int> middle{1};
+    // Owned by the consumer.
+    unsigned int front = 2;
+
+public:
+    // Producer: buffer to fill in before calling `publish()`.
+    T &write_buffer() { return buffers[back]; }
+
+    // Producer: hands the write buffer over to the consumer.
+    void publish() {
+        back = middle.exchange(back | fresh_bit, std::memory_order_acq_rel) &
+               ~fresh_bit;
+    }
+
+    // Consumer: picks up the newest published value. Returns false (and keeps
+    // the current read buffer) if nothing was published since the last call.
+    bool consume() {
+        if ((middle.load(std::memory_order_relaxed) & fresh_bit) == 0)
+            return false;
+        front = middle.exchange(front, std::memory_order_acq_rel) & ~fresh_bit;
+        return true;
+    }
+
+    // Consumer: the value picked up by the last successful `consume()`.
+    const T &read_buffer() { return buffers[front]; }
+};
+
+#endif
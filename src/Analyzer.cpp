@@ -0,0 +1,352 @@
+#include "Analyzer.h"
+#include "OpcodeTable.h"
+#include <algorithm>
+
+static const unsigned int rom_start = 0x200;
+// Instructions are fetched from pc & 0xFFF, code can't be any higher
+static const unsigned int code_limit = 0x1000;
+// Longer runs of jumps after a BNNN target are more likely code than a table
+static const unsigned int max_table_entries = 128;
+
+// The ROM and how the profile decodes it.
+struct RomDecoder {
+    const unsigned char *rom;
+    size_t size;
+    QuirkFlags flags;
+    const OpcodeKindTable *kinds;
+
+    // Whether the `length` bytes at `address` are in the executable part of
+    // the ROM.
+    bool in_code(unsigned int address, unsigned int length) const {
+        return address >= rom_start && address + length <= code_limit &&
+               address + length <= rom_start + size;
+    }
+    unsigned short opcode_at(unsigned int address) const {
+        return rom[address - rom_start] << 8 | rom[address + 1 - rom_start];
+    }
+    // The instruction at `address` as the emulator's handler tables see it:
+    // extension instructions are unknown opcodes under older profiles.
+    opcode_kind kind_at(unsigned int address) const {
+        opcode_kind kind = (opcode_kind)(*kinds)[opcode_at(address)];
+        switch (kind) {
+        case OP_00DN:
+        case OP_5XY2:
+        case OP_5XY3:
+        case OP_F000:
+        case OP_FN01:
+        case OP_F002:
+        case OP_FX3A:
+            return flags.xo_chip ? kind : OP_UNKNOWN;
+        default:
+            return kind;
+        }
+    }
+    // F000 NNNN carries its operand in the next word
+    static unsigned int length_of(opcode_kind kind) {
+        return kind == OP_F000 ? 4 : 2;
+    }
+    // Chip8::skip_distance()
+    unsigned int skip_distance(unsigned int address) const {
+        if (flags.xo_chip && in_code(address + 2, 2) &&
+            opcode_at(address + 2) == 0xF000)
+            return 6;
+        return 4;
+    }
+};
+
+static bool is_skip(opcode_kind kind) {
+    switch (kind) {
+    case OP_3XNN:
+    case OP_4XNN:
+    case OP_5XY0:
+    case OP_9XY0:
+    case OP_EX9E:
+    case OP_EXA1:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Whether nothing after the instruction runs unless something jumps there.
+static bool ends_path(opcode_kind kind) {
+    return kind == OP_1NNN || kind == OP_00EE || kind == OP_00FD ||
+           kind == OP_BNNN || kind == OP_UNKNOWN;
+}
+
+// Where a BNNN at `address` can go: NNN, and if a run of jumps starts there
+// (the usual jump table, indexed by V0), each of them.
+static void jump_table(const RomDecoder &decoder, unsigned int address,
+                       std::vector<uint16_t> &targets) {
+    unsigned int base = decoder.opcode_at(address) & 0x0FFF;
+    targets.push_back(base);
+    if (!decoder.in_code(base, 2))
+        return;
+    for (unsigned int entry = base + 2, n = 1; n < max_table_entries;
+         entry += 2, n++) {
+        if (!decoder.in_code(entry, 2) ||
+            decoder.kind_at(entry) != OP_1NNN ||
+            decoder.kind_at(entry - 2) != OP_1NNN)
+            break;
+        targets.push_back(entry);
+    }
+}
+
+// Marks `count` bytes from `address` on as data.
+static void mark_data(RomAnalysis &analysis, unsigned int address,
+                      unsigned int count) {
+    for (unsigned int i = 0; i < count; i++) {
+        unsigned int offset = ((address + i) & 0xFFFF) - rom_start;
+        if (offset < analysis.bytes.size())
+            analysis.bytes[offset] |= ROM_BYTE_DATA;
+    }
+}
+
+// Follows I through the block and marks the bytes instructions access
+// through it.
+static void mark_block_data(const RomDecoder &decoder, const BasicBlock &block,
+                            RomAnalysis &analysis) {
+    bool known = false;
+    unsigned int index = 0;
+    for (unsigned int address = block.start; address <= block.last;) {
+        opcode_kind kind = decoder.kind_at(address);
+        unsigned short op = decoder.opcode_at(address);
+        unsigned int x = (op & 0x0F00) >> 8;
+        unsigned int y = (op & 0x00F0) >> 4;
+        unsigned int n = op & 0x000F;
+        switch (kind) {
+        case OP_ANNN:
+            known = true;
+            index = op & 0x0FFF;
+            break;
+        case OP_F000:
+            known = true;
+            index = decoder.opcode_at(address + 2);
+            break;
+        case OP_FX1E:
+        case OP_FX29:
+        case OP_FX30:
+            known = false;
+            break;
+        case OP_DXYN:
+            if (known)
+                mark_data(analysis, index,
+                          n == 0 && decoder.flags.super_chip ? 32 : n);
+            break;
+        case OP_FX33:
+            if (known)
+                mark_data(analysis, index, 3);
+            break;
+        case OP_FX55:
+        case OP_FX65:
+            if (known)
+                mark_data(analysis, index, x + 1);
+            if (decoder.flags.increment_index)
+                index += x + 1;
+            break;
+        case OP_5XY2:
+        case OP_5XY3:
+            if (known)
+                mark_data(analysis, index, (x > y ? x - y : y - x) + 1);
+            break;
+        case OP_F002:
+            if (known)
+                mark_data(analysis, index, 16);
+            break;
+        default:
+            break;
+        }
+        address += RomDecoder::length_of(kind);
+    }
+}
+
+int RomAnalysis::block_at(uint16_t address) const {
+    auto found = std::lower_bound(
+        blocks.begin(), blocks.end(), address,
+        [](const BasicBlock &block, uint16_t start) {
+            return block.start < start;
+        });
+    if (found == blocks.end() || found->start != address)
+        return -1;
+    return found - blocks.begin();
+}
+
+void analyze_rom(const unsigned char *rom, size_t size, quirk_profile profile,
+                 RomAnalysis &analysis) {
+    if (profile >= QUIRK_PROFILE_COUNT)
+        profile = QUIRKS_DEFAULT;
+    if (size > 0x10000 - rom_start)
+        size = 0x10000 - rom_start;
+    RomDecoder decoder = {rom, size, quirk_flags(profile), nullptr};
+    decoder.kinds =
+        decoder.flags.super_chip ? &opcode_kinds_extended : &opcode_kinds;
+
+    analysis = RomAnalysis();
+    analysis.profile = profile;
+    analysis.bytes.assign(size, ROM_BYTE_UNKNOWN);
+
+    // Recursive descent: every address reached is decoded once, straight
+    // line code in one go, everything else it leads to goes on the stack
+    std::vector<bool> decoded(code_limit, false);
+    std::vector<bool> leader(code_limit, false);
+    std::vector<bool> external(0x10000, false);
+    std::vector<uint16_t> pending;
+    std::vector<uint16_t> table;
+    if (decoder.in_code(rom_start, 2)) {
+        pending.push_back(rom_start);
+        leader[rom_start] = true;
+    }
+    auto reach = [&](unsigned int target, unsigned int length) {
+        if (!decoder.in_code(target, length)) {
+            if (!external[target & 0xFFFF]) {
+                external[target & 0xFFFF] = true;
+                analysis.external_targets.push_back(target & 0xFFFF);
+            }
+            return false;
+        }
+        return true;
+    };
+    auto branch = [&](unsigned int target) {
+        if (!reach(target, 2))
+            return;
+        leader[target] = true;
+        if (!decoded[target])
+            pending.push_back(target);
+    };
+    while (!pending.empty()) {
+        unsigned int address = pending.back();
+        pending.pop_back();
+        while (!decoded[address]) {
+            opcode_kind kind = decoder.kind_at(address);
+            unsigned int length = RomDecoder::length_of(kind);
+            if (!decoder.in_code(address, length))
+                break;
+            decoded[address] = true;
+            for (unsigned int i = 0; i < length; i++)
+                analysis.bytes[address + i - rom_start] |= ROM_BYTE_CODE;
+
+            unsigned short op = decoder.opcode_at(address);
+            unsigned int next = address + length;
+            if (kind == OP_UNKNOWN)
+                analysis.unknown_opcodes.push_back(address);
+            if (kind == OP_1NNN) {
+                branch(op & 0x0FFF);
+            } else if (kind == OP_2NNN) {
+                branch(op & 0x0FFF);
+                branch(next);
+            } else if (kind == OP_BNNN) {
+                analysis.indirect_jumps.push_back(address);
+                table.clear();
+                jump_table(decoder, address, table);
+                for (uint16_t target : table)
+                    branch(target);
+            } else if (is_skip(kind)) {
+                branch(next);
+                branch(address + decoder.skip_distance(address));
+            }
+            if (ends_path(kind) || kind == OP_2NNN || is_skip(kind))
+                break;
+            // Straight on
+            if (!reach(next, 2))
+                break;
+            address = next;
+        }
+    }
+
+    // Blocks run from a leader to the first instruction that branches or
+    // ends the path, or up to the next leader
+    for (unsigned int start = rom_start; start < code_limit; start++) {
+        if (!leader[start] || !decoded[start])
+            continue;
+        BasicBlock block;
+        block.start = start;
+        block.instructions = 0;
+        unsigned int address = start;
+        while (true) {
+            opcode_kind kind = decoder.kind_at(address);
+            unsigned short op = decoder.opcode_at(address);
+            unsigned int next = address + RomDecoder::length_of(kind);
+            block.instructions++;
+            block.last = address;
+            block.end = next;
+            uint16_t nnn = op & 0x0FFF;
+            if (kind == OP_1NNN) {
+                block.successors.push_back({nnn, EDGE_JUMP});
+            } else if (kind == OP_2NNN) {
+                block.successors.push_back({nnn, EDGE_CALL});
+                block.successors.push_back({(uint16_t)next, EDGE_FALLTHROUGH});
+            } else if (kind == OP_BNNN) {
+                table.clear();
+                jump_table(decoder, address, table);
+                for (uint16_t target : table)
+                    block.successors.push_back({target, EDGE_JUMP_TABLE});
+            } else if (is_skip(kind)) {
+                block.successors.push_back({(uint16_t)next, EDGE_FALLTHROUGH});
+                block.successors.push_back(
+                    {(uint16_t)(address + decoder.skip_distance(address)),
+                     EDGE_SKIP});
+            } else if (!ends_path(kind)) {
+                if (next < code_limit && decoded[next] && !leader[next]) {
+                    address = next;
+                    continue;
+                }
+                block.successors.push_back({(uint16_t)next, EDGE_FALLTHROUGH});
+            }
+            break;
+        }
+        mark_block_data(decoder, block, analysis);
+        analysis.blocks.push_back(block);
+    }
+
+    // Subroutines: the game and every call target, with the blocks they
+    // reach without calling
+    std::vector<uint16_t> entries = {rom_start};
+    for (const BasicBlock &block : analysis.blocks) {
+        for (const BlockEdge &edge : block.successors) {
+            if (edge.kind == EDGE_CALL && analysis.block_at(edge.target) >= 0)
+                entries.push_back(edge.target);
+        }
+    }
+    std::sort(entries.begin(), entries.end());
+    entries.erase(std::unique(entries.begin(), entries.end()), entries.end());
+    std::vector<unsigned int> seen(analysis.blocks.size(), 0);
+    unsigned int visit = 0;
+    for (uint16_t entry : entries) {
+        // An empty or one byte ROM has no code at all
+        if (analysis.block_at(entry) < 0)
+            continue;
+        Subroutine subroutine;
+        subroutine.entry = entry;
+        visit++;
+        std::vector<int> stack = {analysis.block_at(entry)};
+        seen[stack[0]] = visit;
+        while (!stack.empty()) {
+            const BasicBlock &block = analysis.blocks[stack.back()];
+            stack.pop_back();
+            subroutine.blocks.push_back(block.start);
+            for (const BlockEdge &edge : block.successors) {
+                if (edge.kind == EDGE_CALL) {
+                    subroutine.calls.push_back(edge.target);
+                    continue;
+                }
+                int next = analysis.block_at(edge.target);
+                if (next >= 0 && seen[next] != visit) {
+                    seen[next] = visit;
+                    stack.push_back(next);
+                }
+            }
+        }
+        std::sort(subroutine.blocks.begin(), subroutine.blocks.end());
+        std::sort(subroutine.calls.begin(), subroutine.calls.end());
+        subroutine.calls.erase(
+            std::unique(subroutine.calls.begin(), subroutine.calls.end()),
+            subroutine.calls.end());
+        analysis.subroutines.push_back(subroutine);
+    }
+
+    std::sort(analysis.external_targets.begin(),
+              analysis.external_targets.end());
+    std::sort(analysis.unknown_opcodes.begin(),
+              analysis.unknown_opcodes.end());
+    std::sort(analysis.indirect_jumps.begin(), analysis.indirect_jumps.end());
+}
@@ -0,0 +1,134 @@
+#include "Audio.h"
+#include <iostream>
+#include <math.h>
+#include <string.h>
+
+Chip8Audio::Chip8Audio(int buffer_samples) {
+    // Square wave, one period
+    for (int i = 0; i < 256; i++)
+        tone_table[i] = i < 128 ? volume : -volume;
+
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0) {
+        std::cerr << "ERROR: SDL audio could not initialize! SDL_Error: "
+                  << SDL_GetError() << "\n";
+        return;
+    }
+    SDL_AudioSpec wanted, obtained;
+    memset(&wanted, 0, sizeof(wanted));
+    wanted.freq = sample_rate;
+    wanted.format = AUDIO_S16SYS;
+    wanted.channels = 1;
+    wanted.samples = buffer_samples;
+    wanted.callback = callback;
+    wanted.userdata = this;
+    // The device may pick another rate, the tables below follow it
+    device = SDL_OpenAudioDevice(nullptr, 0, &wanted, &obtained,
+                                 SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+    if (device == 0) {
+        std::cerr << "ERROR: Could not open an audio device! SDL_Error: "
+                  << SDL_GetError() << "\n";
+        SDL_QuitSubSystem(SDL_INIT_AUDIO);
+        return;
+    }
+    rate = obtained.freq;
+
+    tone_step = (uint32_t)((double)tone_hz / rate * 4294967296.0);
+    // XO-CHIP plays the pattern at 4000 * 2^((pitch - 64) / 48) bits per
+    // second
+    for (int pitch = 0; pitch < 256; pitch++) {
+        double bits_per_second = 4000 * pow(2, (pitch - 64) / 48.0);
+        pattern_steps[pitch] =
+            (uint32_t)(bits_per_second / rate * (1 << 25));
+    }
+    SDL_PauseAudioDevice(device, 0);
+}
+
+Chip8Audio::~Chip8Audio() {
+    if (device == 0)
+        return;
+    SDL_CloseAudioDevice(device);
+    SDL_QuitSubSystem(SDL_INIT_AUDIO);
+}
+
+void Chip8Audio::push_tick(bool on, const unsigned char *pattern,
+                           unsigned char pitch) {
+    uint32_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) == queue_capacity) {
+        skipped.store(skipped.load(std::memory_order_relaxed) + 1,
+                      std::memory_order_relaxed);
+        return;
+    }
+    AudioTick &tick = ticks[h & (queue_capacity - 1)];
+    tick.on = on;
+    tick.use_pattern = pattern != nullptr;
+    tick.pitch = pitch;
+    if (pattern != nullptr)
+        memcpy(tick.pattern, pattern, sizeof(tick.pattern));
+    head.store(h + 1, std::memory_order_release);
+}
+
+void Chip8Audio::callback(void *user, Uint8 *stream, int len) {
+    Chip8Audio *audio = (Chip8Audio *)user;
+    audio->render((int16_t *)stream, len / (int)sizeof(int16_t));
+    audio->callbacks.store(
+        audio->callbacks.load(std::memory_order_relaxed) + 1,
+        std::memory_order_relaxed);
+}
+
+void Chip8Audio::next_tick() {
+    // 60 ticks cover exactly `rate` samples, the remainder is spread out
+    tick_samples_left = rate / 60;
+    tick_remainder += rate % 60;
+    if (tick_remainder >= 60) {
+        tick_remainder -= 60;
+        tick_samples_left++;
+    }
+
+    uint32_t t = tail.load(std::memory_order_relaxed);
+    uint32_t queued = head.load(std::memory_order_acquire) - t;
+    if (queued == 0 && !priming) {
+        underruns.store(underruns.load(std::memory_order_relaxed) + 1,
+                        std::memory_order_relaxed);
+        priming = true;
+    }
+    if (priming && queued < prime_ticks) {
+        current.on = 0;
+        return;
+    }
+    priming = false;
+    if (queued > max_backlog) {
+        skipped.store(skipped.load(std::memory_order_relaxed) + queued -
+                          max_backlog,
+                      std::memory_order_relaxed);
+        t += queued - max_backlog;
+    }
+    current = ticks[t & (queue_capacity - 1)];
+    tail.store(t + 1, std::memory_order_release);
+}
+
+void Chip8Audio::render(int16_t *out, int count) {
+    while (count > 0) {
+        if (tick_samples_left == 0)
+            next_tick();
+        int run = count < tick_samples_left ? count : tick_samples_left;
+        if (!current.on) {
+            memset(out, 0, run * sizeof(int16_t));
+        } else if (current.use_pattern) {
+            uint32_t step = pattern_steps[current.pitch];
+            for (int i = 0; i < run; i++) {
+                unsigned int bit = pattern_phase >> 25;
+                bool high = (current.pattern[bit >> 3] >> (7 - (bit & 7))) & 1;
+                out[i] = high ? volume : -volume;
+                pattern_phase += step;
+            }
+        } else {
+            for (int i = 0; i < run; i++) {
+                out[i] = tone_table[tone_phase >> 24];
+                tone_phase += tone_step;
+            }
+        }
+        out += run;
+        count -= run;
+        tick_samples_left -= run;
+    }
+}
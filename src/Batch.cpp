@@ -0,0 +1,173 @@
+#include "Batch.h"
+#include "Jit.h"
+#include "Profile.h"
+#include "Scheduler.h"
+#include "Trace.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// Outcome of a single run.
+struct BatchResult {
+    std::string rom;
+    unsigned int run = 0;
+    unsigned int seed = 0;
+    unsigned long cycles = 0;
+    // Part of `cycles` skipped because the game was idle (see halt_state)
+    unsigned long idle_cycles = 0;
+    unsigned long unknown_opcodes = 0;
+    unsigned long long gfx_hash = 0;
+    bool loaded = false;
+};
+
+static void run_one(const BatchOptions &options, TraceWriter *tracer,
+                    size_t index, BatchResult &result) {
+    // Instances are large (the decode cache; memory is a shared ROM image),
+    // keep them off the worker's stack.
+    Chip8 *chip8 = new Chip8();
+    chip8->initialize();
+    chip8->seed(result.seed);
+    TraceRing *trace_ring = nullptr;
+    if (tracer != nullptr) {
+        trace_ring = new TraceRing(index);
+        tracer->attach(trace_ring);
+        chip8->attach_trace(trace_ring);
+    }
+    Profile *profile = nullptr;
+    if (options.profile_prefix != nullptr) {
+        profile = new Profile();
+        chip8->attach_profile(profile);
+    }
+    result.loaded = chip8->load_game(result.rom.c_str());
+    if (result.loaded && options.quirk_table != nullptr)
+        chip8->set_quirks(options.quirk_table->lookup(chip8->rom_hash()));
+
+    if (result.loaded) {
+        Chip8Jit *jit = nullptr;
+        if (options.engine == ENGINE_JIT) {
+            jit = new Chip8Jit();
+            chip8->attach_jit(jit);
+        }
+
+        // Only used to split instructions into 60 Hz ticks, nothing waits.
+        SchedulerOptions timing;
+        timing.instructions_per_second = options.instructions_per_second;
+        timing.presents_per_second = 0;
+        timing.unthrottled = true;
+        Scheduler scheduler(timing);
+
+        unsigned long cycles = 0;
+        while (cycles < options.cycle_budget) {
+            unsigned long count = scheduler.instructions_for_tick();
+            if (count > options.cycle_budget - cycles)
+                count = options.cycle_budget - cycles;
+            if (jit != nullptr)
+                cycles += jit->run(*chip8, count);
+            else if (options.engine == ENGINE_THREADED)
+                cycles += chip8->run_threaded(count);
+            else
+                cycles += chip8->run(count);
+            chip8->update_timers();
+        }
+
+        chip8->attach_jit(nullptr);
+        delete jit;
+        result.cycles = cycles;
+        result.idle_cycles = chip8->get_idle_cycles();
+        result.unknown_opcodes = chip8->get_unknown_opcodes();
+        result.gfx_hash = chip8->gfx_hash();
+        if (profile != nullptr) {
+            std::string prefix =
+                options.profile_prefix + ("-" + std::to_string(index));
+            if (!chip8->write_profile(prefix.c_str()))
+                std::cerr << "ERROR: Can't write profile " << prefix << "\n";
+        }
+    }
+    delete profile;
+    if (trace_ring != nullptr) {
+        tracer->detach(trace_ring);
+        delete trace_ring;
+    }
+    delete chip8;
+}
+
+int run_batch(const BatchOptions &options) {
+    namespace fs = std::filesystem;
+
+    std::vector<std::string> roms;
+    std::error_code error;
+    for (const fs::directory_entry &entry :
+         fs::directory_iterator(options.rom_dir, error)) {
+        if (entry.is_regular_file() && entry.path().extension() == ".ch8")
+            roms.push_back(entry.path().string());
+    }
+    if (error) {
+        std::cerr << "ERROR: Can't read ROM directory " << options.rom_dir
+                  << ": " << error.message() << "\n";
+        return 1;
+    }
+    // Directory order is unspecified, sort so summaries can be diffed.
+    std::sort(roms.begin(), roms.end());
+
+    std::vector<BatchResult> results(roms.size() * options.runs_per_rom);
+    for (size_t i = 0; i < results.size(); i++) {
+        size_t rom = i / options.runs_per_rom;
+        results[i].rom = roms[rom];
+        results[i].run = i % options.runs_per_rom;
+        results[i].seed = options.seed + rom * 0x9E3779B9u + results[i].run;
+    }
+
+    TraceWriter *tracer = nullptr;
+    if (options.trace_path != nullptr) {
+        tracer = new TraceWriter(options.trace_path);
+        if (!tracer->is_open()) {
+            std::cerr << "ERROR: Can't write trace " << options.trace_path
+                      << "\n";
+            delete tracer;
+            return 1;
+        }
+    }
+
+    WorkStealingPool pool(options.threads);
+    auto start = std::chrono::steady_clock::now();
+    pool.run(results.size(),
+             [&](size_t i) { run_one(options, tracer, i, results[i]); });
+    delete tracer;
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    FILE *summary = fopen(options.summary_path, "w");
+    if (summary == nullptr) {
+        std::cerr << "ERROR: Can't write summary " << options.summary_path
+                  << "\n";
+        return 1;
+    }
+    fprintf(summary, "# rom\trun\tseed\tcycles\tidle_cycles\tunknown_opcodes"
+                     "\tgfx_hash\n");
+    unsigned long long total_cycles = 0;
+    int failed = 0;
+    for (const BatchResult &result : results) {
+        if (!result.loaded) {
+            failed++;
+            fprintf(summary, "%s\t%u\t%u\tload-failed\n", result.rom.c_str(),
+                    result.run, result.seed);
+            continue;
+        }
+        total_cycles += result.cycles;
+        fprintf(summary, "%s\t%u\t%u\t%lu\t%lu\t%lu\t%016llx\n",
+                result.rom.c_str(), result.run, result.seed, result.cycles,
+                result.idle_cycles, result.unknown_opcodes, result.gfx_hash);
+    }
+    fclose(summary);
+
+    printf("Batch: %zu runs of %zu games on %u threads in %.2fs "
+           "(%.0f instructions/s), %d failed to load\n",
+           results.size(), roms.size(), pool.size(), elapsed.count(),
+           total_cycles / elapsed.count(), failed);
+    return failed == 0 ? 0 : 1;
+}
@@ -6,10 +6,23 @@
 // to which I have shamelessly stolen code from for educative purposes.
 // =====================================================================================
 #include "Chip8.h"
+#include "Jit.h"
+#include "OpcodeTable.h"
+#include "Profile.h"
+#include "RomImage.h"
+#include "SaveState.h"
+#include "Trace.h"
+#include <algorithm>
+#include <fcntl.h>
 #include <iostream>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <time.h>
+#include <unistd.h>
+#include <vector>
 
 // Initialize
 // Before running the first emulation cycle, you'll you need to prepare the
@@ -21,398 +34,1017 @@ void Chip8::initialize() {
     sp = 0;               // Reset stack pointer
     file_size = 0;        // File size resets to load next game
     // Clear display
+    plane_mask = 3;
     gfx_clear(); // clear graphics before loading next game
+    plane_mask = 1;
+    gfx.hires = false;
+    dirty_rows = ~(uint64_t)0; // whatever the window shows has to be replaced
+    // Nothing has been decoded for the next game yet
+    flush_decode_cache();
 
     // Clear stack
-    for (int i = 0; i < 0xF; i++)
+    for (int i = 0; i <= 0xF; i++)
         stack[i] = 0;
+    stack_current_size = 0;
     // Clear registers
-    for (int i = 0; i < 0xF; i++)
+    for (int i = 0; i <= 0xF; i++)
         V[i] = 0;
-    // Clear memory
-    for (int i = 0; i < 0xFFF; i++)
-        memory[i] = 0;
+    // Fresh memory with nothing but the font, shared with every other blank
+    // instance
+    attach_image(nullptr, 0, false);
+    memset(flags, 0, sizeof(flags));
+    memset(audio_pattern, 0, sizeof(audio_pattern));
+    audio_pattern_loaded = false;
+    pitch = 64;
     // reset keys (keys are set to 'unpressed')
-    for (int i = 0; i < 0xF; i++)
-        key[i] = 0;
+    keys = 0;
+    halted = HALT_NONE;
+    wait_key_register = 0;
+    idle_cycles = 0;
 
-    // Set seed
-    std::srand(time(NULL));
+    // Set seed. Every instance has its own generator so that several can
+    // run side by side; call seed() afterwards for a reproducible run.
+    seed(time(NULL));
+    unknown_opcodes = 0;
 
-    // Load fontset
-    for (int i = 0; i < 80; ++i) {
-        memory[i] = chip8_fontset[i];
-    }
     // Reset timers
     delay_timer = 60;
     sound_timer = 60;
+    // Keeps the profile, but memory was wiped (big font) and nothing has
+    // been decoded yet
+    set_quirks(quirks);
 
     // load program into memory with fopen in binary mode, start filling memory
 }
 
+Chip8::~Chip8() { release_memory(); }
+
 // Loads game into memory, modifies file_size to games size for debugging
 // purposes (i.e. reading opcodes)
-void Chip8::load_game(const char *executable_path) {
-    FILE *fptr;
-    if (!(fptr = fopen(executable_path, "rb"))) {
+bool Chip8::load_game(const char *executable_path) {
+    int fd = open(executable_path, O_RDONLY);
+    if (fd < 0) {
         std::cerr << "ERROR: Failed to open file. Maybe check your executable "
-                     "path...?";
-        return;
+                     "path...?\n";
+        return false;
+    }
+    // Map the file rather than reading it: if the game's image already
+    // exists it's only compared. Anything that doesn't fit below 0x10000 is
+    // dropped as a safeguard. Only XO-CHIP games can use more than 4K, but
+    // which profile a game gets is only known once it's loaded (rom_hash()).
+    struct stat info;
+    size_t size = 0;
+    if (fstat(fd, &info) == 0 && info.st_size > 0)
+        size = std::min((size_t)info.st_size, memory_size - 0x200);
+    void *mapped = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0)
+                            : MAP_FAILED;
+    if (mapped != MAP_FAILED) {
+        load_rom((const unsigned char *)mapped, size);
+        munmap(mapped, size);
+    } else {
+        // Pipes and other files without a size
+        std::vector<unsigned char> rom(memory_size - 0x200);
+        size_t read_size = 0;
+        ssize_t got;
+        while (read_size < rom.size() &&
+               (got = read(fd, rom.data() + read_size,
+                           rom.size() - read_size)) > 0)
+            read_size += got;
+        load_rom(rom.data(), read_size);
     }
-    // read character into memory; limiting steps to 4096 as safeguard
-    int c;
-    int i;
-    for (i = 0; (c = fgetc(fptr)) != EOF && i < 4096; i++) {
-        memory[i + 0x200] = c;
+    close(fd);
+    return true;
+}
+
+void Chip8::load_rom(const unsigned char *data, size_t size) {
+    if (size > memory_size - 0x200)
+        size = memory_size - 0x200;
+    // Fonts and the game, everything else zero
+    attach_image(data, size, quirk_flags(quirks).super_chip);
+    // Loaded bytes replace whatever was decoded at those addresses
+    flush_decode_cache();
+
+    // Set file size to the number of bytes loaded
+    file_size = size;
+}
+
+void Chip8::attach_image(const unsigned char *rom, size_t size,
+                         bool big_font) {
+    unsigned char base[RomImage::base_size] = {};
+    memcpy(base, chip8_fontset, sizeof(chip8_fontset));
+    if (big_font)
+        memcpy(base + big_font_address, big_fontset, sizeof(big_fontset));
+
+    RomImage *next = RomImage::acquire(base, rom, size);
+    unsigned char *mapped = next != nullptr ? next->map() : nullptr;
+    if (mapped == nullptr) {
+        //* No in-memory files (or out of mappings): the instance gets its
+        //* own copy, which behaves the same.
+        RomImage::release(next);
+        next = nullptr;
+        mapped = new unsigned char[memory_size];
+        memset(mapped, 0, memory_size);
+        memcpy(mapped, base, sizeof(base));
+        if (size > 0)
+            memcpy(mapped + RomImage::base_size, rom, size);
+    }
+    release_memory();
+    memory = mapped;
+    image = next;
+    image_big_font = big_font;
+    memory_pristine = true;
+    mark_all_dirty();
+}
+
+void Chip8::release_memory() {
+    if (image != nullptr) {
+        RomImage::unmap(memory);
+        RomImage::release(image);
+    } else {
+        delete[] memory;
+    }
+    memory = nullptr;
+    image = nullptr;
+}
+
+unsigned long long Chip8::rom_hash() {
+    unsigned long long hash = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < file_size; i++) {
+        hash ^= memory[0x200 + i];
+        hash *= 0x100000001b3ULL;
     }
-    fclose(fptr);
+    return hash;
+}
+
+void Chip8::seed(unsigned int value) {
+    // xorshift gets stuck on a zero state
+    rng_state = value != 0 ? value : 0x2545F491;
+}
 
-    // Set file size to i
-    file_size = i;
+// xorshift32, returns the top byte of the new state.
+unsigned char Chip8::random_byte() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state >> 24;
 }
 
-// TODO: Emulate a timer
-// Chip-8 has two timers you will need to implement.
-// As mentioned above bother timers (delay and sound) will count down to zero
-// if they've been set to any value > 0. Since these timers count down at 60 Hz
-// it'd be smart to implment something that slows down your emulation cycle
-// (e.g. such as executing only 60 opcodes/second).
+// Emulate a cycle
+// Executes a single instruction. The timers are not touched here: they count
+// down at 60 Hz no matter how fast instructions run, so whoever drives the CPU
+// (see Scheduler) calls `update_timers()` 60 times per emulated second.
 void Chip8::emulate_cycle() {
     // Fetch Opcode. Something to note is that opcodes are 16 bits (2 bytes) so
     // we need to fetch the current one at prog_counter and bitshift them 8 bits
     // over and perform an OR on the next 8 bits in memory.
-    opcode = memory[prog_counter] << 8 | memory[prog_counter + 1];
-    printf("Executing opcode [0x0000] -> %4X\n", opcode);
-
-    // opcode & 0xF000 performs an AND operation which masks the opcode to just
-    // displaying the first bit and from there we can write a switch statement
-    // for each opcode.
-    switch (opcode & 0xF000) {
-    case 0x0000:
-        switch (opcode & 0x000F) {
-        case 0x0000: // 0x00E0: clears the screen
-            gfx_clear();
-            draw_flag = true;
-            prog_counter += 2;
-            break;
-        case 0x000E: // 0x00EE: Returns from subroutine
-            printf("== RETURNING FROM SUBROUTINE ==\n");
-            // == Pop from stack
-            prog_counter = stack[sp];
-            stack[sp] = 0; // clears the value from the stack
-            // logic for moving sp down
-            if (stack_current_size > 1)
-                sp--;
-            else // No entries in stack
-                sp = 0;
-            stack_current_size--;
-            prog_counter += 2;
-            read_stack(); //! Debugging
-            break;
-        default:
-            printf("Unknown opcode [0x0000]: 0x%4X\n", opcode);
+    //* The opcode is only fetched and decoded the first time an address is
+    //* executed, after that the cached handler and operands are reused.
+    if (halted != HALT_NONE)
+        return;
+    Instruction &ins = decode_cache[prog_counter & 0xFFF];
+    if (ins.handler == nullptr)
+        ins = decode(memory[prog_counter & 0xFFF] << 8 |
+                     memory[(prog_counter + 1) & 0xFFF]);
+    opcode = ins.opcode;
+    CHIP8_TRACE(TRACE_LEVEL_OPCODES, trace_ring, TRACE_OPCODE, prog_counter,
+                opcode, index_register, stack_current_size);
+
+#if CHIP8_PROFILE
+    if (profile != nullptr) {
+        profile->instruction(prog_counter, ins.kind, stack_current_size);
+        if (ins.kind == OP_DXYN) {
+            Profile::profile_clock::time_point start =
+                Profile::profile_clock::now();
+            (this->*ins.handler)(ins);
+            profile->sprite(start);
+            return;
+        }
+    }
+#endif
+    (this->*ins.handler)(ins);
+}
+
+unsigned long Chip8::run(unsigned long count) {
+    for (unsigned long i = 0; i < count; i++) {
+        if (halted != HALT_NONE) {
+            // Nothing can change before the next tick or key event
+            idle_cycles += count - i;
             break;
         }
-        break;
-    case 0x1000: //! 1NNN: Jumps to address NNN
-        prog_counter = opcode & 0x0FFF;
-        break;
-    case 0x2000: // 0x2NNN: Calls subroutine at address NNN
-        printf("== CALLING SUBROUTINE ==\n");
-        if (stack_current_size > 0)
-            sp++;
-        stack_current_size++;
-        stack[sp] = prog_counter;
-        prog_counter = opcode & 0x0FFF;
-        read_stack(); //! Debugging
-        break;
-    case 0x3000: // 3XNN: Skips the next instruction if VX == NN (usually the
-                 // next instruction is a jump to skip a code block).
-        // If the register at 0 is equivalent to the 8 bit constant skip next
-        // step
-        //* NOTE: Don't forget to shift your bits when searching for
-        //* an register address. Otherwise in this case you'll be
-        //* accessing memory at (possibly) address 3840!
-        if (V[(opcode & 0x0F00) >> 8] == (opcode & 0x00FF))
-            prog_counter += 4;
-        else
-            prog_counter += 2;
-        break;
-    case 0x4000: // 4XNN: Skips the next instruction if VX != NN (usually the
-                 // next instruction is a jump to skip a code block).
-        if (V[(opcode & 0x0F00) >> 8] != (opcode & 0x00FF))
-            prog_counter += 4;
-        else
-            prog_counter += 2;
-        break;
-    //? Is 5xy0 comparing registers vs. 3xnn and 4xnn where it compares the
-    // memory address (8-bit constant)?
-    case 0x5000: // 5XY0: Skips the next instruction if VX == VY (usually the
-                 // next instruction is a jump to skip a code block).
-        if (V[(opcode & 0x0F00) >> 8] == V[(opcode & 0x00F0) >> 4])
-            prog_counter += 4;
-        else
-            prog_counter += 2;
-        break;
-    case 0x6000: // 6xnn: Sets VX to NN
-        V[(opcode & 0x0F00) >> 8] = (opcode & 0x00FF);
+        emulate_cycle();
+    }
+    return count;
+}
+
+void Chip8::set_keys(uint16_t mask) {
+    if (mask != keys)
+        CHIP8_TRACE(TRACE_LEVEL_EVENTS, trace_ring, TRACE_KEYS, prog_counter,
+                    opcode, mask, stack_current_size);
+    uint16_t pressed = mask & ~keys;
+    keys = mask;
+    if (halted == HALT_WAIT_KEY && pressed != 0) {
+        // Lowest newly pressed key goes to VX, then continue after FX0A
+        unsigned char key_num = 0;
+        while (((pressed >> key_num) & 1) == 0)
+            key_num++;
+        V[wait_key_register] = key_num;
         prog_counter += 2;
-        break;
-    case 0x7000: // 7XNN: Adds NN to VX (carry flag is not changed)
-        V[(opcode & 0x0F00) >> 8] += opcode & 0x00FF;
+        halted = HALT_NONE;
+    }
+}
+
+void Chip8::update_timers() {
+    // A timer loop gets another look every tick
+    if (halted == HALT_WAIT_TIMER)
+        halted = HALT_NONE;
+
+    if (delay_timer > 0)
+        --delay_timer;
+
+    if (sound_timer > 0) {
+        if (sound_timer == 1)
+            CHIP8_TRACE(TRACE_LEVEL_EVENTS, trace_ring, TRACE_BEEP,
+                        prog_counter, opcode, 0, stack_current_size);
+        --sound_timer;
+    }
+}
+
+// Handler for each opcode_kind, in enum order, for the quirk policy `Quirks`.
+// Extension instructions outside the profile's instruction set are unknown.
+#define SUPER_CHIP(Quirks, handler)                                            \
+    (Quirks::super_chip ? &Chip8::handler : &Chip8::op_unknown)
+#define XO_CHIP(Quirks, handler)                                               \
+    (Quirks::xo_chip ? &Chip8::handler : &Chip8::op_unknown)
+#define HANDLER_TABLE(Quirks)                                                  \
+    {                                                                          \
+        &Chip8::op_00E0, &Chip8::op_00EE, &Chip8::op_1NNN, &Chip8::op_2NNN,    \
+        &Chip8::op_3XNN<Quirks>, &Chip8::op_4XNN<Quirks>,                      \
+        &Chip8::op_5XY0<Quirks>, &Chip8::op_6XNN, &Chip8::op_7XNN,             \
+        &Chip8::op_8XY0, &Chip8::op_8XY1<Quirks>, &Chip8::op_8XY2<Quirks>,     \
+        &Chip8::op_8XY3<Quirks>, &Chip8::op_8XY4, &Chip8::op_8XY5,             \
+        &Chip8::op_8XY6<Quirks>, &Chip8::op_8XY7, &Chip8::op_8XYE<Quirks>,     \
+        &Chip8::op_9XY0<Quirks>, &Chip8::op_ANNN, &Chip8::op_BNNN<Quirks>,     \
+        &Chip8::op_CXNN, &Chip8::op_DXYN<Quirks>, &Chip8::op_EX9E<Quirks>,     \
+        &Chip8::op_EXA1<Quirks>, &Chip8::op_FX07, &Chip8::op_FX0A,             \
+        &Chip8::op_FX15, &Chip8::op_FX18, &Chip8::op_FX1E, &Chip8::op_FX29,    \
+        &Chip8::op_FX33, &Chip8::op_FX55<Quirks>, &Chip8::op_FX65<Quirks>,     \
+        SUPER_CHIP(Quirks, op_00CN),                                           \
+        SUPER_CHIP(Quirks, op_00FB),                                           \
+        SUPER_CHIP(Quirks, op_00FC),                                           \
+        SUPER_CHIP(Quirks, op_00FD),                                           \
+        SUPER_CHIP(Quirks, op_00FE),                                           \
+        SUPER_CHIP(Quirks, op_00FF),                                           \
+        SUPER_CHIP(Quirks, op_FX30),                                           \
+        SUPER_CHIP(Quirks, op_FX75),                                           \
+        SUPER_CHIP(Quirks, op_FX85),                                           \
+        XO_CHIP(Quirks, op_00DN),                                              \
+        XO_CHIP(Quirks, op_5XY2),                                              \
+        XO_CHIP(Quirks, op_5XY3),                                              \
+        XO_CHIP(Quirks, op_F000),                                              \
+        XO_CHIP(Quirks, op_FN01),                                              \
+        XO_CHIP(Quirks, op_F002),                                              \
+        XO_CHIP(Quirks, op_FX3A),                                              \
+        &Chip8::op_unknown,                                                    \
+    }
+
+// One table per quirk_profile, in enum order.
+const Chip8::Handler
+    Chip8::handler_tables[QUIRK_PROFILE_COUNT][OP_KIND_COUNT] = {
+        HANDLER_TABLE(QuirksDefault),
+        HANDLER_TABLE(QuirksChip8),
+        HANDLER_TABLE(QuirksSuperChip),
+        HANDLER_TABLE(QuirksXoChip),
+};
+
+#undef HANDLER_TABLE
+#undef SUPER_CHIP
+#undef XO_CHIP
+
+const unsigned char Chip8::chip8_fontset[80] = {
+    0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+    0x20, 0x60, 0x20, 0x20, 0x70, // 1
+    0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+    0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+    0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+    0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+    0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+    0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+    0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+    0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+    0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+    0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+    0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+    0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+    0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+    0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+};
+
+// SUPER-CHIP big digits 0-9, then XO-CHIP's A-F, 10 rows each.
+const unsigned char Chip8::big_fontset[160] = {
+    0x3C, 0x7E, 0xE7, 0xC3, 0xC3, 0xC3, 0xC3, 0xE7, 0x7E, 0x3C, // 0
+    0x18, 0x38, 0x58, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3C, // 1
+    0x3E, 0x7F, 0xC3, 0x06, 0x0C, 0x18, 0x30, 0x60, 0xFF, 0xFF, // 2
+    0x3C, 0x7E, 0xC3, 0x03, 0x0E, 0x0E, 0x03, 0xC3, 0x7E, 0x3C, // 3
+    0x06, 0x0E, 0x1E, 0x36, 0x66, 0xC6, 0xFF, 0xFF, 0x06, 0x06, // 4
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFE, 0x03, 0xC3, 0x7E, 0x3C, // 5
+    0x3E, 0x7C, 0xC0, 0xC0, 0xFC, 0xFE, 0xC3, 0xC3, 0x7E, 0x3C, // 6
+    0xFF, 0xFF, 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x60, 0x60, // 7
+    0x3C, 0x7E, 0xC3, 0xC3, 0x7E, 0x7E, 0xC3, 0xC3, 0x7E, 0x3C, // 8
+    0x3C, 0x7E, 0xC3, 0xC3, 0x7F, 0x3F, 0x03, 0x03, 0x3E, 0x7C, // 9
+    0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+    0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+    0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+    0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0, // F
+};
+
+void Chip8::set_quirks(quirk_profile profile) {
+    if (profile >= QUIRK_PROFILE_COUNT)
+        profile = QUIRKS_DEFAULT;
+    quirks = profile;
+    handlers = handler_tables[profile];
+    QuirkFlags enabled = quirk_flags(profile);
+    kind_table = enabled.super_chip ? &opcode_kinds_extended : &opcode_kinds;
+    memory_mask = enabled.xo_chip ? 0xFFFF : 0xFFF;
+    // A game that hasn't written anything yet switches to the image with the
+    // big font (which other instances share) instead of writing it.
+    if (enabled.super_chip && image != nullptr && memory_pristine) {
+        if (!image_big_font)
+            attach_image(image->get_rom(), image->get_rom_size(), true);
+    } else if (enabled.super_chip) {
+        memcpy(memory + big_font_address, big_fontset, sizeof(big_fontset));
+        mark_dirty(big_font_address);
+    }
+    // Cached instructions point into the old table, translations follow the
+    // old rules
+    flush_decode_cache();
+    if (jit != nullptr)
+        jit->reset();
+}
+
+// Decode
+// Which instruction an opcode is comes from the opcode_kinds table (see
+// OpcodeTable.h for how opcodes are matched). The operands are masked and
+// shifted here once so the handlers can use them directly.
+Instruction Chip8::decode(unsigned short op) {
+    Instruction ins;
+    ins.opcode = op;
+    ins.nnn = op & 0x0FFF;
+    ins.nn = op & 0x00FF;
+    ins.n = op & 0x000F;
+    ins.x = (op & 0x0F00) >> 8;
+    ins.y = (op & 0x00F0) >> 4;
+    ins.kind = (*kind_table)[op];
+    ins.handler = handlers[ins.kind];
+    return ins;
+}
+
+void Chip8::flush_decode_cache() {
+    for (int i = 0; i < 4096; i++)
+        decode_cache[i].handler = nullptr;
+}
+
+// Instructions are two bytes long, so a write to `address` can change both the
+// instruction starting there and the one starting a byte before it. Code only
+// runs from the first 4K, nothing above can have been decoded.
+void Chip8::write_memory(unsigned short address, unsigned char value) {
+    address &= memory_mask;
+    memory[address] = value;
+    memory_pristine = false;
+    mark_dirty(address);
+    if (address >= 0x1000)
+        return;
+    decode_cache[address].handler = nullptr;
+    decode_cache[(address - 1) & 0xFFF].handler = nullptr;
+    if (jit != nullptr)
+        jit->invalidate(address);
+}
+
+// 0x00E0: clears the screen
+void Chip8::op_00E0(const Instruction &ins) {
+    gfx_clear();
+    draw_flag = true;
+    prog_counter += 2;
+}
+
+// 0x00EE: Returns from subroutine
+//* Returning with nothing on the stack faults (see HALT_FAULT).
+void Chip8::op_00EE(const Instruction &ins) {
+    if (stack_current_size == 0) {
+        halted = HALT_FAULT;
+        CHIP8_TRACE(TRACE_LEVEL_EVENTS, trace_ring, TRACE_HALT, prog_counter,
+                    ins.opcode, halted, stack_current_size);
+        return;
+    }
+    // Only read by the trace, which TRACE=0 compiles out
+    [[maybe_unused]] unsigned short from = prog_counter;
+    // == Pop from stack
+    prog_counter = stack[sp];
+    stack[sp] = 0; // clears the value from the stack
+    // logic for moving sp down
+    if (stack_current_size > 1)
+        sp--;
+    else // No entries in stack
+        sp = 0;
+    stack_current_size--;
+    prog_counter += 2;
+    CHIP8_TRACE(TRACE_LEVEL_EVENTS, trace_ring, TRACE_RETURN, from,
+                ins.opcode, prog_counter, stack_current_size);
+    CHIP8_PROFILE_HOOK(profile, ret());
+}
+
+//! 1NNN: Jumps to address NNN
+//* Also spots the two idle loops games use to wait, so the CPU can halt
+//* until the next timer tick instead of spinning:
+//*   - a jump to itself (end of game, waiting for interrupts that never come)
+//*   - FX07, 3XNN/4XNN, 1NNN back to the FX07 (polling the delay timer)
+void Chip8::op_1NNN(const Instruction &ins) {
+    unsigned short from = prog_counter;
+    prog_counter = ins.nnn;
+    if (ins.nnn == from ||
+        (ins.nnn == ((from - 4) & 0xFFF) && is_delay_poll(ins.nnn))) {
+        halted = HALT_WAIT_TIMER;
+        CHIP8_TRACE(TRACE_LEVEL_EVENTS, trace_ring, TRACE_HALT, from,
+                    ins.opcode, halted, stack_current_size);
+    }
+}
+
+bool Chip8::is_delay_poll(unsigned short address) {
+    // Read from memory rather than the decode cache, which not every engine
+    // fills
+    unsigned short read = memory[address & 0xFFF] << 8 |
+                          memory[(address + 1) & 0xFFF];
+    unsigned short test = memory[(address + 2) & 0xFFF] << 8 |
+                          memory[(address + 3) & 0xFFF];
+    const OpcodeKindTable &kinds = *kind_table;
+    return kinds[read] == OP_FX07 &&
+           (kinds[test] == OP_3XNN || kinds[test] == OP_4XNN) &&
+           (read & 0x0F00) == (test & 0x0F00);
+}
+
+// 0x2NNN: Calls subroutine at address NNN
+//* A call with all 16 entries in use faults (see HALT_FAULT) instead of
+//* writing past the stack.
+void Chip8::op_2NNN(const Instruction &ins) {
+    if (stack_current_size == 16) {
+        halted = HALT_FAULT;
+        CHIP8_TRACE(TRACE_LEVEL_EVENTS, trace_ring, TRACE_HALT, prog_counter,
+                    ins.opcode, halted, stack_current_size);
+        return;
+    }
+    if (stack_current_size > 0)
+        sp++;
+    stack_current_size++;
+    stack[sp] = prog_counter;
+    prog_counter = ins.nnn;
+    // The call's own address is pushed, 00EE adds 2 when returning
+    CHIP8_TRACE(TRACE_LEVEL_EVENTS, trace_ring, TRACE_CALL, stack[sp],
+                ins.opcode, stack[sp] + 2, stack_current_size);
+    CHIP8_PROFILE_HOOK(profile, call(ins.nnn, stack_current_size));
+}
+
+// 3XNN: Skips the next instruction if VX == NN (usually the next instruction is
+// a jump to skip a code block).
+template <class Quirks>
+void Chip8::op_3XNN(const Instruction &ins) {
+    // If the register at 0 is equivalent to the 8 bit constant skip next
+    // step
+    //* NOTE: Don't forget to shift your bits when searching for
+    //* an register address. Otherwise in this case you'll be
+    //* accessing memory at (possibly) address 3840!
+    //* (decode() already did the shifting, ins.x is the register index)
+    if (V[ins.x] == ins.nn)
+        prog_counter += skip_distance<Quirks>();
+    else
         prog_counter += 2;
-        break;
-    case 0x8000: // 0x8XY0-0x8XYE
-        switch (opcode & 0x000F) {
-        case 0x0000: // 0x8XY0: Sets VX to the value of VY
-            V[(opcode & 0x0F00) >> 8] = V[(opcode & 0x00F0)];
-            prog_counter += 2;
-            break;
-        case 0x0001: // 0x8XY1: Sets VX to VX *or*  VY  (bitwise OR operation)
-            V[(opcode & 0x0F00) >> 8] |= V[(opcode & 0x00F0)];
-            prog_counter += 2;
-            break;
-        case 0x0002: // 0x8XY2: Sets VX to VX *and* VY (bitwise AND operation)
-            V[(opcode & 0x0F00) >> 8] &= V[(opcode & 0x00F0)];
-            prog_counter += 2;
-            break;
-        case 0x0003: // 0x8XY3: Sets VX to VX *xor* VY (bitwise XOR operation)
-            V[(opcode & 0x0F00) >> 8] ^= V[(opcode & 0x00F0)];
-            prog_counter += 2;
-            break;
-        case 0x0004: // 0x8XY4: Adds VY to VX. VF is set to 1 when there's an
-                     // overflow, and to 0 when there is not
-            //*================================================================
-            //* NOTE: So the expression V[(opcode & 0x00F0) >> 4] and
-            //* V[(opcode & 0x0F00) >> 8] is just formatting the
-            //* opcode to get the address for the register.
-            //*================================================================
-            //* Register VY is between 2 bytes (16 bits) (4 hexadecimal) and in
-            //* order to get the register
-            //* properly I need to mask the opcode to just the VY (word?) and
-            //* then bit shift it 4 places
-            //* over to get the proper address so if you have an opcode like
-            //* 0x8A33 we are:
-            //* 1. Masking our opcode to get our VY (0x8A33 & 0x00F0) ==
-            //* (0x0030)
-            //* 2. Masking our opcode to get our VX (0x8A33 & 0x0F00) ==
-            //* (0x0A00)
-            //* 3. Bitshifting the values over 4 bits (binary) to retrieve
-            //* the correct address.
-            //*     3a. For VY, this is (0x0030) >> 4 == (0x0003)
-            //*     3b. For VX, this is (0x0A00) >> 8 == (0x000A)
-            //* 4. We now compare the two values to see if VY + VX will result
-            //* in an overflow which
-            //* we account for by setting the 16th register (0xF or our carry
-            //* flag register) to 1.
-            //*================================================================
-            if (V[(opcode & 0x00F0) >> 4] > (0xFF - V[(opcode & 0x0F00) >> 8]))
-                V[0xF] = 1;
-            else
-                V[0xF] = 0;
-            //* 5. Add VY to VX
-            V[(opcode & 0x0F00) >> 8] += V[(opcode & 0x00F0)];
-            //* 6. Increment prog_counter by 2
-            prog_counter += 2;
-            break;
-        case 0x0005: // 0x8XY5: VY is subtracted from VX. VF is set to 0 when
-                     // there's an underflow, and 1 when there is not. (i.e. VF
-                     // set to 1 if VX >= VY and 0 if not)
-            if ((V[opcode & 0x0F00] >> 8) >= V[opcode & 0x00F0] >> 4)
-                V[0xF] = 0;
-            else
-                V[0xF] = 1;
-            V[(opcode & 0x0F00) >> 8] -= V[(opcode & 0x00F0) >> 4]; // VX -= VY
-            prog_counter += 2;
-            break;
-        case 0x0006: // 0x8XY6: Shifts VX to the right by 1, then stores the
-                     // least significant bit of VX prior to the shift into VF.
-            // Store the least significant bit of VX into VF
-            V[0xF] = (V[(opcode & 0x0F00) >> 8]) & 0x000F;
-            // Shift VX to the right by 1
-            V[(opcode & 0x0F00) >> 8] >>= 1;
-            prog_counter += 2;
-            break;
-        case 0x0007: // 0x8XY7: Sets VX to VY minus VX. VF is set to 0 when
-                     // there's an underflow, and 1 when there is not. (i.e. VF
-                     // set to 1 if VY >= VX).
-            if (V[(opcode & 0x0F00) >> 8] <= V[(opcode & 0x00F0) >> 4])
-                V[0xF] = 0; // underflow
-            else
-                V[0xF] = 1;
-            V[(opcode & 0x0F00) >> 8] =
-                V[(opcode & 0x00F0) >> 4] -
-                V[(opcode & 0X0F00) >> 8]; // VX = VY - VX
-            prog_counter += 2;
-            break;
-        case 0x000E: // 0x8XYE
-            //* From wikipedia: 8XYE: Shifts vx to the left by 1, then sets
-            //* VF to 1 if the most significant bit of VX prior to that
-            //* shift was set, or to 0 if it was unset.
-            //* Checks if value at register is greater than or equal to 128
-            //* which in binary sets the most significant bit to 1.
-            if (V[(opcode & 0x0F00) >> 8] >= 0x80)
-                V[0xF] = 1;
-            else
-                V[0xF] = 0;
-            V[(opcode & 0x0F00) >> 8] <<= 1; // VX <<= 1
-            prog_counter += 2;
-            break;
-        default:
-            printf("Unknown opcode [0x0000]: 0x%4X\n", opcode);
-            break;
-        }
-        break;
-    case 0x9000: // 0x9XY0: Skips the next instruction if VX does not equal VY
-        if (V[(opcode & 0x0F00) >> 8] != V[(opcode & 0x00F0) >> 4])
-            prog_counter += 4;
-        else
-            prog_counter += 2;
-        break;
-    case 0xA000: // 0xANNN: Sets I to the address NNN
-        index_register = opcode & 0x0FFF;
+}
+
+// 4XNN: Skips the next instruction if VX != NN (usually the next instruction is
+// a jump to skip a code block).
+template <class Quirks>
+void Chip8::op_4XNN(const Instruction &ins) {
+    if (V[ins.x] != ins.nn)
+        prog_counter += skip_distance<Quirks>();
+    else
         prog_counter += 2;
-        break;
-    case 0xB000: // 0xBNNN: Jumps to the address NNN plus V0.
-        prog_counter = V[0x0] + (opcode & 0x0FFF);
-        break;
-    case 0xC000: {
-        // 0xCXNN: Sets VX to the result of a bitwise AND operation on
-        // a random number (0-255) to NN.
-        // V[(opcode & 0x0F00) >> 8] =
-        //     (rand() % 0xFF) & (opcode & 0x00FF); // generates random number
-        V[(opcode & 0x0F00) >> 8] =
-            rand() & (opcode & 0x00FF); // generates random number
+}
+
+//? Is 5xy0 comparing registers vs. 3xnn and 4xnn where it compares the
+// memory address (8-bit constant)?
+// 5XY0: Skips the next instruction if VX == VY (usually the next instruction is
+// a jump to skip a code block).
+template <class Quirks>
+void Chip8::op_5XY0(const Instruction &ins) {
+    if (V[ins.x] == V[ins.y])
+        prog_counter += skip_distance<Quirks>();
+    else
         prog_counter += 2;
-    } break;
-    case 0xD000: // 0xDXYN: Draws a sprite at coordinate (VX, VY)
-    {
-        unsigned short x = V[(opcode & 0x0F00) >> 8];
-        unsigned short y = V[(opcode & 0x00F0) >> 4];
-        unsigned short height = opcode & 0x000F;
-        unsigned short pixel;
-
-        V[0xF] = 0; // carry flag, used for collision detection
-        for (int y_line = 0; y_line < height; y_line++) {
-            pixel = memory[index_register + y_line];
-            for (int x_line = 0; x_line < 8; x_line++) {
-                //?  What is this doing?
-                if ((pixel & (0x80 >> x_line)) != 0) {
-                    if (gfx[(x + x_line + ((y + y_line) * 64))] == 1)
-                        V[0xF] = 1;
-                    gfx[x + x_line + ((y + y_line) * 64)] ^= 1;
-                }
-            }
-        }
+}
+
+// 6xnn: Sets VX to NN
+void Chip8::op_6XNN(const Instruction &ins) {
+    V[ins.x] = ins.nn;
+    prog_counter += 2;
+}
+
+// 7XNN: Adds NN to VX (carry flag is not changed)
+void Chip8::op_7XNN(const Instruction &ins) {
+    V[ins.x] += ins.nn;
+    prog_counter += 2;
+}
+
+// 0x8XY0: Sets VX to the value of VY
+void Chip8::op_8XY0(const Instruction &ins) {
+    V[ins.x] = V[ins.y];
+    prog_counter += 2;
+}
+
+// 0x8XY1: Sets VX to VX *or*  VY  (bitwise OR operation)
+template <class Quirks>
+void Chip8::op_8XY1(const Instruction &ins) {
+    V[ins.x] |= V[ins.y];
+    if (Quirks::vf_reset)
+        V[0xF] = 0;
+    prog_counter += 2;
+}
+
+// 0x8XY2: Sets VX to VX *and* VY (bitwise AND operation)
+template <class Quirks>
+void Chip8::op_8XY2(const Instruction &ins) {
+    V[ins.x] &= V[ins.y];
+    if (Quirks::vf_reset)
+        V[0xF] = 0;
+    prog_counter += 2;
+}
+
+// 0x8XY3: Sets VX to VX *xor* VY (bitwise XOR operation)
+template <class Quirks>
+void Chip8::op_8XY3(const Instruction &ins) {
+    V[ins.x] ^= V[ins.y];
+    if (Quirks::vf_reset)
+        V[0xF] = 0;
+    prog_counter += 2;
+}
 
-        draw_flag = true;
+// 0x8XY4: Adds VY to VX. VF is set to 1 when there's an overflow, and to 0 when
+// there is not
+void Chip8::op_8XY4(const Instruction &ins) {
+    //*================================================================
+    //* NOTE: So the expression V[(opcode & 0x00F0) >> 4] and
+    //* V[(opcode & 0x0F00) >> 8] is just formatting the
+    //* opcode to get the address for the register.
+    //*================================================================
+    //* Register VY is between 2 bytes (16 bits) (4 hexadecimal) and in
+    //* order to get the register
+    //* properly I need to mask the opcode to just the VY (word?) and
+    //* then bit shift it 4 places
+    //* over to get the proper address so if you have an opcode like
+    //* 0x8A33 we are:
+    //* 1. Masking our opcode to get our VY (0x8A33 & 0x00F0) ==
+    //* (0x0030)
+    //* 2. Masking our opcode to get our VX (0x8A33 & 0x0F00) ==
+    //* (0x0A00)
+    //* 3. Bitshifting the values over 4 bits (binary) to retrieve
+    //* the correct address.
+    //*     3a. For VY, this is (0x0030) >> 4 == (0x0003)
+    //*     3b. For VX, this is (0x0A00) >> 8 == (0x000A)
+    //*     (steps 1-3 now happen once in decode(), giving ins.x/ins.y)
+    //* 4. We now compare the two values to see if VY + VX will result
+    //* in an overflow which
+    //* we account for by setting the 16th register (0xF or our carry
+    //* flag register) to 1.
+    //*================================================================
+    if (V[ins.y] > (0xFF - V[ins.x]))
+        V[0xF] = 1;
+    else
+        V[0xF] = 0;
+    //* 5. Add VY to VX
+    V[ins.x] += V[ins.y];
+    //* 6. Increment prog_counter by 2
+    prog_counter += 2;
+}
+
+// 0x8XY5: VY is subtracted from VX. VF is set to 0 when there's an underflow,
+// and 1 when there is not. (i.e. VF set to 1 if VX >= VY and 0 if not)
+void Chip8::op_8XY5(const Instruction &ins) {
+    if (V[ins.x] >= V[ins.y])
+        V[0xF] = 0;
+    else
+        V[0xF] = 1;
+    V[ins.x] -= V[ins.y]; // VX -= VY
+    prog_counter += 2;
+}
+
+// 0x8XY6: Shifts VX to the right by 1, then stores the least significant bit of
+// VX prior to the shift into VF.
+//* With the shift_vy quirk VY is shifted into VX instead.
+template <class Quirks>
+void Chip8::op_8XY6(const Instruction &ins) {
+    unsigned char source = V[Quirks::shift_vy ? ins.y : ins.x];
+    // Store the least significant bit of the source into VF
+    V[0xF] = source & 0x1;
+    // Shift it to the right by 1
+    V[ins.x] = source >> 1;
+    prog_counter += 2;
+}
+
+// 0x8XY7: Sets VX to VY minus VX. VF is set to 0 when there's an underflow, and
+// 1 when there is not. (i.e. VF set to 1 if VY >= VX).
+void Chip8::op_8XY7(const Instruction &ins) {
+    if (V[ins.x] <= V[ins.y])
+        V[0xF] = 0; // underflow
+    else
+        V[0xF] = 1;
+    V[ins.x] = V[ins.y] - V[ins.x]; // VX = VY - VX
+    prog_counter += 2;
+}
+
+// 0x8XYE
+template <class Quirks>
+void Chip8::op_8XYE(const Instruction &ins) {
+    //* From wikipedia: 8XYE: Shifts vx to the left by 1, then sets
+    //* VF to 1 if the most significant bit of VX prior to that
+    //* shift was set, or to 0 if it was unset.
+    //* Checks if value at register is greater than or equal to 128
+    //* which in binary sets the most significant bit to 1.
+    //* With the shift_vy quirk VY is shifted into VX instead.
+    unsigned char source = V[Quirks::shift_vy ? ins.y : ins.x];
+    if (source >= 0x80)
+        V[0xF] = 1;
+    else
+        V[0xF] = 0;
+    V[ins.x] = source << 1; // VX = source << 1
+    prog_counter += 2;
+}
+
+// 0x9XY0: Skips the next instruction if VX does not equal VY
+template <class Quirks>
+void Chip8::op_9XY0(const Instruction &ins) {
+    if (V[ins.x] != V[ins.y])
+        prog_counter += skip_distance<Quirks>();
+    else
         prog_counter += 2;
-    } break;
-    case 0xE000: // 0xEX9E + EXA1: Get keys . Not implementing till I
-                 // figure out how to get graphics set up.
-        switch (opcode & 0x00FF) {
-        case 0x009E:
-            //! Need to find a way to implement key() properly
-            if (key[V[(opcode & 0x0F00) >> 8]] == 1)
-                prog_counter += 4;
-            else
-                prog_counter += 2;
-            break;
-        case 0x00A1:
-            //! Need to find a way to implement key() properly
-            if (key[V[(opcode & 0x0F00) >> 8]] != 1)
-                prog_counter += 4;
-            else
-                prog_counter += 2;
-            break;
-        default:
-            printf("Unknown opcode [0x0000]: 0x%4X\n", opcode);
-            break;
-        }
-        break;
-    case 0xF000: // 0xFX07-0xFX65
-        switch (opcode & 0x00FF) {
-        case 0x0007: // 0xFX07: Sets VX to the value of the delay timer.
-            V[(opcode & 0x0F00) >> 8] = delay_timer;
-            prog_counter += 2;
-            break;
-        case 0x000A: // 0xFX0A
-            //* From Wikipedia: A key press is awaited, and then stored in VX
-            //* (blocking operation,
-            //* all instruction halted until next key event, delay and sound
-            //* timers should continue
-            //* processing).
-            prog_counter += 2;
-            break;
-        case 0x0015: // 0xFX15: Sets the delay timer to vx.
-            delay_timer = V[(opcode & 0x0F00) >> 8];
-            prog_counter += 2;
-            break;
-        case 0x0018: // 0xFX18: Sets the sound timer to VX.
-            sound_timer = V[(opcode & 0x0F00) >> 8];
-            prog_counter += 2;
-            break;
-        case 0x001E: // 0xFX1E: Adds VX to I. VF is not affected.
-            index_register += V[(opcode & 0x0F00)];
-            prog_counter += 2;
-            break;
-        case 0x0029: // 0xFX29: Sets I to the location of the sprite for the
-                     // character in VX
-            index_register = V[(opcode & 0x0F00) >> 8];
-            prog_counter += 2;
-            break;
-        case 0x0033: // 0xFX33: Stores the binary-coded decimal representation
-                     // of VX
-            memory[index_register] = V[(opcode & 0x0F00) >> 8] / 100;
-            memory[index_register + 1] = (V[(opcode & 0x0F00) >> 8] / 10) % 10;
-            memory[index_register + 2] = (V[(opcode & 0x0F00) >> 8] / 100) % 10;
-            prog_counter += 2;
-            break;
-        case 0x0055: // 0xFX55: Stores from V0 to VX (including VX) in memory,
-                     // starting at address I. The offset from I is increased by
-                     // 1 for each value written, but I itself is left
-                     // unmodified.
-            for (int i = 0; i <= ((opcode & 0x0F00) >> 8); i++) {
-                memory[index_register + i] = V[i];
+}
+
+// 0xANNN: Sets I to the address NNN
+void Chip8::op_ANNN(const Instruction &ins) {
+    index_register = ins.nnn;
+    prog_counter += 2;
+}
+
+// 0xBNNN: Jumps to the address NNN plus V0.
+//* With the jump_vx quirk it's BXNN: XNN plus VX.
+template <class Quirks>
+void Chip8::op_BNNN(const Instruction &ins) {
+    prog_counter = V[Quirks::jump_vx ? ins.x : 0x0] + ins.nnn;
+}
+
+// 0xCXNN: Sets VX to the result of a bitwise AND operation on a random number
+// (0-255) to NN.
+void Chip8::op_CXNN(const Instruction &ins) {
+    // V[(opcode & 0x0F00) >> 8] =
+    //     (rand() % 0xFF) & (opcode & 0x00FF); // generates random number
+    V[ins.x] = random_byte() & ins.nn; // generates random number
+    prog_counter += 2;
+}
+
+// 0xDXYN: Draws a sprite at coordinate (VX, VY)
+//* The starting coordinate wraps around the screen, the parts of the sprite
+//* that go past the right or bottom edge are clipped (or, with the
+//* wrap_sprites quirk, drawn on the opposite edge).
+//* SUPER-CHIP draws DXY0 as a 16x16 sprite, two bytes per row. Each plane
+//* selected by FN01 gets its own copy of the sprite data, one after the
+//* other starting at I.
+template <class Quirks>
+void Chip8::op_DXYN(const Instruction &ins) {
+    unsigned int width = gfx.width();
+    unsigned int screen_height = gfx.height();
+    unsigned int x = V[ins.x] & (width - 1);
+    unsigned int y = V[ins.y] & (screen_height - 1);
+    bool big = Quirks::super_chip && ins.n == 0;
+    unsigned int sprite_height = big ? 16 : ins.n;
+    unsigned int row_bytes = big ? 2 : 1;
+    unsigned int height = sprite_height;
+    if (!Quirks::wrap_sprites && y + height > screen_height)
+        height = screen_height - y;
+
+    uint64_t collision = 0; // carry flag, used for collision detection
+    unsigned short address = index_register;
+    for (int plane = 0; plane < 2; plane++) {
+        if (((plane_mask >> plane) & 1) == 0)
+            continue;
+        for (unsigned int y_line = 0; y_line < height; y_line++) {
+            // Move the sprite row to the leftmost pixels of the screen, then
+            // over to column x. Pixels shifted past the right edge are
+            // dropped, or come back in on the left when wrapping.
+            unsigned short at = address + y_line * row_bytes;
+            uint64_t sprite = (uint64_t)memory[at & memory_mask] << 56;
+            if (big)
+                sprite |= (uint64_t)memory[(at + 1) & memory_mask] << 48;
+            uint64_t left = 0, right = 0, lost = 0;
+            if (x < 64) {
+                left = sprite >> x;
+                if (x != 0)
+                    right = sprite << (64 - x);
+            } else {
+                right = sprite >> (x - 64);
+                if (x != 64)
+                    lost = sprite << (128 - x);
             }
-            prog_counter += 2;
-            break;
-        case 0x0065: // 0xFX65: reg_load(VX, &index_register);
-            for (int i = 0; i <= ((opcode & 0x0F00) >> 8); i++) {
-                V[i] = memory[index_register + i];
+            if (width == 64) {
+                lost = right;
+                right = 0;
             }
-            prog_counter += 2;
-            break;
-        default:
-            printf("Unknown opcode [0x0000]: 0x%4X\n", opcode);
-            break;
+            if (Quirks::wrap_sprites)
+                left |= lost;
+            unsigned int row = (y + y_line) & (screen_height - 1);
+            collision |= blit_row(gfx.planes[plane][row], left, right);
+            if ((left | right) != 0)
+                dirty_rows |= (uint64_t)1 << row;
         }
-        break;
+        address += sprite_height * row_bytes;
+    }
+    V[0xF] = collision != 0;
+
+    draw_flag = true;
+    prog_counter += 2;
+}
+
+// 0xEX9E: Skips the next instruction if the key stored in VX is pressed.
+template <class Quirks>
+void Chip8::op_EX9E(const Instruction &ins) {
+    if ((keys >> (V[ins.x] & 0xF)) & 1)
+        prog_counter += skip_distance<Quirks>();
+    else
+        prog_counter += 2;
+}
+
+// 0xEXA1: Skips the next instruction if the key stored in VX isn't pressed.
+template <class Quirks>
+void Chip8::op_EXA1(const Instruction &ins) {
+    if (((keys >> (V[ins.x] & 0xF)) & 1) == 0)
+        prog_counter += skip_distance<Quirks>();
+    else
+        prog_counter += 2;
+}
+
+// 0xFX07: Sets VX to the value of the delay timer.
+void Chip8::op_FX07(const Instruction &ins) {
+    V[ins.x] = delay_timer;
+    prog_counter += 2;
+}
+
+// 0xFX0A
+void Chip8::op_FX0A(const Instruction &ins) {
+    //* From Wikipedia: A key press is awaited, and then stored in VX
+    //* (blocking operation,
+    //* all instruction halted until next key event, delay and sound
+    //* timers should continue
+    //* processing).
+    //* set_keys() stores the key and moves past this instruction.
+    halted = HALT_WAIT_KEY;
+    wait_key_register = ins.x;
+    CHIP8_TRACE(TRACE_LEVEL_EVENTS, trace_ring, TRACE_HALT, prog_counter,
+                ins.opcode, halted, stack_current_size);
+}
+
+// 0xFX15: Sets the delay timer to vx.
+void Chip8::op_FX15(const Instruction &ins) {
+    delay_timer = V[ins.x];
+    prog_counter += 2;
+}
+
+// 0xFX18: Sets the sound timer to VX.
+void Chip8::op_FX18(const Instruction &ins) {
+    sound_timer = V[ins.x];
+    prog_counter += 2;
+}
+
+// 0xFX1E: Adds VX to I. VF is not affected.
+void Chip8::op_FX1E(const Instruction &ins) {
+    index_register += V[ins.x];
+    prog_counter += 2;
+}
 
-    default:
-        printf("Unknown opcode [0x0000]: 0x%4X\n", opcode);
-        break;
+// 0xFX29: Sets I to the location of the sprite for the character in VX
+void Chip8::op_FX29(const Instruction &ins) {
+    index_register = V[ins.x];
+    prog_counter += 2;
+}
+
+// 0xFX33: Stores the binary-coded decimal representation of VX
+void Chip8::op_FX33(const Instruction &ins) {
+    write_memory(index_register, V[ins.x] / 100);
+    write_memory(index_register + 1, (V[ins.x] / 10) % 10);
+    write_memory(index_register + 2, (V[ins.x] / 100) % 10);
+    prog_counter += 2;
+}
+
+// 0xFX55: Stores from V0 to VX (including VX) in memory, starting at address I.
+// The offset from I is increased by 1 for each value written, but I itself is
+// left unmodified (unless the increment_index quirk moves it past VX).
+template <class Quirks>
+void Chip8::op_FX55(const Instruction &ins) {
+    for (int i = 0; i <= ins.x; i++) {
+        write_memory(index_register + i, V[i]);
     }
-    // Update timers
-    if (delay_timer > 0)
-        --delay_timer;
+    if (Quirks::increment_index)
+        index_register += ins.x + 1;
+    prog_counter += 2;
+}
 
-    if (sound_timer > 0) {
-        if (sound_timer == 1)
-            printf("BEEP!\n");
-        --sound_timer;
+// 0xFX65: reg_load(VX, &index_register);
+template <class Quirks>
+void Chip8::op_FX65(const Instruction &ins) {
+    for (int i = 0; i <= ins.x; i++) {
+        V[i] = memory[(index_register + i) & memory_mask];
     }
+    if (Quirks::increment_index)
+        index_register += ins.x + 1;
+    prog_counter += 2;
+}
+
+template <class Scroll>
+void Chip8::scroll_planes(Scroll scroll) {
+    for (int plane = 0; plane < 2; plane++)
+        if ((plane_mask >> plane) & 1)
+            scroll(gfx.planes[plane]);
+    dirty_rows = ~(uint64_t)0;
+    draw_flag = true;
+}
+
+//* SUPER-CHIP and XO-CHIP scroll by pixels of the current resolution (the
+//* original SUPER-CHIP 1.1 scrolled by half as much in low resolution).
+
+// 0x00CN: Scrolls the display down N rows
+void Chip8::op_00CN(const Instruction &ins) {
+    int height = gfx.height(), n = ins.n;
+    scroll_planes([=](uint64_t(*rows)[2]) { scroll_down(rows, height, n); });
+    prog_counter += 2;
+}
+
+// 0x00FB: Scrolls the display right 4 pixels
+void Chip8::op_00FB(const Instruction &ins) {
+    int height = gfx.height(), width = gfx.width();
+    scroll_planes(
+        [=](uint64_t(*rows)[2]) { scroll_right(rows, height, width, 4); });
+    prog_counter += 2;
+}
+
+// 0x00FC: Scrolls the display left 4 pixels
+void Chip8::op_00FC(const Instruction &ins) {
+    int height = gfx.height(), width = gfx.width();
+    scroll_planes(
+        [=](uint64_t(*rows)[2]) { scroll_left(rows, height, width, 4); });
+    prog_counter += 2;
+}
+
+// 0x00FD: Exits the interpreter
+//* There's nothing to exit to, so it stays on this instruction like a jump to
+//* itself and halts until the next timer tick.
+void Chip8::op_00FD(const Instruction &ins) {
+    halted = HALT_WAIT_TIMER;
+    CHIP8_TRACE(TRACE_LEVEL_EVENTS, trace_ring, TRACE_HALT, prog_counter,
+                ins.opcode, halted, stack_current_size);
+}
+
+// 0x00FE: Switches to low resolution (64x32) and clears the screen
+void Chip8::op_00FE(const Instruction &ins) {
+    clear_rows(gfx.planes[0]);
+    clear_rows(gfx.planes[1]);
+    gfx.hires = false;
+    dirty_rows = ~(uint64_t)0;
+    draw_flag = true;
+    prog_counter += 2;
 }
 
+// 0x00FF: Switches to high resolution (128x64) and clears the screen
+void Chip8::op_00FF(const Instruction &ins) {
+    clear_rows(gfx.planes[0]);
+    clear_rows(gfx.planes[1]);
+    gfx.hires = true;
+    dirty_rows = ~(uint64_t)0;
+    draw_flag = true;
+    prog_counter += 2;
+}
+
+// 0xFX30: Sets I to the big (8x10) sprite for the digit in VX
+void Chip8::op_FX30(const Instruction &ins) {
+    index_register = big_font_address + (V[ins.x] & 0xF) * 10;
+    prog_counter += 2;
+}
+
+// 0xFX75: Stores V0 to VX in the flag registers
+void Chip8::op_FX75(const Instruction &ins) {
+    memcpy(flags, V, ins.x + 1);
+    prog_counter += 2;
+}
+
+// 0xFX85: Loads V0 to VX from the flag registers
+void Chip8::op_FX85(const Instruction &ins) {
+    memcpy(V, flags, ins.x + 1);
+    prog_counter += 2;
+}
+
+// 0x00DN: Scrolls the display up N rows
+void Chip8::op_00DN(const Instruction &ins) {
+    int height = gfx.height(), n = ins.n;
+    scroll_planes([=](uint64_t(*rows)[2]) { scroll_up(rows, height, n); });
+    prog_counter += 2;
+}
+
+// 0x5XY2: Stores VX to VY in memory starting at I, I is left unmodified. X can
+// be above Y, the registers are then stored in descending order.
+void Chip8::op_5XY2(const Instruction &ins) {
+    int step = ins.x <= ins.y ? 1 : -1;
+    int count = (ins.y - ins.x) * step + 1;
+    for (int i = 0; i < count; i++)
+        write_memory(index_register + i, V[ins.x + i * step]);
+    prog_counter += 2;
+}
+
+// 0x5XY3: Loads VX to VY from memory starting at I, the reverse of 5XY2.
+void Chip8::op_5XY3(const Instruction &ins) {
+    int step = ins.x <= ins.y ? 1 : -1;
+    int count = (ins.y - ins.x) * step + 1;
+    for (int i = 0; i < count; i++)
+        V[ins.x + i * step] = memory[(index_register + i) & memory_mask];
+    prog_counter += 2;
+}
+
+// 0xF000 NNNN: Sets I to the 16 bit address in the next two bytes
+void Chip8::op_F000(const Instruction &ins) {
+    index_register = memory[(prog_counter + 2) & 0xFFF] << 8 |
+                     memory[(prog_counter + 3) & 0xFFF];
+    prog_counter += 4;
+}
+
+// 0xFN01: Selects the planes (bit 0 and 1 of N) drawing, clearing and
+// scrolling apply to
+void Chip8::op_FN01(const Instruction &ins) {
+    plane_mask = ins.x & 3;
+    prog_counter += 2;
+}
+
+// 0xF002: Loads the 16 byte audio pattern from memory at I
+void Chip8::op_F002(const Instruction &ins) {
+    for (int i = 0; i < 16; i++)
+        audio_pattern[i] = memory[(index_register + i) & memory_mask];
+    audio_pattern_loaded = true;
+    prog_counter += 2;
+}
+
+// 0xFX3A: Sets the audio pattern's playback rate (see get_audio_pattern())
+void Chip8::op_FX3A(const Instruction &ins) {
+    pitch = V[ins.x];
+    prog_counter += 2;
+}
+
+void Chip8::op_unknown(const Instruction &ins) {
+    unknown_opcodes++;
+    CHIP8_TRACE(TRACE_LEVEL_EVENTS, trace_ring, TRACE_UNKNOWN, prog_counter,
+                ins.opcode, 0, stack_current_size);
+}
+
+// The threaded core (ThreadedInterpreter.cpp) calls the quirk handlers
+// directly, so every profile's are instantiated here.
+#define INSTANTIATE_QUIRK_HANDLERS(Quirks)                                     \
+    template void Chip8::op_8XY1<Quirks>(const Instruction &ins);              \
+    template void Chip8::op_8XY2<Quirks>(const Instruction &ins);              \
+    template void Chip8::op_8XY3<Quirks>(const Instruction &ins);              \
+    template void Chip8::op_8XY6<Quirks>(const Instruction &ins);              \
+    template void Chip8::op_8XYE<Quirks>(const Instruction &ins);              \
+    template void Chip8::op_BNNN<Quirks>(const Instruction &ins);              \
+    template void Chip8::op_DXYN<Quirks>(const Instruction &ins);              \
+    template void Chip8::op_FX55<Quirks>(const Instruction &ins);              \
+    template void Chip8::op_FX65<Quirks>(const Instruction &ins);
+
+INSTANTIATE_QUIRK_HANDLERS(QuirksDefault)
+INSTANTIATE_QUIRK_HANDLERS(QuirksChip8)
+INSTANTIATE_QUIRK_HANDLERS(QuirksSuperChip)
+INSTANTIATE_QUIRK_HANDLERS(QuirksXoChip)
+
+#undef INSTANTIATE_QUIRK_HANDLERS
+
 void Chip8::gfx_clear() {
-    // Clears all values in GFX to 0
-    for (int i = 0; i < 64 * 32; i++)
-        gfx[i] = 0;
+    // Clears the selected planes, only rows that had pixels set change
+    for (int plane = 0; plane < 2; plane++) {
+        if (((plane_mask >> plane) & 1) == 0)
+            continue;
+        for (int i = 0; i < 64; i++)
+            if ((gfx.planes[plane][i][0] | gfx.planes[plane][i][1]) != 0)
+                dirty_rows |= (uint64_t)1 << i;
+        clear_rows(gfx.planes[plane]);
+    }
 }
 
 void Chip8::gfx_draw_all() {
-    for (int i = 0; i < 64 * 32; i++)
-        gfx[i] = 1;
+    for (int i = 0; i < gfx.height(); i++) {
+        gfx.planes[0][i][0] = ~(uint64_t)0;
+        gfx.planes[0][i][1] = gfx.hires ? ~(uint64_t)0 : 0;
+    }
+    dirty_rows = ~(uint64_t)0;
 }
 
 void Chip8::read_stack() {
@@ -420,7 +1052,178 @@ void Chip8::read_stack() {
         printf("Memory @ %2d [0x0000] ==> %4X\n", i, stack[i]);
 }
 
-unsigned char *Chip8::get_gfx() { return gfx; }
+const Framebuffer &Chip8::get_gfx() { return gfx; }
+
+unsigned long long Chip8::gfx_hash() {
+    unsigned long long hash = 0xcbf29ce484222325ULL;
+    bool second_plane = false;
+    for (int i = 0; i < 64; i++)
+        if ((gfx.planes[1][i][0] | gfx.planes[1][i][1]) != 0)
+            second_plane = true;
+    // Low resolution rows only use their first word
+    unsigned int row_size = (gfx.hires ? 2 : 1) * sizeof(uint64_t);
+    for (int plane = 0; plane < (second_plane ? 2 : 1); plane++) {
+        for (int row = 0; row < gfx.height(); row++) {
+            const unsigned char *bytes =
+                (const unsigned char *)gfx.planes[plane][row];
+            for (unsigned int i = 0; i < row_size; i++) {
+                hash ^= bytes[i];
+                hash *= 0x100000001b3ULL;
+            }
+        }
+    }
+    return hash;
+}
+
+void Chip8::save_state(SaveState &state) {
+    memcpy(state.memory, memory, memory_size);
+    memcpy(state.gfx, gfx.planes, sizeof(gfx.planes));
+    memcpy(state.stack, stack, sizeof(stack));
+    memcpy(state.V, V, sizeof(V));
+    memcpy(state.flags, flags, sizeof(flags));
+    memcpy(state.audio_pattern, audio_pattern, sizeof(audio_pattern));
+    state.opcode = opcode;
+    state.index_register = index_register;
+    state.prog_counter = prog_counter;
+    state.sp = sp;
+    state.stack_current_size = stack_current_size;
+    state.rng_state = rng_state;
+    state.keys = keys;
+    state.delay_timer = delay_timer;
+    state.sound_timer = sound_timer;
+    state.halted = halted;
+    state.wait_key_register = wait_key_register;
+    state.draw_flag = draw_flag;
+    state.quirks = quirks;
+    state.hires = gfx.hires;
+    state.plane_mask = plane_mask;
+    state.pitch = pitch;
+    state.audio_pattern_loaded = audio_pattern_loaded;
+    memset(state.reserved, 0, sizeof(state.reserved));
+    state.idle_cycles = idle_cycles;
+    state.unknown_opcodes = unknown_opcodes;
+
+    memcpy(state.header.magic, SAVE_STATE_MAGIC, 8);
+    state.header.version = SAVE_STATE_VERSION;
+    state.header.byte_order = SAVE_STATE_BYTE_ORDER;
+    state.header.size = sizeof(SaveState);
+    state.header.reserved = 0;
+    state.header.checksum = save_state_checksum(state);
+}
+
+bool Chip8::load_state(const SaveState &state) {
+    // The checksum catches damaged files, the register checks make sure a
+    // crafted one can't index out of bounds.
+    if (!save_state_valid(state) || state.stack_current_size > 16 ||
+        state.sp != (state.stack_current_size > 0
+                         ? state.stack_current_size - 1
+                         : 0) ||
+        state.wait_key_register > 15 || state.halted > HALT_FAULT ||
+        state.quirks >= QUIRK_PROFILE_COUNT || state.hires > 1 ||
+        state.plane_mask > 3)
+        return false;
+
+    // Switches tables and drops everything decoded or translated, memory is
+    // replaced wholesale right after
+    set_quirks((quirk_profile)state.quirks);
+    // Only pages that differ are written, the others stay shared with the
+    // game's image (rewinding loads a state every frame)
+    for (size_t page = 0; page < memory_size; page += 4096) {
+        if (memcmp(memory + page, state.memory + page, 4096) != 0) {
+            memcpy(memory + page, state.memory + page, 4096);
+            memory_pristine = false;
+        }
+    }
+    mark_all_dirty();
+    restore_registers(state);
+    return true;
+}
+
+void Chip8::restore_registers(const SaveState &state) {
+    memcpy(gfx.planes, state.gfx, sizeof(gfx.planes));
+    memcpy(stack, state.stack, sizeof(stack));
+    memcpy(V, state.V, sizeof(V));
+    memcpy(flags, state.flags, sizeof(flags));
+    memcpy(audio_pattern, state.audio_pattern, sizeof(audio_pattern));
+    gfx.hires = state.hires;
+    plane_mask = state.plane_mask;
+    pitch = state.pitch;
+    audio_pattern_loaded = state.audio_pattern_loaded != 0;
+    opcode = state.opcode;
+    index_register = state.index_register;
+    prog_counter = state.prog_counter;
+    sp = state.sp;
+    stack_current_size = state.stack_current_size;
+    rng_state = state.rng_state;
+    keys = state.keys;
+    delay_timer = state.delay_timer;
+    sound_timer = state.sound_timer;
+    halted = (halt_state)state.halted;
+    wait_key_register = state.wait_key_register;
+    draw_flag = true;
+    idle_cycles = state.idle_cycles;
+    unknown_opcodes = state.unknown_opcodes;
+
+    // The whole screen has to be redrawn
+    dirty_rows = ~(uint64_t)0;
+}
+
+void Chip8::save_snapshot(SaveState &snapshot) {
+    save_state(snapshot);
+    memset(dirty_pages, 0, sizeof(dirty_pages));
+}
+
+void Chip8::reset_to_snapshot(const SaveState &snapshot) {
+    if (snapshot.quirks != quirks)
+        set_quirks((quirk_profile)snapshot.quirks);
+    bool code_restored = false;
+    for (size_t word = 0; word < sizeof(dirty_pages) / 8; word++) {
+        for (uint64_t bits = dirty_pages[word]; bits != 0; bits &= bits - 1) {
+            size_t start = (word * 64 + __builtin_ctzll(bits)) *
+                           dirty_page_size;
+            memcpy(memory + start, snapshot.memory + start, dirty_page_size);
+            memory_pristine = false;
+            if (start >= 0x1000)
+                continue;
+            // The page's instructions, and the one reaching into it from
+            // the page before
+            for (size_t i = 0; i <= dirty_page_size; i++)
+                decode_cache[(start + i - 1) & 0xFFF].handler = nullptr;
+            code_restored = true;
+        }
+        dirty_pages[word] = 0;
+    }
+    if (code_restored && jit != nullptr)
+        jit->reset();
+    restore_registers(snapshot);
+}
+
+void Chip8::patch_memory(unsigned short address, const unsigned char *bytes,
+                         size_t size) {
+    size = std::min(size, memory_size - address);
+    if (size == 0)
+        return;
+    memcpy(memory + address, bytes, size);
+    memory_pristine = false;
+    size_t end = address + size;
+    for (size_t at = address & ~(dirty_page_size - 1); at < end;
+         at += dirty_page_size)
+        mark_dirty(at);
+    if (address >= 0x1000)
+        return;
+    for (size_t i = address; i < std::min(end, (size_t)0x1000); i++) {
+        decode_cache[i].handler = nullptr;
+        decode_cache[(i - 1) & 0xFFF].handler = nullptr;
+    }
+    if (jit != nullptr)
+        jit->reset();
+}
+
+bool Chip8::write_profile(const char *prefix) {
+    if (profile == nullptr)
+        return false;
+    return profile->write_files(prefix, memory);
+}
 
 bool Chip8::get_draw_flag() { return draw_flag; }
 
@@ -435,7 +1238,8 @@ void Chip8::read_binary_opcodes() {
     for (int i = 0; i < file_size; i++) {
         if (i % 10 == 0 && i != 0) // formatting
             printf("\n");
-        opcode = memory[prog_counter] << 8 | memory[prog_counter + 1];
+        opcode = memory[prog_counter & 0xFFF] << 8 |
+                 memory[(prog_counter + 1) & 0xFFF];
         prog_counter += 2;
         printf("0x%4X | ", opcode);
     }
@@ -0,0 +1,121 @@
+#include "Disassembler.h"
+#include <stdio.h>
+
+// Mnemonics follow Cowgod's Chip-8 technical reference, and its SUPER-CHIP
+// section for the SUPER-CHIP instructions. The XO-CHIP ones use the same style
+// for Octo's names. Extension instructions are disassembled whatever the
+// game's quirk profile is.
+int disassemble(unsigned short opcode, char *out, size_t size) {
+    unsigned int x = (opcode & 0x0F00) >> 8;
+    unsigned int y = (opcode & 0x00F0) >> 4;
+    unsigned int n = opcode & 0x000F;
+    unsigned int nn = opcode & 0x00FF;
+    unsigned int nnn = opcode & 0x0FFF;
+
+    switch (opcode & 0xF000) {
+    case 0x0000:
+        if (opcode == 0x00E0)
+            return snprintf(out, size, "CLS");
+        if (opcode == 0x00EE)
+            return snprintf(out, size, "RET");
+        if ((opcode & 0xFFF0) == 0x00C0)
+            return snprintf(out, size, "SCD %u", n);
+        if ((opcode & 0xFFF0) == 0x00D0)
+            return snprintf(out, size, "SCU %u", n);
+        if (opcode == 0x00FB)
+            return snprintf(out, size, "SCR");
+        if (opcode == 0x00FC)
+            return snprintf(out, size, "SCL");
+        if (opcode == 0x00FD)
+            return snprintf(out, size, "EXIT");
+        if (opcode == 0x00FE)
+            return snprintf(out, size, "LOW");
+        if (opcode == 0x00FF)
+            return snprintf(out, size, "HIGH");
+        break;
+    case 0x1000:
+        return snprintf(out, size, "JP 0x%03X", nnn);
+    case 0x2000:
+        return snprintf(out, size, "CALL 0x%03X", nnn);
+    case 0x3000:
+        return snprintf(out, size, "SE V%X, 0x%02X", x, nn);
+    case 0x4000:
+        return snprintf(out, size, "SNE V%X, 0x%02X", x, nn);
+    case 0x5000:
+        if (n == 0)
+            return snprintf(out, size, "SE V%X, V%X", x, y);
+        if (n == 2)
+            return snprintf(out, size, "SAVE V%X-V%X", x, y);
+        if (n == 3)
+            return snprintf(out, size, "LOAD V%X-V%X", x, y);
+        break;
+    case 0x6000:
+        return snprintf(out, size, "LD V%X, 0x%02X", x, nn);
+    case 0x7000:
+        return snprintf(out, size, "ADD V%X, 0x%02X", x, nn);
+    case 0x8000: {
+        static const char *const names[16] = {
+            "LD", "OR", "AND", "XOR", "ADD", "SUB", "SHR", "SUBN",
+            nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, "SHL",
+            nullptr};
+        if (names[n] != nullptr)
+            return snprintf(out, size, "%s V%X, V%X", names[n], x, y);
+        break;
+    }
+    case 0x9000:
+        if (n == 0)
+            return snprintf(out, size, "SNE V%X, V%X", x, y);
+        break;
+    case 0xA000:
+        return snprintf(out, size, "LD I, 0x%03X", nnn);
+    case 0xB000:
+        return snprintf(out, size, "JP V0, 0x%03X", nnn);
+    case 0xC000:
+        return snprintf(out, size, "RND V%X, 0x%02X", x, nn);
+    case 0xD000:
+        return snprintf(out, size, "DRW V%X, V%X, %u", x, y, n);
+    case 0xE000:
+        if (nn == 0x9E)
+            return snprintf(out, size, "SKP V%X", x);
+        if (nn == 0xA1)
+            return snprintf(out, size, "SKNP V%X", x);
+        break;
+    case 0xF000:
+        if (opcode == 0xF000)
+            return snprintf(out, size, "LD I, LONG");
+        if (opcode == 0xF002)
+            return snprintf(out, size, "AUDIO");
+        switch (nn) {
+        case 0x01:
+            return snprintf(out, size, "PLANE %u", x);
+        case 0x07:
+            return snprintf(out, size, "LD V%X, DT", x);
+        case 0x0A:
+            return snprintf(out, size, "LD V%X, K", x);
+        case 0x15:
+            return snprintf(out, size, "LD DT, V%X", x);
+        case 0x18:
+            return snprintf(out, size, "LD ST, V%X", x);
+        case 0x1E:
+            return snprintf(out, size, "ADD I, V%X", x);
+        case 0x29:
+            return snprintf(out, size, "LD F, V%X", x);
+        case 0x30:
+            return snprintf(out, size, "LD HF, V%X", x);
+        case 0x33:
+            return snprintf(out, size, "LD B, V%X", x);
+        case 0x55:
+            return snprintf(out, size, "LD [I], V%X", x);
+        case 0x65:
+            return snprintf(out, size, "LD V%X, [I]", x);
+        case 0x75:
+            return snprintf(out, size, "LD R, V%X", x);
+        case 0x85:
+            return snprintf(out, size, "LD V%X, R", x);
+        case 0x3A:
+            return snprintf(out, size, "PITCH V%X", x);
+        }
+        break;
+    }
+    return snprintf(out, size, "DW 0x%04X", opcode);
+}
@@ -0,0 +1,284 @@
+#include "Display.h"
+#include "Graphics.h"
+#include <algorithm>
+#include <csignal>
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+PackedFrame::PackedFrame(pixel_format format, scale_filter filter, int scale,
+                         const uint32_t palette[4], size_t header_size)
+    : format(format), scaler(filter, 128 * scale, palette),
+      scaled(128 * scale * 2 * scale), width(128 * scale),
+      height(64 * scale), data(header_size + 128 * scale * 64 * scale * 3),
+      header_size(header_size) {}
+
+void PackedFrame::update(const Framebuffer &gfx, uint64_t dirty_rows) {
+    uint64_t rows = scaler.update(gfx, dirty_rows);
+    int factor = scaler.get_factor();
+    size_t plane_size = (size_t)width * height;
+    uint8_t *out = data.data() + header_size;
+    for (int y = 0; y < gfx.height(); y++) {
+        if (((rows >> y) & 1) == 0)
+            continue;
+        scaler.scale_row(y, (uint8_t *)scaled.data(),
+                         width * sizeof(uint32_t));
+        size_t first = (size_t)y * factor * width;
+        size_t count = (size_t)factor * width;
+        const uint32_t *argb = scaled.data();
+        if (format == FORMAT_RGB24) {
+            uint8_t *rgb = out + first * 3;
+            for (size_t i = 0; i < count; i++) {
+                rgb[3 * i] = argb[i] >> 16;
+                rgb[3 * i + 1] = argb[i] >> 8;
+                rgb[3 * i + 2] = argb[i];
+            }
+            continue;
+        }
+        // BT.601 studio range, in 8 bit fixed point
+        uint8_t *luma = out + first;
+        uint8_t *cb = luma + plane_size, *cr = cb + plane_size;
+        for (size_t i = 0; i < count; i++) {
+            int r = (argb[i] >> 16) & 0xFF, g = (argb[i] >> 8) & 0xFF,
+                b = argb[i] & 0xFF;
+            luma[i] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+            cb[i] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+            cr[i] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+        }
+    }
+}
+
+// == PNG ==
+//* Written without compression (stored deflate blocks), which keeps the
+//* encoder to a CRC and an Adler-32. Snapshots are small and meant for
+//* comparing, not archiving.
+
+static uint32_t crc32(uint32_t crc, const uint8_t *bytes, size_t size) {
+    static uint32_t table[256];
+    if (table[1] == 0) {
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++)
+                c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            table[n] = c;
+        }
+    }
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+        crc = table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+static void put_be32(std::vector<uint8_t> &out, uint32_t value) {
+    out.push_back(value >> 24);
+    out.push_back(value >> 16);
+    out.push_back(value >> 8);
+    out.push_back(value);
+}
+
+static void png_chunk(std::vector<uint8_t> &out, const char *type,
+                      const std::vector<uint8_t> &body) {
+    put_be32(out, body.size());
+    size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), body.begin(), body.end());
+    put_be32(out, crc32(0, out.data() + start, out.size() - start));
+}
+
+static std::vector<uint8_t> encode_png(const uint8_t *rgb, int width,
+                                       int height) {
+    std::vector<uint8_t> png = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    std::vector<uint8_t> header;
+    put_be32(header, width);
+    put_be32(header, height);
+    // 8 bits per channel, truecolor, deflate, filters, no interlacing
+    for (uint8_t byte : {8, 2, 0, 0, 0})
+        header.push_back(byte);
+    png_chunk(png, "IHDR", header);
+
+    // Scanlines, each behind filter type 0 (none)
+    size_t stride = (size_t)width * 3;
+    std::vector<uint8_t> raw;
+    raw.reserve((stride + 1) * height);
+    for (int y = 0; y < height; y++) {
+        raw.push_back(0);
+        raw.insert(raw.end(), rgb + y * stride, rgb + (y + 1) * stride);
+    }
+    std::vector<uint8_t> zlib = {0x78, 0x01};
+    uint32_t a = 1, b = 0;
+    for (size_t i = 0; i < raw.size(); i++) {
+        a = (a + raw[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    size_t offset = 0;
+    do {
+        size_t block = std::min(raw.size() - offset, (size_t)65535);
+        bool last = offset + block == raw.size();
+        zlib.push_back(last ? 1 : 0);
+        zlib.push_back(block & 0xFF);
+        zlib.push_back(block >> 8);
+        zlib.push_back(~block & 0xFF);
+        zlib.push_back((~block >> 8) & 0xFF);
+        zlib.insert(zlib.end(), raw.begin() + offset,
+                    raw.begin() + offset + block);
+        offset += block;
+    } while (offset < raw.size());
+    put_be32(zlib, b << 16 | a);
+    png_chunk(png, "IDAT", zlib);
+    png_chunk(png, "IEND", {});
+    return png;
+}
+
+// == Snapshots ==
+
+SnapshotDisplay::SnapshotDisplay(const char *prefix, bool png,
+                                 unsigned long every, scale_filter filter,
+                                 int scale)
+    : prefix(prefix), png(png), every(every),
+      frame(PackedFrame::FORMAT_RGB24, filter, scale, get_palette().data(),
+            0) {}
+
+SnapshotDisplay::~SnapshotDisplay() {
+    if (every == 0 && frames > 0) {
+        char path[32];
+        snprintf(path, sizeof(path), "-%06lu.%s", frames, png ? "png" : "ppm");
+        write((prefix + path).c_str());
+    }
+}
+
+bool SnapshotDisplay::write(const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (file == nullptr) {
+        std::cerr << "ERROR: Can't write " << path << "\n";
+        running = false;
+        return false;
+    }
+    bool written;
+    if (png) {
+        std::vector<uint8_t> bytes =
+            encode_png(frame.pixels(), frame.width, frame.height);
+        written = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    } else {
+        size_t size = (size_t)frame.width * frame.height * 3;
+        written = fprintf(file, "P6\n%d %d\n255\n", frame.width,
+                          frame.height) > 0 &&
+                  fwrite(frame.pixels(), 1, size, file) == size;
+    }
+    written = fclose(file) == 0 && written;
+    if (!written) {
+        std::cerr << "ERROR: Can't write " << path << "\n";
+        running = false;
+    }
+    return written;
+}
+
+void SnapshotDisplay::update_screen_with_buffer(const Framebuffer &gfx,
+                                                uint64_t dirty_rows) {
+    frame.update(gfx, dirty_rows);
+    frames++;
+    if (every != 0 && frames % every == 0) {
+        char path[32];
+        snprintf(path, sizeof(path), "-%06lu.%s", frames, png ? "png" : "ppm");
+        write((prefix + path).c_str());
+    }
+}
+
+// == Streams ==
+
+StreamDisplay::StreamDisplay(const char *path, bool y4m, scale_filter filter,
+                             int scale)
+    : frame(y4m ? PackedFrame::FORMAT_YUV444 : PackedFrame::FORMAT_RGB24,
+            filter, scale, get_palette().data(), y4m ? 6 : 0) {
+    if (strcmp(path, "-") == 0) {
+        // The video gets stdout to itself, everything printed goes to stderr
+        fflush(stdout);
+        fd = dup(STDOUT_FILENO);
+        if (fd >= 0)
+            dup2(STDERR_FILENO, STDOUT_FILENO);
+    } else {
+        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    if (fd < 0) {
+        std::cerr << "ERROR: Can't write " << path << ": " << strerror(errno)
+                  << "\n";
+        running = false;
+        return;
+    }
+    // A reader that goes away should end the game, not the process
+    std::signal(SIGPIPE, SIG_IGN);
+    if (y4m) {
+        memcpy(frame.data.data(), "FRAME\n", 6);
+        char header[64];
+        int size = snprintf(header, sizeof(header),
+                            "YUV4MPEG2 W%d H%d F60:1 Ip A1:1 C444\n",
+                            frame.width, frame.height);
+        running = write_all((const uint8_t *)header, size);
+    }
+}
+
+StreamDisplay::~StreamDisplay() {
+    if (fd >= 0)
+        close(fd);
+}
+
+bool StreamDisplay::write_all(const uint8_t *bytes, size_t size) {
+    while (size > 0) {
+        ssize_t written = ::write(fd, bytes, size);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0) {
+            std::cerr << "ERROR: Video output failed: " << strerror(errno)
+                      << "\n";
+            return false;
+        }
+        bytes += written;
+        size -= written;
+    }
+    return true;
+}
+
+void StreamDisplay::update_screen_with_buffer(const Framebuffer &gfx,
+                                              uint64_t dirty_rows) {
+    if (!running)
+        return;
+    // Unchanged frames still go out, the stream has a fixed frame rate
+    frame.update(gfx, dirty_rows);
+    running = write_all(frame.data.data(), frame.data.size());
+}
+
+Display *open_display(const char *spec, scale_filter filter, int scale,
+                      unsigned long snapshot_every) {
+    const char *colon = strchr(spec, ':');
+    std::string kind =
+        colon != nullptr ? std::string(spec, colon - spec) : spec;
+    const char *target = colon != nullptr ? colon + 1 : "";
+    bool needs_target = kind == "ppm" || kind == "png" || kind == "y4m" ||
+                        kind == "rgb";
+    if (needs_target != (colon != nullptr && *target != '\0') ||
+        (!needs_target && kind != "sdl" && kind != "null")) {
+        std::cerr << "ERROR: Unknown display " << spec
+                  << " (sdl, null, ppm:PREFIX, png:PREFIX, y4m:FILE or "
+                     "rgb:FILE)\n";
+        return nullptr;
+    }
+    if (kind == "sdl")
+        return new Chip8Window(filter, scale != 0 ? scale : 8);
+    if (kind == "null")
+        return new NullDisplay();
+
+    if (scale == 0)
+        scale = 1;
+    if (kind == "ppm" || kind == "png")
+        return new SnapshotDisplay(target, kind == "png", snapshot_every,
+                                   filter, scale);
+    StreamDisplay *stream =
+        new StreamDisplay(target, kind == "y4m", filter, scale);
+    if (!stream->is_running()) {
+        delete stream;
+        return nullptr;
+    }
+    return stream;
+}
@@ -0,0 +1,232 @@
+#include "Environment.h"
+#include "Chip8.h"
+#include "Lockstep.h"
+#include "ThreadPool.h"
+#include <iostream>
+#include <string.h>
+#include <vector>
+
+// Observations and slots start on their own cache line
+static const size_t ring_alignment = 64;
+
+static size_t align_up(size_t size) {
+    return (size + ring_alignment - 1) / ring_alignment * ring_alignment;
+}
+
+static size_t observation_size(uint32_t watch_count) {
+    return align_up(sizeof(chip8_env_observation) + watch_count);
+}
+
+static size_t slot_size(uint32_t env_count, uint32_t watch_count) {
+    return align_up(sizeof(chip8_env_slot_header) +
+                    (size_t)env_count * observation_size(watch_count));
+}
+
+struct chip8_env {
+    uint32_t env_count;
+    uint32_t slot_count;
+    uint32_t max_episode_frames;
+    std::vector<uint16_t> watches;
+    unsigned char *ring;
+    chip8_env_ring_header *header;
+    // A batch per thread, batch b holding the environments from
+    // first_env[b] on
+    std::vector<LockstepBatch *> batches;
+    std::vector<uint32_t> first_env;
+    WorkStealingPool pool;
+    // Per environment and slot, the screen rows that changed since the
+    // slot was last written
+    std::vector<uint64_t> stale_rows;
+    std::vector<uint32_t> episode_frames;
+    std::vector<uint8_t> done;
+
+    chip8_env(unsigned int threads) : pool(threads) {}
+};
+
+// Runs `task(b)` for every batch, in parallel if there are several.
+template <typename Task> static void each_batch(chip8_env *env, Task task) {
+    if (env->batches.size() == 1)
+        task(0);
+    else
+        env->pool.run(env->batches.size(), task);
+}
+
+// Writes batch `b`'s environments into `slot`.
+static void write_observations(chip8_env *env, size_t b, unsigned char *slot,
+                               size_t slot_index) {
+    LockstepBatch &batch = *env->batches[b];
+    size_t stride = env->header->observation_size;
+    for (size_t lane = 0; lane < batch.size(); lane++) {
+        size_t index = env->first_env[b] + lane;
+        Chip8 &chip8 = batch.get_machine(lane);
+        chip8_env_observation &observation =
+            *(chip8_env_observation *)(slot + sizeof(chip8_env_slot_header) +
+                                       index * stride);
+
+        uint64_t *stale = &env->stale_rows[index * env->slot_count];
+        uint64_t changed = chip8.get_dirty_rows();
+        chip8.clear_dirty_rows();
+        if (changed != 0) {
+            for (uint32_t s = 0; s < env->slot_count; s++)
+                stale[s] |= changed;
+        }
+        const Framebuffer &gfx = chip8.get_gfx();
+        for (uint64_t rows = stale[slot_index]; rows != 0; rows &= rows - 1) {
+            int row = __builtin_ctzll(rows);
+            memcpy(observation.planes[0][row], gfx.planes[0][row], 16);
+            memcpy(observation.planes[1][row], gfx.planes[1][row], 16);
+        }
+        stale[slot_index] = 0;
+
+        observation.hires = gfx.hires;
+        observation.done = env->done[index];
+        observation.halted = chip8.get_halt_state();
+        observation.episode_frame = env->episode_frames[index];
+        uint8_t *watched = (uint8_t *)(&observation + 1);
+        for (size_t i = 0; i < env->watches.size(); i++)
+            watched[i] = chip8.read_memory(env->watches[i]);
+    }
+}
+
+// The slot for the next reset or step, with its header filled in.
+static unsigned char *next_slot(chip8_env *env, uint32_t frames,
+                                uint64_t &number, size_t &slot_index) {
+    number = env->header->published + 1;
+    slot_index = (number - 1) % env->slot_count;
+    unsigned char *slot = env->ring + env->header->slots_offset +
+                          slot_index * env->header->slot_size;
+    chip8_env_slot_header &slot_header = *(chip8_env_slot_header *)slot;
+    slot_header.number = number;
+    slot_header.frames = frames;
+    return slot;
+}
+
+static void publish(chip8_env *env, uint64_t number) {
+    // Everything written to the slot is visible before the new count
+    __atomic_store_n(&env->header->published, number, __ATOMIC_RELEASE);
+}
+
+size_t chip8_env_ring_size(uint32_t env_count, uint32_t slot_count,
+                           uint32_t watch_count) {
+    return align_up(sizeof(chip8_env_ring_header)) +
+           (size_t)slot_count * slot_size(env_count, watch_count);
+}
+
+chip8_env *chip8_env_create(const chip8_env_config *config, void *ring,
+                            size_t ring_size) {
+    if (config == nullptr || config->env_count == 0 ||
+        config->slot_count == 0 || config->profile >= QUIRK_PROFILE_COUNT ||
+        (config->rom == nullptr && config->rom_size > 0) ||
+        (config->watch_addresses == nullptr && config->watch_count > 0)) {
+        std::cerr << "ERROR: Invalid environment config\n";
+        return nullptr;
+    }
+    size_t needed = chip8_env_ring_size(config->env_count, config->slot_count,
+                                        config->watch_count);
+    if (ring == nullptr || (uintptr_t)ring % ring_alignment != 0 ||
+        ring_size < needed) {
+        std::cerr << "ERROR: The environment ring needs " << needed
+                  << " bytes aligned to " << ring_alignment << "\n";
+        return nullptr;
+    }
+
+    unsigned int threads = config->threads;
+    if (threads > config->env_count)
+        threads = config->env_count;
+    if (threads == 0)
+        threads = 1;
+    chip8_env *env = new chip8_env(threads);
+    env->env_count = config->env_count;
+    env->slot_count = config->slot_count;
+    env->max_episode_frames = config->max_episode_frames;
+    env->watches.assign(config->watch_addresses,
+                        config->watch_addresses + config->watch_count);
+    env->ring = (unsigned char *)ring;
+    env->header = (chip8_env_ring_header *)ring;
+    // Every slot gets all rows the first time it's written
+    env->stale_rows.assign((size_t)env->env_count * env->slot_count,
+                           ~(uint64_t)0);
+    env->episode_frames.assign(env->env_count, 0);
+    env->done.assign(env->env_count, 0);
+
+    unsigned int ips = config->instructions_per_second;
+    if (ips == 0)
+        ips = 700;
+    for (unsigned int b = 0; b < threads; b++) {
+        uint32_t first = (uint64_t)env->env_count * b / threads;
+        uint32_t end = (uint64_t)env->env_count * (b + 1) / threads;
+        env->first_env.push_back(first);
+        env->batches.push_back(new LockstepBatch(
+            end - first, config->rom, config->rom_size,
+            (quirk_profile)config->profile, first + 1, ips));
+    }
+
+    chip8_env_ring_header &header = *env->header;
+    memset(&header, 0, sizeof(header));
+    header.magic = CHIP8_ENV_RING_MAGIC;
+    header.version = CHIP8_ENV_RING_VERSION;
+    header.env_count = env->env_count;
+    header.slot_count = env->slot_count;
+    header.watch_count = config->watch_count;
+    header.observation_size = observation_size(config->watch_count);
+    header.slot_size = slot_size(env->env_count, config->watch_count);
+    header.slots_offset = align_up(sizeof(chip8_env_ring_header));
+    return env;
+}
+
+void chip8_env_destroy(chip8_env *env) {
+    if (env == nullptr)
+        return;
+    for (LockstepBatch *batch : env->batches)
+        delete batch;
+    delete env;
+}
+
+uint64_t chip8_env_reset(chip8_env *env, const uint32_t *seeds,
+                         const uint8_t *selected) {
+    uint64_t number;
+    size_t slot_index;
+    unsigned char *slot = next_slot(env, 0, number, slot_index);
+    each_batch(env, [&](size_t b) {
+        LockstepBatch &batch = *env->batches[b];
+        for (size_t lane = 0; lane < batch.size(); lane++) {
+            size_t index = env->first_env[b] + lane;
+            if (selected != nullptr && selected[index] == 0)
+                continue;
+            batch.reset_lane(lane, seeds[index]);
+            env->episode_frames[index] = 0;
+            env->done[index] = 0;
+        }
+        write_observations(env, b, slot, slot_index);
+    });
+    publish(env, number);
+    return number;
+}
+
+uint64_t chip8_env_step(chip8_env *env, const uint16_t *key_masks,
+                        uint32_t frame_skip) {
+    if (frame_skip == 0)
+        return 0;
+    uint64_t number;
+    size_t slot_index;
+    unsigned char *slot = next_slot(env, frame_skip, number, slot_index);
+    each_batch(env, [&](size_t b) {
+        LockstepBatch &batch = *env->batches[b];
+        size_t first = env->first_env[b];
+        for (uint32_t frame = 0; frame < frame_skip; frame++)
+            batch.step_batch(key_masks + first);
+        for (size_t lane = 0; lane < batch.size(); lane++) {
+            size_t index = first + lane;
+            uint32_t &frames = env->episode_frames[index];
+            frames += frame_skip;
+            // A fault halts the CPU until the reset, so it's still there
+            if (batch.get_halt_state(lane) == HALT_FAULT ||
+                (env->max_episode_frames > 0 &&
+                 frames >= env->max_episode_frames))
+                env->done[index] = 1;
+        }
+        write_observations(env, b, slot, slot_index);
+    });
+    publish(env, number);
+    return number;
+}
@@ -0,0 +1,86 @@
+#include "Framebuffer.h"
+#include <string.h>
+
+// Rows are 16 bytes and 16 byte aligned, so every row is one aligned vector.
+// Vertical scrolls are row copies; horizontal ones shift both words of a row
+// at once and carry the bits that cross from word 0 into word 1 (or back).
+
+void scroll_down(uint64_t (*rows)[2], int height, int n) {
+    if (n >= height) {
+        memset(rows, 0, height * sizeof(rows[0]));
+        return;
+    }
+#if defined(__SSE2__)
+    __m128i *row = (__m128i *)rows;
+    for (int y = height - 1; y >= n; y--)
+        _mm_store_si128(row + y, _mm_load_si128(row + y - n));
+    for (int y = 0; y < n; y++)
+        _mm_store_si128(row + y, _mm_setzero_si128());
+#else
+    memmove(rows + n, rows, (height - n) * sizeof(rows[0]));
+    memset(rows, 0, n * sizeof(rows[0]));
+#endif
+}
+
+void scroll_up(uint64_t (*rows)[2], int height, int n) {
+    if (n >= height) {
+        memset(rows, 0, height * sizeof(rows[0]));
+        return;
+    }
+#if defined(__SSE2__)
+    __m128i *row = (__m128i *)rows;
+    for (int y = 0; y < height - n; y++)
+        _mm_store_si128(row + y, _mm_load_si128(row + y + n));
+    for (int y = height - n; y < height; y++)
+        _mm_store_si128(row + y, _mm_setzero_si128());
+#else
+    memmove(rows, rows + n, (height - n) * sizeof(rows[0]));
+    memset(rows + height - n, 0, n * sizeof(rows[0]));
+#endif
+}
+
+void scroll_right(uint64_t (*rows)[2], int height, int width, int n) {
+#if defined(__SSE2__)
+    __m128i *row = (__m128i *)rows;
+    __m128i count = _mm_cvtsi32_si128(n);
+    __m128i carry_count = _mm_cvtsi32_si128(64 - n);
+    // Word 1 is off screen in low resolution
+    __m128i visible = _mm_set_epi64x(width > 64 ? -1 : 0, -1);
+    for (int y = 0; y < height; y++) {
+        __m128i v = _mm_load_si128(row + y);
+        // Low bits of word 0 become the high bits of word 1
+        __m128i carry = _mm_slli_si128(_mm_sll_epi64(v, carry_count), 8);
+        v = _mm_or_si128(_mm_srl_epi64(v, count), carry);
+        _mm_store_si128(row + y, _mm_and_si128(v, visible));
+    }
+#else
+    for (int y = 0; y < height; y++) {
+        uint64_t right = rows[y][1] >> n | rows[y][0] << (64 - n);
+        rows[y][0] >>= n;
+        rows[y][1] = width > 64 ? right : 0;
+    }
+#endif
+}
+
+void scroll_left(uint64_t (*rows)[2], int height, int width, int n) {
+#if defined(__SSE2__)
+    __m128i *row = (__m128i *)rows;
+    __m128i count = _mm_cvtsi32_si128(n);
+    __m128i carry_count = _mm_cvtsi32_si128(64 - n);
+    __m128i visible = _mm_set_epi64x(width > 64 ? -1 : 0, -1);
+    for (int y = 0; y < height; y++) {
+        __m128i v = _mm_load_si128(row + y);
+        // High bits of word 1 become the low bits of word 0
+        __m128i carry = _mm_srli_si128(_mm_srl_epi64(v, carry_count), 8);
+        v = _mm_or_si128(_mm_sll_epi64(v, count), carry);
+        _mm_store_si128(row + y, _mm_and_si128(v, visible));
+    }
+#else
+    for (int y = 0; y < height; y++) {
+        rows[y][0] = rows[y][0] << n | rows[y][1] >> (64 - n);
+        rows[y][1] = width > 64 ? rows[y][1] << n : 0;
+    }
+#endif
+}
+
+void clear_rows(uint64_t (*rows)[2]) { memset(rows, 0, 64 * sizeof(rows[0])); }
@@ -1,14 +1,19 @@
 #include "Graphics.h"
 #include <iostream>
 #include <stdlib.h>
+#include <string.h>
 
-Chip8Window::Chip8Window() {
+Chip8Window::Chip8Window(scale_filter filter, int scale) : scale(scale) {
     // anything to do with the display will be scaled for properly viewing.
     // logically shouldn't affect anything else.
     srand(time(nullptr));
 
-    pixels = new Uint32[width * height];
-    memset(pixels, 0, width * height);
+    int texture_scale = filter == FILTER_SDL ? 1 : scale;
+    texture_width = width * texture_scale;
+    texture_height = height * texture_scale;
+    pixels = new Uint32[texture_width * texture_height];
+    memset(pixels, 0, texture_width * texture_height * sizeof(Uint32));
+    scaler = new FrameScaler(filter, texture_width, get_palette().data());
 
     if (SDL_Init(SDL_INIT_VIDEO) < 0) {
         std::cout << "ERROR: SDL could not initialize! SDL_Error: "
@@ -26,14 +31,17 @@ Chip8Window::Chip8Window() {
                       << SDL_GetError() << "\n";
         } else {
             renderer = SDL_CreateRenderer(window, -1, 0);
-            texture =
-                SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
-                                  SDL_TEXTUREACCESS_STATIC, width, height);
+            // Streaming so changed rows can be written straight into the
+            // texture with SDL_LockTexture.
+            texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                                        SDL_TEXTUREACCESS_STREAMING,
+                                        texture_width, texture_height);
 
             set_pixels(); //! DELETE THIS LATER. Just testing if pixel data is
                           //! outputted properly.
 
-            SDL_UpdateTexture(texture, NULL, pixels, width * sizeof(Uint32));
+            SDL_UpdateTexture(texture, NULL, pixels,
+                              texture_width * sizeof(Uint32));
             dest_rect = {0, 0, width * scale, height * scale};
 
             // == update texture ==
@@ -47,6 +55,7 @@ Chip8Window::Chip8Window() {
 
 Chip8Window::~Chip8Window() {
     delete[] pixels;
+    delete scaler;
     SDL_DestroyTexture(texture);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
@@ -56,8 +65,8 @@ Chip8Window::~Chip8Window() {
 // creates a simple chessboard pattern for window (debugging)
 void Chip8Window::set_pixels() {
     bool color = false;
-    for (int i = 0; i < width * height; i++) {
-        if (!(i % width == 0))
+    for (int i = 0; i < texture_width * texture_height; i++) {
+        if (!(i % texture_width == 0))
             color = !color;
         pixels[i] = color ? color_on : color_off;
     }
@@ -69,70 +78,109 @@ void Chip8Window::handle_input() {
         case SDL_QUIT:
             flip_game_running();
             break;
+        //* Key changes show up in the emulator trace (TRACE_KEYS) rather
+        //* than being printed here.
         case SDL_KEYDOWN: {
-            std::cout << "Key press detected" << std::endl;
-            SDL_KeyboardEvent k = event.key;
-            printf("Scancode: 0x%02X", k.keysym.scancode);
-            printf(", (char)Scancode: %c", k.keysym.sym >= 33 && k.keysym.sym <= 126 ? (char)k.keysym.sym : '*');
-            printf(", Name: %s\n", SDL_GetKeyName(k.keysym.sym));
-            // Sorry for the implementation, just want to get this working properly
-            switch(k.keysym.sym) {
-                case '1':
-                    break;
-                case '2':
-                    break;
-                case '3':
-                    break;
-                case '4': 
-                    break;
-                case 'q': 
-                    break;
-                case 'w': 
-                    break;
-                case 'e': 
-                    break;
-                case 'r': 
-                    break;
-                case 'a': 
-                    break;
-                case 's': 
-                    break;
-                case 'd': 
-                    break;
-                case 'f': 
-                    break;
-                case 'z': 
-                    break;
-                case 'x': 
-                    break;
-                case 'c': 
-                    break;
-                case 'v': 
-                    break;
-                default:
-                    printf("Key unrecognized: %c\n", k.keysym.sym);
-                    break;
-            }
+            if (event.key.keysym.sym == SDLK_F5)
+                pending_state_request = STATE_REQUEST_SAVE;
+            else if (event.key.keysym.sym == SDLK_F9)
+                pending_state_request = STATE_REQUEST_LOAD;
+            else if (event.key.keysym.sym == SDLK_BACKSPACE)
+                rewinding = true;
+            int key_num = key_from_keycode(event.key.keysym.sym);
+            if (key_num >= 0)
+                input_set_key(key_num, true);
             break;
         }
-        case SDL_KEYUP:
-            std::cout << "Key release detected" << std::endl;
+        case SDL_KEYUP: {
+            if (event.key.keysym.sym == SDLK_BACKSPACE)
+                rewinding = false;
+            int key_num = key_from_keycode(event.key.keysym.sym);
+            if (key_num >= 0)
+                input_set_key(key_num, false);
             break;
         }
+        }
     }
 }
 
-void Chip8Window::update_screen_with_buffer(unsigned char *gfx) {
-    // update pixels from gfx
-    for (int i = 0; i < width * height; i++) {
-        pixels[i] = gfx[i] == 1 ? color_on : color_off;
+int Chip8Window::key_from_keycode(SDL_Keycode sym) {
+    switch (sym) {
+    case '1':
+        return KEY_PRESS_1;
+    case '2':
+        return KEY_PRESS_2;
+    case '3':
+        return KEY_PRESS_3;
+    case '4':
+        return KEY_PRESS_4;
+    case 'q':
+        return KEY_PRESS_Q;
+    case 'w':
+        return KEY_PRESS_W;
+    case 'e':
+        return KEY_PRESS_E;
+    case 'r':
+        return KEY_PRESS_R;
+    case 'a':
+        return KEY_PRESS_A;
+    case 's':
+        return KEY_PRESS_S;
+    case 'd':
+        return KEY_PRESS_D;
+    case 'f':
+        return KEY_PRESS_F;
+    case 'z':
+        return KEY_PRESS_Z;
+    case 'x':
+        return KEY_PRESS_X;
+    case 'c':
+        return KEY_PRESS_C;
+    case 'v':
+        return KEY_PRESS_V;
+    default:
+        return -1;
     }
+}
 
-    // update texture
-    //* NOTE: instead of copying the entire new array from chip-8 gfx into
-    //* pixels, could instead just update the texture with pointer to gfx
-    // SDL_UpdateTexture(texture, NULL, pixels, width * sizeof(Uint32));
-    SDL_UpdateTexture(texture, NULL, pixels, width * sizeof(Uint32));
+void Chip8Window::update_screen_with_buffer(const Framebuffer &gfx,
+                                            uint64_t dirty_rows) {
+    // Nothing changed, the last presented frame is still correct
+    if (dirty_rows == 0)
+        return;
+
+    uint64_t rows = scaler->update(gfx, dirty_rows);
+    int factor = scaler->get_factor();
+
+    // Lock each run of consecutive changed rows and write the scaled pixels
+    // straight into the texture. Locked memory is write-only, so every pixel
+    // of the locked rows gets written, each texture row once.
+    int y = 0;
+    while (y < gfx.height()) {
+        if (((rows >> y) & 1) == 0) {
+            y++;
+            continue;
+        }
+        int first = y;
+        while (y < gfx.height() && ((rows >> y) & 1) != 0)
+            y++;
+
+        SDL_Rect rect = {0, first * factor, texture_width,
+                         (y - first) * factor};
+        void *locked;
+        int pitch;
+        if (SDL_LockTexture(texture, &rect, &locked, &pitch) != 0) {
+            std::cout << "ERROR: Could not lock texture! SDL_Error: "
+                      << SDL_GetError() << "\n";
+            return;
+        }
+        for (int row_y = first; row_y < y; row_y++)
+            scaler->scale_row(row_y,
+                              (Uint8 *)locked +
+                                  (row_y - first) * factor * pitch,
+                              pitch);
+        SDL_UnlockTexture(texture);
+    }
 
     // clear previous renderer, copy new one from texture, present renderer
     SDL_RenderClear(renderer);
@@ -142,7 +190,7 @@ void Chip8Window::update_screen_with_buffer(unsigned char *gfx) {
 
 void Chip8Window::update_screen() {
     // update pixels from gfx
-    for (int i = 0; i < width * height; i++) {
+    for (int i = 0; i < texture_width * texture_height; i++) {
         pixels[i] = i % 2 == 0 ? color_on : color_off;
     }
 
@@ -150,7 +198,7 @@ void Chip8Window::update_screen() {
     //* NOTE: instead of copying the entire new array from chip-8 gfx into
     //* pixels, could instead just update the texture with pointer to gfx
     // SDL_UpdateTexture(texture, NULL, pixels, width * sizeof(Uint32));
-    SDL_UpdateTexture(texture, NULL, pixels, width * sizeof(Uint32));
+    SDL_UpdateTexture(texture, NULL, pixels, texture_width * sizeof(Uint32));
 
     // clear previous renderer, copy new one from texture, present renderer
     SDL_RenderClear(renderer);
@@ -158,6 +206,4 @@ void Chip8Window::update_screen() {
     SDL_RenderPresent(renderer);
 }
 
-bool Chip8Window::is_running() { return running; }
-
 void Chip8Window::flip_game_running() { running = !running; }
\ No newline at end of file
@@ -0,0 +1,290 @@
+// =====================================================================================
+// x86-64 basic block recompiler.
+//
+// Only instructions that touch nothing but the registers, I and memory reads
+// are translated; everything else ends the block and runs in the interpreter.
+// Translated code gets V in rdi, &index_register in rsi and memory in rdx
+// (System V calling convention) and only uses caller-saved registers.
+// =====================================================================================
+#include "Jit.h"
+#include "Chip8.h"
+#include "Quirks.h"
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__unix__)
+#include <sys/mman.h>
+#define JIT_AVAILABLE 1
+#else
+#define JIT_AVAILABLE 0
+#endif
+
+// Worst case is FX65 with X = F: 16 bytes of bounds check, 16 load/store
+// pairs of 7 bytes each and 4 bytes to move I (increment_index quirk).
+static const size_t max_instruction_bytes = 132;
+static const size_t code_buffer_size = 1024 * 1024;
+
+Chip8Jit::Chip8Jit() {
+    memset(self_modified, 0, sizeof(self_modified));
+    flush();
+#if JIT_AVAILABLE
+    void *buffer = mmap(nullptr, code_buffer_size,
+                        PROT_READ | PROT_WRITE | PROT_EXEC,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer != MAP_FAILED) {
+        code_buffer = (unsigned char *)buffer;
+        code_capacity = code_buffer_size;
+    }
+#endif
+}
+
+Chip8Jit::~Chip8Jit() {
+#if JIT_AVAILABLE
+    if (code_buffer != nullptr)
+        munmap(code_buffer, code_capacity);
+#endif
+}
+
+void Chip8Jit::flush() {
+    code_used = 0;
+    for (int i = 0; i < 4096; i++) {
+        blocks[i].code = nullptr;
+        blocks[i].length = 0;
+        blocks[i].compiled = false;
+        covered[i] = false;
+    }
+}
+
+void Chip8Jit::invalidate(unsigned short address) {
+    address &= 0xFFF;
+    self_modified[address] = true;
+    // Blocks are small and self-modifying code is rare, so rather than
+    // tracking which blocks overlap the address just start over.
+    if (covered[address])
+        flush();
+}
+
+void Chip8Jit::reset() {
+    memset(self_modified, 0, sizeof(self_modified));
+    flush();
+}
+
+int Chip8Jit::step(Chip8 &chip8) {
+    unsigned short address = chip8.prog_counter & 0xFFF;
+    Block &block = blocks[address];
+    if (!block.compiled)
+        compile(chip8, address);
+    if (block.code == nullptr) {
+        chip8.emulate_cycle();
+        return 1;
+    }
+
+    int executed = block.code(chip8.V, &chip8.index_register, chip8.memory);
+    chip8.prog_counter += 2 * executed;
+    // The last instruction executed, as emulate_cycle() leaves it
+    if (executed > 0)
+        chip8.opcode = chip8.memory[(chip8.prog_counter - 2) & 0xFFF] << 8 |
+                       chip8.memory[(chip8.prog_counter - 1) & 0xFFF];
+
+    // A bounds check inside the block bailed out, the interpreter handles that
+    // instruction.
+    if (executed < block.length) {
+        chip8.emulate_cycle();
+        executed++;
+    }
+    return executed;
+}
+
+unsigned long Chip8Jit::run(Chip8 &chip8, unsigned long count) {
+    unsigned long executed = 0;
+    while (executed < count) {
+        if (chip8.halted != HALT_NONE) {
+            // Same fast-forward as Chip8::run()
+            chip8.idle_cycles += count - executed;
+            return count;
+        }
+        executed += step(chip8);
+    }
+    return executed;
+}
+
+void Chip8Jit::compile(const Chip8 &chip8, unsigned short address) {
+    if (code_buffer != nullptr &&
+        code_capacity - code_used < max_block_length * max_instruction_bytes + 16)
+        flush();
+
+    Block &block = blocks[address];
+    block.compiled = true;
+    block.code = nullptr;
+    block.length = 0;
+    if (code_buffer == nullptr)
+        return;
+
+    // Quirks only change which code gets emitted, so they're settled here
+    QuirkFlags quirks = quirk_flags(chip8.quirks);
+    size_t start = code_used;
+    int length = 0;
+    int pc = address;
+    while (length < max_block_length && pc + 1 < 4096) {
+        if (self_modified[pc] || self_modified[pc + 1])
+            break;
+        unsigned short opcode = chip8.memory[pc] << 8 | chip8.memory[pc + 1];
+        size_t mark = code_used;
+        if (!emit_instruction(opcode, length, quirks)) {
+            code_used = mark;
+            break;
+        }
+        length++;
+        pc += 2;
+    }
+    if (length == 0) {
+        code_used = start;
+        return;
+    }
+
+    // mov eax, length; ret
+    emit(0xB8);
+    emit32(length);
+    emit(0xC3);
+
+    void *entry = code_buffer + start;
+    memcpy(&block.code, &entry, sizeof(block.code));
+    block.length = length;
+    for (int i = address; i < pc; i++)
+        covered[i] = true;
+}
+
+// vf_reset quirk after 8XY1/8XY2/8XY3: mov byte [rdi + 0xF], 0
+void Chip8Jit::emit_vf_reset(const QuirkFlags &quirks) {
+    if (quirks.vf_reset)
+        emit(0xC6), emit(0x47), emit(0x0F), emit(0x00);
+}
+
+void Chip8Jit::emit32(unsigned int value) {
+    emit(value & 0xFF);
+    emit((value >> 8) & 0xFF);
+    emit((value >> 16) & 0xFF);
+    emit((value >> 24) & 0xFF);
+}
+
+// Register operands are addressed as [rdi + disp8], which is what the 0x47
+// (al) and 0x4F (cl) ModRM bytes below encode.
+bool Chip8Jit::emit_instruction(unsigned short opcode, int executed,
+                                const QuirkFlags &quirks) {
+    unsigned char x = (opcode & 0x0F00) >> 8;
+    unsigned char y = (opcode & 0x00F0) >> 4;
+    // Register the shifts read from
+    unsigned char shifted = quirks.shift_vy ? y : x;
+    unsigned char nn = opcode & 0x00FF;
+    unsigned short nnn = opcode & 0x0FFF;
+
+    switch (opcode & 0xF000) {
+    case 0x6000: // 6XNN: mov byte [rdi + X], NN
+        emit(0xC6), emit(0x47), emit(x), emit(nn);
+        return true;
+    case 0x7000: // 7XNN: add byte [rdi + X], NN
+        emit(0x80), emit(0x47), emit(x), emit(nn);
+        return true;
+    case 0xA000: // ANNN: mov word [rsi], NNN
+        emit(0x66), emit(0xC7), emit(0x06);
+        emit(nnn & 0xFF), emit(nnn >> 8);
+        return true;
+    case 0x8000: {
+        // VF is written before VX in the interpreter, so any form that reads
+        // or writes VF through X or Y is left to it.
+        bool uses_vf = x == 0xF || y == 0xF;
+        switch (opcode & 0x000F) {
+        case 0x0000: // 8XY0: mov al, [rdi + Y]; mov [rdi + X], al
+            emit(0x8A), emit(0x47), emit(y);
+            emit(0x88), emit(0x47), emit(x);
+            return true;
+        case 0x0001: // 8XY1: mov al, [rdi + Y]; or [rdi + X], al
+            emit(0x8A), emit(0x47), emit(y);
+            emit(0x08), emit(0x47), emit(x);
+            emit_vf_reset(quirks);
+            return true;
+        case 0x0002: // 8XY2: mov al, [rdi + Y]; and [rdi + X], al
+            emit(0x8A), emit(0x47), emit(y);
+            emit(0x20), emit(0x47), emit(x);
+            emit_vf_reset(quirks);
+            return true;
+        case 0x0003: // 8XY3: mov al, [rdi + Y]; xor [rdi + X], al
+            emit(0x8A), emit(0x47), emit(y);
+            emit(0x30), emit(0x47), emit(x);
+            emit_vf_reset(quirks);
+            return true;
+        case 0x0004: // 8XY4: mov al, [X]; add al, [Y]; setc cl
+            if (uses_vf)
+                return false;
+            emit(0x8A), emit(0x47), emit(x);
+            emit(0x02), emit(0x47), emit(y);
+            emit(0x0F), emit(0x92), emit(0xC1);
+            break;
+        case 0x0005: // 8XY5: mov al, [X]; sub al, [Y]; setc cl
+            if (uses_vf)
+                return false;
+            emit(0x8A), emit(0x47), emit(x);
+            emit(0x2A), emit(0x47), emit(y);
+            emit(0x0F), emit(0x92), emit(0xC1);
+            break;
+        case 0x0006: // 8XY6: mov al, [X or Y]; mov cl, al; and cl, 1; shr al, 1
+            if (uses_vf)
+                return false;
+            emit(0x8A), emit(0x47), emit(shifted);
+            emit(0x88), emit(0xC1);
+            emit(0x80), emit(0xE1), emit(0x01);
+            emit(0xD0), emit(0xE8);
+            break;
+        case 0x0007: // 8XY7: mov al, [Y]; sub al, [X]; setc cl
+            if (uses_vf)
+                return false;
+            emit(0x8A), emit(0x47), emit(y);
+            emit(0x2A), emit(0x47), emit(x);
+            emit(0x0F), emit(0x92), emit(0xC1);
+            break;
+        case 0x000E: // 8XYE: mov al, [X or Y]; shl al, 1; setc cl
+            if (uses_vf)
+                return false;
+            emit(0x8A), emit(0x47), emit(shifted);
+            emit(0xD0), emit(0xE0);
+            emit(0x0F), emit(0x92), emit(0xC1);
+            break;
+        default:
+            return false;
+        }
+        // mov [rdi + X], al; mov [rdi + 0xF], cl
+        emit(0x88), emit(0x47), emit(x);
+        emit(0x88), emit(0x4F), emit(0x0F);
+        return true;
+    }
+    case 0xF000:
+        switch (opcode & 0x00FF) {
+        case 0x001E: // FX1E: movzx eax, byte [rdi + X]; add [rsi], ax
+            emit(0x0F), emit(0xB6), emit(0x47), emit(x);
+            emit(0x66), emit(0x01), emit(0x06);
+            return true;
+        case 0x0029: // FX29: movzx eax, byte [rdi + X]; mov [rsi], ax
+            emit(0x0F), emit(0xB6), emit(0x47), emit(x);
+            emit(0x66), emit(0x89), emit(0x06);
+            return true;
+        case 0x0065: // FX65
+            // movzx eax, word [rsi]; cmp eax, 0xFFF - X
+            emit(0x0F), emit(0xB7), emit(0x06);
+            emit(0x3D), emit32(0xFFF - x);
+            // jbe over the exit; mov eax, executed; ret
+            emit(0x76), emit(0x06);
+            emit(0xB8), emit32(executed);
+            emit(0xC3);
+            for (int i = 0; i <= x; i++) {
+                // mov cl, [rdx + rax + i]; mov [rdi + i], cl
+                emit(0x8A), emit(0x4C), emit(0x02), emit(i);
+                emit(0x88), emit(0x4F), emit(i);
+            }
+            // increment_index quirk: add word [rsi], X + 1
+            if (quirks.increment_index)
+                emit(0x66), emit(0x83), emit(0x06), emit(x + 1);
+            return true;
+        }
+        return false;
+    }
+    return false;
+}
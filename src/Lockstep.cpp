@@ -0,0 +1,642 @@
+#include "Lockstep.h"
+#include "OpcodeTable.h"
+#include "SaveState.h"
+#include <string.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// == Lanes ==
+//* 32 lanes at a time: one register of 32 machines is an AVX2 vector of
+//* bytes, I and the program counter are two vectors of words. A lane mask
+//* (Bytes) is 0xFF in the lanes an operation applies to and 0 elsewhere.
+//* Without AVX2 the same operations are plain loops, which the compiler
+//* vectorizes for whatever the target has.
+
+#if defined(__AVX2__)
+struct Bytes {
+    __m256i v;
+};
+struct Words {
+    __m256i lo, hi; // lanes 0-15, 16-31
+};
+
+static inline Bytes load_bytes(const uint8_t *p) {
+    return {_mm256_loadu_si256((const __m256i *)p)};
+}
+static inline void store_bytes(uint8_t *p, Bytes value, Bytes mask) {
+    __m256i old = _mm256_loadu_si256((const __m256i *)p);
+    _mm256_storeu_si256((__m256i *)p, _mm256_blendv_epi8(old, value.v, mask.v));
+}
+static inline Bytes splat(uint8_t value) {
+    return {_mm256_set1_epi8((char)value)};
+}
+static inline Bytes operator+(Bytes a, Bytes b) {
+    return {_mm256_add_epi8(a.v, b.v)};
+}
+static inline Bytes operator-(Bytes a, Bytes b) {
+    return {_mm256_sub_epi8(a.v, b.v)};
+}
+static inline Bytes operator&(Bytes a, Bytes b) {
+    return {_mm256_and_si256(a.v, b.v)};
+}
+static inline Bytes operator|(Bytes a, Bytes b) {
+    return {_mm256_or_si256(a.v, b.v)};
+}
+static inline Bytes operator^(Bytes a, Bytes b) {
+    return {_mm256_xor_si256(a.v, b.v)};
+}
+static inline Bytes operator~(Bytes a) {
+    return {_mm256_xor_si256(a.v, _mm256_set1_epi8(-1))};
+}
+static inline Bytes equal(Bytes a, Bytes b) {
+    return {_mm256_cmpeq_epi8(a.v, b.v)};
+}
+// a < b, unsigned
+static inline Bytes below(Bytes a, Bytes b) {
+    return ~equal({_mm256_max_epu8(a.v, b.v)}, a);
+}
+static inline Bytes shr1(Bytes a) {
+    return {_mm256_and_si256(_mm256_srli_epi16(a.v, 1),
+                             _mm256_set1_epi8(0x7F))};
+}
+static inline Bytes shr7(Bytes a) {
+    return {_mm256_and_si256(_mm256_srli_epi16(a.v, 7), _mm256_set1_epi8(1))};
+}
+static inline Bytes decrement_to_zero(Bytes a) {
+    return {_mm256_subs_epu8(a.v, _mm256_set1_epi8(1))};
+}
+static inline Bytes select(Bytes mask, Bytes a, Bytes b) {
+    return {_mm256_blendv_epi8(b.v, a.v, mask.v)};
+}
+static inline uint32_t bits_of(Bytes mask) {
+    return (uint32_t)_mm256_movemask_epi8(mask.v);
+}
+// The mask with lane n set for bit n of `bits`
+static inline Bytes lanes_in(uint32_t bits) {
+    // Byte n gets byte n / 8 of `bits`, then tests bit n % 8
+    const __m256i spread = _mm256_setr_epi8(
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2,
+        3, 3, 3, 3, 3, 3, 3, 3);
+    const __m256i bit = _mm256_set1_epi64x(0x8040201008040201LL);
+    __m256i v = _mm256_shuffle_epi8(_mm256_set1_epi32((int)bits), spread);
+    return {_mm256_cmpeq_epi8(_mm256_and_si256(v, bit), bit)};
+}
+
+static inline Words load_words(const uint16_t *p) {
+    return {_mm256_loadu_si256((const __m256i *)p),
+            _mm256_loadu_si256((const __m256i *)(p + 16))};
+}
+static inline void store_words(uint16_t *p, Words value, Bytes mask) {
+    __m256i mask_lo = _mm256_cvtepi8_epi16(_mm256_castsi256_si128(mask.v));
+    __m256i mask_hi = _mm256_cvtepi8_epi16(_mm256_extracti128_si256(mask.v, 1));
+    Words old = load_words(p);
+    _mm256_storeu_si256((__m256i *)p,
+                        _mm256_blendv_epi8(old.lo, value.lo, mask_lo));
+    _mm256_storeu_si256((__m256i *)(p + 16),
+                        _mm256_blendv_epi8(old.hi, value.hi, mask_hi));
+}
+static inline Words splat_words(uint16_t value) {
+    __m256i v = _mm256_set1_epi16((short)value);
+    return {v, v};
+}
+static inline Words operator+(Words a, Words b) {
+    return {_mm256_add_epi16(a.lo, b.lo), _mm256_add_epi16(a.hi, b.hi)};
+}
+// Zero extended
+static inline Words widen(Bytes a) {
+    return {_mm256_cvtepu8_epi16(_mm256_castsi256_si128(a.v)),
+            _mm256_cvtepu8_epi16(_mm256_extracti128_si256(a.v, 1))};
+}
+// Lanes whose word equals `value`, as bits
+static inline uint32_t words_equal(const uint16_t *p, uint16_t value) {
+    __m256i v = _mm256_set1_epi16((short)value);
+    __m256i lo = _mm256_cmpeq_epi16(
+        _mm256_loadu_si256((const __m256i *)p), v);
+    __m256i hi = _mm256_cmpeq_epi16(
+        _mm256_loadu_si256((const __m256i *)(p + 16)), v);
+    // packs interleaves the 128 bit halves, the permute puts them back
+    __m256i packed =
+        _mm256_permute4x64_epi64(_mm256_packs_epi16(lo, hi), 0xD8);
+    return (uint32_t)_mm256_movemask_epi8(packed);
+}
+
+// Chip8::random_byte() on the lanes in `mask`, 8 at a time
+static inline Bytes random_bytes(uint32_t *state, Bytes mask) {
+    __m256i top[4];
+    for (int i = 0; i < 4; i++) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(state + 8 * i));
+        __m256i next = _mm256_xor_si256(x, _mm256_slli_epi32(x, 13));
+        next = _mm256_xor_si256(next, _mm256_srli_epi32(next, 17));
+        next = _mm256_xor_si256(next, _mm256_slli_epi32(next, 5));
+        __m256i lanes = _mm256_cvtepi8_epi32(
+            _mm_loadl_epi64((const __m128i *)((const char *)&mask.v + 8 * i)));
+        _mm256_storeu_si256((__m256i *)(state + 8 * i),
+                            _mm256_blendv_epi8(x, next, lanes));
+        top[i] = _mm256_srli_epi32(next, 24);
+    }
+    // 4 x 8 dwords down to 32 bytes, the packs mix up the order of the
+    // dwords
+    __m256i bytes = _mm256_packus_epi16(_mm256_packus_epi32(top[0], top[1]),
+                                        _mm256_packus_epi32(top[2], top[3]));
+    return {_mm256_permutevar8x32_epi32(
+        bytes, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7))};
+}
+#else
+struct Bytes {
+    uint8_t b[32];
+};
+struct Words {
+    uint16_t w[32];
+};
+
+#define EACH_LANE(i) for (int i = 0; i < 32; i++)
+
+static inline Bytes load_bytes(const uint8_t *p) {
+    Bytes r;
+    memcpy(r.b, p, sizeof(r.b));
+    return r;
+}
+static inline void store_bytes(uint8_t *p, Bytes value, Bytes mask) {
+    EACH_LANE(i) p[i] = mask.b[i] ? value.b[i] : p[i];
+}
+static inline Bytes splat(uint8_t value) {
+    Bytes r;
+    memset(r.b, value, sizeof(r.b));
+    return r;
+}
+#define BYTES_OP(op)                                                           \
+    static inline Bytes operator op(Bytes a, Bytes b) {                        \
+        Bytes r;                                                               \
+        EACH_LANE(i) r.b[i] = a.b[i] op b.b[i];                                \
+        return r;                                                              \
+    }
+BYTES_OP(+)
+BYTES_OP(-)
+BYTES_OP(&)
+BYTES_OP(|)
+BYTES_OP(^)
+#undef BYTES_OP
+static inline Bytes operator~(Bytes a) {
+    EACH_LANE(i) a.b[i] = ~a.b[i];
+    return a;
+}
+static inline Bytes equal(Bytes a, Bytes b) {
+    Bytes r;
+    EACH_LANE(i) r.b[i] = a.b[i] == b.b[i] ? 0xFF : 0;
+    return r;
+}
+static inline Bytes below(Bytes a, Bytes b) {
+    Bytes r;
+    EACH_LANE(i) r.b[i] = a.b[i] < b.b[i] ? 0xFF : 0;
+    return r;
+}
+static inline Bytes shr1(Bytes a) {
+    EACH_LANE(i) a.b[i] >>= 1;
+    return a;
+}
+static inline Bytes shr7(Bytes a) {
+    EACH_LANE(i) a.b[i] >>= 7;
+    return a;
+}
+static inline Bytes decrement_to_zero(Bytes a) {
+    EACH_LANE(i) a.b[i] -= a.b[i] != 0;
+    return a;
+}
+static inline Bytes select(Bytes mask, Bytes a, Bytes b) {
+    EACH_LANE(i) a.b[i] = mask.b[i] ? a.b[i] : b.b[i];
+    return a;
+}
+static inline uint32_t bits_of(Bytes mask) {
+    uint32_t bits = 0;
+    EACH_LANE(i) bits |= (uint32_t)(mask.b[i] >> 7) << i;
+    return bits;
+}
+static inline Bytes lanes_in(uint32_t bits) {
+    Bytes r;
+    EACH_LANE(i) r.b[i] = (bits >> i) & 1 ? 0xFF : 0;
+    return r;
+}
+
+static inline Words load_words(const uint16_t *p) {
+    Words r;
+    memcpy(r.w, p, sizeof(r.w));
+    return r;
+}
+static inline void store_words(uint16_t *p, Words value, Bytes mask) {
+    EACH_LANE(i) p[i] = mask.b[i] ? value.w[i] : p[i];
+}
+static inline Words splat_words(uint16_t value) {
+    Words r;
+    EACH_LANE(i) r.w[i] = value;
+    return r;
+}
+static inline Words operator+(Words a, Words b) {
+    EACH_LANE(i) a.w[i] += b.w[i];
+    return a;
+}
+static inline Words widen(Bytes a) {
+    Words r;
+    EACH_LANE(i) r.w[i] = a.b[i];
+    return r;
+}
+static inline uint32_t words_equal(const uint16_t *p, uint16_t value) {
+    uint32_t bits = 0;
+    EACH_LANE(i) bits |= (uint32_t)(p[i] == value) << i;
+    return bits;
+}
+
+static inline Bytes random_bytes(uint32_t *state, Bytes mask) {
+    Bytes r;
+    EACH_LANE(i) {
+        uint32_t next = state[i];
+        next ^= next << 13;
+        next ^= next >> 17;
+        next ^= next << 5;
+        if (mask.b[i])
+            state[i] = next;
+        r.b[i] = next >> 24;
+    }
+    return r;
+}
+
+#undef EACH_LANE
+#endif
+
+// == Batch ==
+
+LockstepBatch::LockstepBatch(size_t lanes, const unsigned char *rom,
+                             size_t size, quirk_profile profile,
+                             unsigned int seed,
+                             unsigned int instructions_per_second)
+    : lanes(lanes),
+      padded((lanes + block_lanes - 1) / block_lanes * block_lanes),
+      cycles_per_frame(instructions_per_second / 60) {
+    if (profile >= QUIRK_PROFILE_COUNT)
+        profile = QUIRKS_DEFAULT;
+    flags = quirk_flags(profile);
+    kind_table = flags.super_chip ? &opcode_kinds_extended : &opcode_kinds;
+    for (int r = 0; r < 16; r++)
+        V[r].assign(padded, 0);
+    index_register.assign(padded, 0);
+    prog_counter.assign(padded, 0);
+    opcode.assign(padded, 0);
+    sp.assign(padded, 0);
+    stack_current_size.assign(padded, 0);
+    delay_timer.assign(padded, 0);
+    sound_timer.assign(padded, 0);
+    // Padding lanes stay halted, so they're never grouped
+    halted.assign(padded, HALT_WAIT_KEY);
+    keys.assign(padded, 0);
+    rng_state.assign(padded, 1);
+    pending.assign(padded / block_lanes, 0);
+    group.assign(padded / block_lanes, 0);
+    ahead_lanes.assign(padded / block_lanes, 0);
+    ahead.assign(padded, 0);
+
+    // Every lane saves the same snapshot (the seed comes after), which
+    // makes it the last snapshot of each of them for reset_to_snapshot()
+    initial = new SaveState();
+    machines.resize(lanes);
+    for (size_t lane = 0; lane < lanes; lane++) {
+        Chip8 *chip8 = new Chip8();
+        chip8->initialize();
+        chip8->set_quirks(profile);
+        // The ROM image is shared, lanes only get pages of their own when
+        // they write
+        chip8->load_rom(rom, size);
+        chip8->seed(seed);
+        chip8->save_snapshot(*initial);
+        chip8->seed(seed + lane);
+        machines[lane] = chip8;
+        from_machine(lane);
+    }
+    memcpy(code, initial->memory, sizeof(code));
+}
+
+LockstepBatch::~LockstepBatch() {
+    for (Chip8 *chip8 : machines)
+        delete chip8;
+    delete initial;
+}
+
+void LockstepBatch::to_machine(size_t lane) {
+    Chip8 &chip8 = *machines[lane];
+    for (int r = 0; r < 16; r++)
+        chip8.V[r] = V[r][lane];
+    chip8.index_register = index_register[lane];
+    chip8.prog_counter = prog_counter[lane];
+    chip8.opcode = opcode[lane];
+    chip8.sp = sp[lane];
+    chip8.stack_current_size = stack_current_size[lane];
+    chip8.delay_timer = delay_timer[lane];
+    chip8.sound_timer = sound_timer[lane];
+    chip8.halted = (halt_state)halted[lane];
+    chip8.keys = keys[lane];
+    chip8.rng_state = rng_state[lane];
+}
+
+void LockstepBatch::from_machine(size_t lane) {
+    const Chip8 &chip8 = *machines[lane];
+    for (int r = 0; r < 16; r++)
+        V[r][lane] = chip8.V[r];
+    index_register[lane] = chip8.index_register;
+    prog_counter[lane] = chip8.prog_counter;
+    opcode[lane] = chip8.opcode;
+    sp[lane] = chip8.sp;
+    stack_current_size[lane] = chip8.stack_current_size;
+    delay_timer[lane] = chip8.delay_timer;
+    sound_timer[lane] = chip8.sound_timer;
+    halted[lane] = chip8.halted;
+    keys[lane] = chip8.keys;
+    rng_state[lane] = chip8.rng_state;
+}
+
+void LockstepBatch::step_batch(const uint16_t *actions) {
+    for (size_t lane = 0; lane < lanes; lane++) {
+        // Only a key press ending an FX0A wait needs the machine
+        if (halted[lane] == HALT_WAIT_KEY && (actions[lane] & ~keys[lane])) {
+            to_machine(lane);
+            machines[lane]->set_keys(actions[lane]);
+            from_machine(lane);
+        } else {
+            keys[lane] = actions[lane];
+        }
+        // Chip8::run() counts the slots of a halted CPU as idle
+        if (halted[lane] != HALT_NONE)
+            machines[lane]->idle_cycles += cycles_per_frame;
+    }
+
+    for (unsigned long cycle = 0; cycle < cycles_per_frame; cycle++) {
+        if (!step_cycle(cycle))
+            break;
+    }
+    // Lanes ahead when the rest halted are done with the frame too
+    for (size_t b = 0; b < ahead_lanes.size(); b++) {
+        for (uint32_t bits = ahead_lanes[b]; bits != 0; bits &= bits - 1)
+            ahead[b * block_lanes + __builtin_ctz(bits)] = 0;
+        ahead_lanes[b] = 0;
+    }
+
+    // Chip8::update_timers() on every lane
+    for (size_t base = 0; base < padded; base += block_lanes) {
+        Bytes delay = load_bytes(&delay_timer[base]);
+        Bytes sound = load_bytes(&sound_timer[base]);
+        Bytes all = splat(0xFF);
+        store_bytes(&delay_timer[base], decrement_to_zero(delay), all);
+        store_bytes(&sound_timer[base], decrement_to_zero(sound), all);
+        Bytes state = load_bytes(&halted[base]);
+        store_bytes(&halted[base], splat(HALT_NONE),
+                    equal(state, splat(HALT_WAIT_TIMER)));
+    }
+}
+
+bool LockstepBatch::step_cycle(unsigned long cycle) {
+    size_t blocks = padded / block_lanes;
+    bool any = false;
+    for (size_t b = 0; b < blocks; b++) {
+        pending[b] = bits_of(
+            equal(load_bytes(&halted[b * block_lanes]), splat(HALT_NONE)));
+        any |= pending[b] != 0;
+        // Lanes that ran this cycle already sit it out
+        uint32_t skipped = ahead_lanes[b];
+        for (uint32_t bits = skipped; bits != 0; bits &= bits - 1) {
+            size_t lane = b * block_lanes + __builtin_ctz(bits);
+            if (--ahead[lane] == 0)
+                ahead_lanes[b] &= ~(1u << (lane % block_lanes));
+        }
+        pending[b] &= ~skipped;
+    }
+    if (!any)
+        return false;
+
+    for (size_t b = 0; b < blocks; b++) {
+        while (pending[b] != 0) {
+            // The lowest lane still to go leads a group of every pending
+            // lane at the same address
+            unsigned short pc =
+                prog_counter[b * block_lanes + __builtin_ctz(pending[b])];
+            for (size_t g = b; g < blocks; g++) {
+                if (pending[g] == 0) {
+                    group[g] = 0;
+                    continue;
+                }
+                group[g] = pending[g] &
+                           words_equal(&prog_counter[g * block_lanes], pc);
+                pending[g] &= ~group[g];
+            }
+            if (run_vector(pc, b))
+                continue;
+            for (size_t g = b; g < blocks; g++) {
+                for (uint32_t bits = group[g]; bits != 0; bits &= bits - 1)
+                    run_scalar(g * block_lanes + __builtin_ctz(bits), cycle);
+            }
+        }
+    }
+    return true;
+}
+
+void LockstepBatch::run_scalar(size_t lane, unsigned long cycle) {
+    Chip8 &chip8 = *machines[lane];
+    to_machine(lane);
+    unsigned long steps = 0;
+    do {
+        chip8.emulate_cycle();
+        steps++;
+        // Writes below 0x1000 may have been to code
+        code_written |= chip8.dirty_pages[0] & 0xFFFF;
+    } while (chip8.halted == HALT_NONE && cycle + steps < cycles_per_frame &&
+             !vectorizable(chip8.prog_counter));
+    from_machine(lane);
+    scalar_steps += steps;
+    if (chip8.halted != HALT_NONE) {
+        chip8.idle_cycles += cycles_per_frame - cycle - steps;
+    } else if (steps > 1) {
+        ahead[lane] = steps - 1;
+        ahead_lanes[lane / block_lanes] |= 1u << (lane % block_lanes);
+    }
+}
+
+bool LockstepBatch::vectorizable(unsigned short pc) {
+    // The instruction, and the one a skip looks at, have to be as loaded on
+    // every lane
+    unsigned short at = pc & 0xFFF;
+    uint16_t pages = 1 << (at >> 8) | 1 << (((pc + 3) & 0xFFF) >> 8);
+    if ((code_written & pages) != 0)
+        return false;
+    unsigned short op = code[at] << 8 | code[(pc + 1) & 0xFFF];
+    switch ((*kind_table)[op]) {
+    case OP_1NNN:
+        // Idle loops halt the CPU, op_1NNN() spots those
+        return (op & 0x0FFF) != pc && (op & 0x0FFF) != ((pc - 4) & 0xFFF);
+    case OP_8XY4:
+    case OP_8XY5:
+    case OP_8XY7:
+        // The handlers write VF and then read VX and VY, so the new flag is
+        // what they see through X or Y; those forms are left to them
+        return (op & 0x0F00) != 0x0F00 && (op & 0x00F0) != 0x00F0;
+    case OP_3XNN:
+    case OP_4XNN:
+    case OP_5XY0:
+    case OP_6XNN:
+    case OP_7XNN:
+    case OP_8XY0:
+    case OP_8XY1:
+    case OP_8XY2:
+    case OP_8XY3:
+    case OP_8XY6:
+    case OP_8XYE:
+    case OP_9XY0:
+    case OP_ANNN:
+    case OP_CXNN:
+    case OP_FX07:
+    case OP_FX15:
+    case OP_FX18:
+    case OP_FX1E:
+    case OP_FX29:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool LockstepBatch::run_vector(unsigned short pc, size_t first) {
+    if (!vectorizable(pc))
+        return false;
+    unsigned short op = code[pc & 0xFFF] << 8 | code[(pc + 1) & 0xFFF];
+    opcode_kind kind = (opcode_kind)(*kind_table)[op];
+    unsigned char x = (op & 0x0F00) >> 8;
+    unsigned char y = (op & 0x00F0) >> 4;
+    unsigned char nn = op & 0x00FF;
+    unsigned short nnn = op & 0x0FFF;
+    // Chip8::skip_distance()
+    unsigned short skip = 4;
+    if (flags.xo_chip && code[(pc + 2) & 0xFFF] == 0xF0 &&
+        code[(pc + 3) & 0xFFF] == 0x00)
+        skip = 6;
+
+    for (size_t b = first; b < padded / block_lanes; b++) {
+        if (group[b] == 0)
+            continue;
+        size_t base = b * block_lanes;
+        Bytes mask = lanes_in(group[b]);
+        Bytes vx = load_bytes(&V[x][base]);
+        Bytes vy = load_bytes(&V[y][base]);
+        Bytes one = splat(1);
+        // Lanes that skip the next instruction
+        Bytes taken = splat(0);
+        // The handlers write VF before VX, except where VF is reset
+        switch (kind) {
+        case OP_3XNN:
+            taken = equal(vx, splat(nn));
+            break;
+        case OP_4XNN:
+            taken = ~equal(vx, splat(nn));
+            break;
+        case OP_5XY0:
+            taken = equal(vx, vy);
+            break;
+        case OP_9XY0:
+            taken = ~equal(vx, vy);
+            break;
+        case OP_6XNN:
+            store_bytes(&V[x][base], splat(nn), mask);
+            break;
+        case OP_7XNN:
+            store_bytes(&V[x][base], vx + splat(nn), mask);
+            break;
+        case OP_8XY0:
+            store_bytes(&V[x][base], vy, mask);
+            break;
+        case OP_8XY1:
+        case OP_8XY2:
+        case OP_8XY3:
+            store_bytes(&V[x][base],
+                        kind == OP_8XY1   ? vx | vy
+                        : kind == OP_8XY2 ? vx & vy
+                                          : vx ^ vy,
+                        mask);
+            if (flags.vf_reset)
+                store_bytes(&V[0xF][base], splat(0), mask);
+            break;
+        case OP_8XY4: {
+            Bytes sum = vx + vy;
+            store_bytes(&V[0xF][base], below(sum, vx) & one, mask);
+            store_bytes(&V[x][base], sum, mask);
+            break;
+        }
+        case OP_8XY5:
+            store_bytes(&V[0xF][base], below(vx, vy) & one, mask);
+            store_bytes(&V[x][base], vx - vy, mask);
+            break;
+        case OP_8XY7:
+            store_bytes(&V[0xF][base], below(vy, vx) & one, mask);
+            store_bytes(&V[x][base], vy - vx, mask);
+            break;
+        case OP_8XY6: {
+            Bytes source = flags.shift_vy ? vy : vx;
+            store_bytes(&V[0xF][base], source & one, mask);
+            store_bytes(&V[x][base], shr1(source), mask);
+            break;
+        }
+        case OP_8XYE: {
+            Bytes source = flags.shift_vy ? vy : vx;
+            store_bytes(&V[0xF][base], shr7(source), mask);
+            store_bytes(&V[x][base], source + source, mask);
+            break;
+        }
+        case OP_ANNN:
+            store_words(&index_register[base], splat_words(nnn), mask);
+            break;
+        case OP_CXNN:
+            store_bytes(&V[x][base],
+                        random_bytes(&rng_state[base], mask) & splat(nn),
+                        mask);
+            break;
+        case OP_FX07:
+            store_bytes(&V[x][base], load_bytes(&delay_timer[base]), mask);
+            break;
+        case OP_FX15:
+            store_bytes(&delay_timer[base], vx, mask);
+            break;
+        case OP_FX18:
+            store_bytes(&sound_timer[base], vx, mask);
+            break;
+        case OP_FX1E:
+            store_words(&index_register[base],
+                        load_words(&index_register[base]) + widen(vx), mask);
+            break;
+        case OP_FX29:
+            store_words(&index_register[base], widen(vx), mask);
+            break;
+        default:
+            break;
+        }
+
+        if (kind == OP_1NNN) {
+            store_words(&prog_counter[base], splat_words(nnn), mask);
+        } else {
+            Words step = widen(select(taken, splat(skip), splat(2)));
+            store_words(&prog_counter[base],
+                        load_words(&prog_counter[base]) + step, mask);
+        }
+        store_words(&opcode[base], splat_words(op), mask);
+        vector_steps += __builtin_popcount(group[b]);
+    }
+    return true;
+}
+
+void LockstepBatch::reset_lane(size_t lane, unsigned int seed) {
+    machines[lane]->reset_to_snapshot(*initial);
+    machines[lane]->seed(seed);
+    from_machine(lane);
+    // The lane's code is as loaded again, the others' may still not be
+    code_written = 0;
+    for (Chip8 *chip8 : machines)
+        code_written |= chip8->dirty_pages[0] & 0xFFFF;
+}
+
+Chip8 &LockstepBatch::get_machine(size_t lane) {
+    to_machine(lane);
+    return *machines[lane];
+}
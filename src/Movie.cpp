@@ -0,0 +1,145 @@
+#include "Movie.h"
+#include "Chip8.h"
+#include "Display.h"
+#include "Scheduler.h"
+#include <chrono>
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+void Movie::record_frame(uint16_t mask, Chip8 &chip8) {
+    keys.push_back(mask);
+    if (keys.size() % checkpoint_interval == 0)
+        checkpoints.push_back(chip8.gfx_hash());
+}
+
+bool Movie::save(const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (file == nullptr)
+        return false;
+    MovieHeader header = {};
+    memcpy(header.magic, MOVIE_MAGIC, 8);
+    header.version = MOVIE_VERSION;
+    header.seed = seed;
+    header.rom_hash = rom_hash;
+    header.instructions_per_second = instructions_per_second;
+    header.checkpoint_interval = checkpoint_interval;
+    header.frame_count = keys.size();
+    header.quirks = quirks;
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   fwrite(keys.data(), sizeof(uint16_t), keys.size(), file) ==
+                       keys.size() &&
+                   fwrite(checkpoints.data(), sizeof(uint64_t),
+                          checkpoints.size(), file) == checkpoints.size();
+    return fclose(file) == 0 && written;
+}
+
+bool Movie::load(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr)
+        return false;
+    MovieHeader header;
+    bool read = fread(&header, sizeof(header), 1, file) == 1 &&
+                memcmp(header.magic, MOVIE_MAGIC, 8) == 0 &&
+                header.version == MOVIE_VERSION &&
+                header.checkpoint_interval > 0 &&
+                header.quirks < QUIRK_PROFILE_COUNT;
+    // The frame count sizes everything after the header, so it has to
+    // match the file before anything is allocated for it
+    struct stat info;
+    read = read && fstat(fileno(file), &info) == 0 &&
+           (uint64_t)info.st_size ==
+               sizeof(header) + (uint64_t)header.frame_count * 2 +
+                   (uint64_t)(header.frame_count /
+                              header.checkpoint_interval) * 8;
+    if (read) {
+        seed = header.seed;
+        rom_hash = header.rom_hash;
+        instructions_per_second = header.instructions_per_second;
+        checkpoint_interval = header.checkpoint_interval;
+        quirks = (quirk_profile)header.quirks;
+        keys.resize(header.frame_count);
+        checkpoints.resize(header.frame_count / checkpoint_interval);
+        read = fread(keys.data(), sizeof(uint16_t), keys.size(), file) ==
+                   keys.size() &&
+               fread(checkpoints.data(), sizeof(uint64_t), checkpoints.size(),
+                     file) == checkpoints.size();
+    }
+    fclose(file);
+    return read;
+}
+
+int replay_movie(const char *movie_path, const char *rom_path,
+                 Display *display) {
+    Movie movie;
+    if (!movie.load(movie_path)) {
+        std::cerr << "ERROR: " << movie_path << " is not a readable movie\n";
+        return 1;
+    }
+
+    // Instances are large, keep this one off the stack
+    Chip8 *chip8 = new Chip8();
+    chip8->initialize();
+    if (!chip8->load_game(rom_path)) {
+        delete chip8;
+        return 1;
+    }
+    if (chip8->rom_hash() != movie.rom_hash) {
+        std::cerr << "ERROR: " << movie_path << " was recorded with a "
+                  << "different game than " << rom_path << "\n";
+        delete chip8;
+        return 1;
+    }
+    chip8->seed(movie.seed);
+    // Whatever profile the game was recorded with, not what the quirk table
+    // says now
+    chip8->set_quirks(movie.quirks);
+
+    // Only splits instructions into frames, nothing waits
+    SchedulerOptions timing;
+    timing.instructions_per_second = movie.instructions_per_second;
+    timing.presents_per_second = 0;
+    timing.unthrottled = true;
+    Scheduler scheduler(timing);
+
+    auto start = std::chrono::steady_clock::now();
+    size_t checked = 0;
+    long mismatch = -1;
+    for (size_t frame = 0; frame < movie.keys.size(); frame++) {
+        chip8->set_keys(movie.keys[frame]);
+        chip8->run(scheduler.instructions_for_tick());
+        chip8->update_timers();
+        if (display != nullptr) {
+            display->update_screen_with_buffer(chip8->get_gfx(),
+                                               chip8->get_dirty_rows());
+            chip8->clear_dirty_rows();
+            if (!display->is_running()) {
+                delete chip8;
+                return 1;
+            }
+        }
+        if ((frame + 1) % movie.checkpoint_interval == 0) {
+            if (chip8->gfx_hash() != movie.checkpoints[checked]) {
+                mismatch = frame;
+                break;
+            }
+            checked++;
+        }
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    delete chip8;
+
+    if (mismatch >= 0) {
+        printf("Replay: framebuffer differs at frame %ld (checkpoint %zu)\n",
+               mismatch, checked);
+        return 1;
+    }
+    double movie_seconds = movie.keys.size() / 60.0;
+    printf("Replay: %zu frames, %zu checkpoints matched in %.3fs (%.0fx real "
+           "time)\n",
+           movie.keys.size(), checked, elapsed.count(),
+           elapsed.count() > 0 ? movie_seconds / elapsed.count() : 0.0);
+    return 0;
+}
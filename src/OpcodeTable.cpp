@@ -0,0 +1,24 @@
+#include "OpcodeTable.h"
+
+constexpr OpcodeKindTable opcode_kinds = make_opcode_kind_table(false);
+constexpr OpcodeKindTable opcode_kinds_extended = make_opcode_kind_table(true);
+
+static_assert(opcode_kinds[0x00E0] == OP_00E0 &&
+                  opcode_kinds[0x00EE] == OP_00EE &&
+                  opcode_kinds[0x8AB4] == OP_8XY4 &&
+                  opcode_kinds[0x8AB8] == OP_UNKNOWN &&
+                  opcode_kinds[0xE1A1] == OP_EXA1 &&
+                  opcode_kinds[0xF265] == OP_FX65 &&
+                  opcode_kinds[0xF266] == OP_UNKNOWN,
+              "opcode_kinds doesn't match the instruction set");
+
+static_assert(opcode_kinds_extended[0x00C4] == OP_00CN &&
+                  opcode_kinds_extended[0x00E0] == OP_00E0 &&
+                  opcode_kinds_extended[0x00F0] == OP_UNKNOWN &&
+                  opcode_kinds_extended[0x00FE] == OP_00FE &&
+                  opcode_kinds_extended[0x5AB3] == OP_5XY3 &&
+                  opcode_kinds_extended[0x5AB1] == OP_UNKNOWN &&
+                  opcode_kinds_extended[0xF000] == OP_F000 &&
+                  opcode_kinds_extended[0xF201] == OP_FN01 &&
+                  opcode_kinds_extended[0xF265] == OP_FX65,
+              "opcode_kinds_extended doesn't match the instruction set");
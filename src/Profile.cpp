@@ -0,0 +1,87 @@
+#include "Profile.h"
+#include <string>
+
+const char *opcode_kind_name(unsigned char kind) {
+    static const char *const names[OP_KIND_COUNT] = {
+        "00E0", "00EE", "1NNN", "2NNN", "3XNN", "4XNN", "5XY0", "6XNN",
+        "7XNN", "8XY0", "8XY1", "8XY2", "8XY3", "8XY4", "8XY5", "8XY6",
+        "8XY7", "8XYE", "9XY0", "ANNN", "BNNN", "CXNN", "DXYN", "EX9E",
+        "EXA1", "FX07", "FX0A", "FX15", "FX18", "FX1E", "FX29", "FX33",
+        "FX55", "FX65", "00CN", "00FB", "00FC", "00FD", "00FE", "00FF",
+        "FX30", "FX75", "FX85", "00DN", "5XY2", "5XY3", "F000", "FN01",
+        "F002", "FX3A", "unknown"};
+    return kind < OP_KIND_COUNT ? names[kind] : "?";
+}
+
+void Profile::write_json(FILE *file) {
+    unsigned long long total = 0;
+    for (int i = 0; i < OP_KIND_COUNT; i++)
+        total += opcodes[i];
+
+    fprintf(file, "{\n  \"instructions\": %llu,\n  \"opcodes\": {", total);
+    const char *separator = "";
+    for (int i = 0; i < OP_KIND_COUNT; i++) {
+        if (opcodes[i] == 0)
+            continue;
+        fprintf(file, "%s\"%s\": %llu", separator, opcode_kind_name(i),
+                opcodes[i]);
+        separator = ", ";
+    }
+
+    fprintf(file, "},\n  \"depths\": [");
+    for (int i = 0; i < 17; i++)
+        fprintf(file, i == 0 ? "%llu" : ", %llu", depths[i]);
+    fprintf(file, "],\n  \"max_depth\": %u,\n", max_depth);
+
+    fprintf(file, "  \"subroutines\": [");
+    separator = "";
+    for (int address = 0; address < 4096; address++) {
+        if (calls[address] == 0 && subroutine_instructions[address] == 0)
+            continue;
+        fprintf(file,
+                "%s\n    {\"address\": %d, \"calls\": %llu, "
+                "\"instructions\": %llu}",
+                separator, address, calls[address],
+                subroutine_instructions[address]);
+        separator = ",";
+    }
+
+    fprintf(file, "\n  ],\n  \"sprites\": {\"count\": %llu, \"ns\": %llu},\n",
+            sprites, sprite_ns);
+
+    fprintf(file, "  \"pcs\": [");
+    separator = "";
+    for (int address = 0; address < 4096; address++) {
+        if (pcs[address] == 0)
+            continue;
+        fprintf(file, "%s[%d, %llu]", separator, address, pcs[address]);
+        separator = ", ";
+    }
+    fprintf(file, "]\n}\n");
+}
+
+void Profile::write_csv(FILE *file, const unsigned char *memory) {
+    fprintf(file, "address,opcode,executions\n");
+    for (int address = 0; address < 4096; address++) {
+        if (pcs[address] == 0)
+            continue;
+        fprintf(file, "0x%03X,%02X%02X,%llu\n", address, memory[address],
+                memory[(address + 1) & 0xFFF], pcs[address]);
+    }
+}
+
+bool Profile::write_files(const char *prefix, const unsigned char *memory) {
+    std::string path = prefix;
+    FILE *json = fopen((path + ".json").c_str(), "w");
+    FILE *csv = fopen((path + ".csv").c_str(), "w");
+    if (json != nullptr)
+        write_json(json);
+    if (csv != nullptr)
+        write_csv(csv, memory);
+    bool written = json != nullptr && csv != nullptr;
+    if (json != nullptr)
+        fclose(json);
+    if (csv != nullptr)
+        fclose(csv);
+    return written;
+}
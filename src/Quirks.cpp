@@ -0,0 +1,93 @@
+#include "Quirks.h"
+#include <algorithm>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *const profile_names[QUIRK_PROFILE_COUNT] = {
+    "default",
+    "chip8",
+    "superchip",
+    "xochip",
+};
+
+static const QuirkFlags profile_flags[QUIRK_PROFILE_COUNT] = {
+    quirk_flags_of<QuirksDefault>(),
+    quirk_flags_of<QuirksChip8>(),
+    quirk_flags_of<QuirksSuperChip>(),
+    quirk_flags_of<QuirksXoChip>(),
+};
+
+QuirkFlags quirk_flags(quirk_profile profile) {
+    return profile_flags[profile < QUIRK_PROFILE_COUNT ? profile
+                                                       : QUIRKS_DEFAULT];
+}
+
+const char *quirk_profile_name(quirk_profile profile) {
+    return profile < QUIRK_PROFILE_COUNT ? profile_names[profile] : "unknown";
+}
+
+bool parse_quirk_profile(const char *name, quirk_profile &profile) {
+    for (int i = 0; i < QUIRK_PROFILE_COUNT; i++) {
+        if (strcmp(name, profile_names[i]) == 0) {
+            profile = (quirk_profile)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool QuirkTable::load(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == nullptr)
+        return false;
+    char line[256];
+    int line_number = 0;
+    while (fgets(line, sizeof(line), file) != nullptr) {
+        line_number++;
+        char hash_text[32], name[32];
+        if (sscanf(line, " %31s", hash_text) != 1 || hash_text[0] == '#')
+            continue;
+        char *end = nullptr;
+        unsigned long long hash = strtoull(hash_text, &end, 16);
+        quirk_profile profile;
+        if (*end != '\0' || sscanf(line, "%*s %31s", name) != 1 ||
+            !parse_quirk_profile(name, profile)) {
+            std::cerr << "WARNING: " << path << ":" << line_number
+                      << ": expected a ROM hash and a quirk profile\n";
+            continue;
+        }
+        add(hash, profile);
+    }
+    fclose(file);
+    return true;
+}
+
+void QuirkTable::add(unsigned long long rom_hash, quirk_profile profile) {
+    auto at = std::lower_bound(
+        entries.begin(), entries.end(), rom_hash,
+        [](const std::pair<unsigned long long, quirk_profile> &entry,
+           unsigned long long hash) { return entry.first < hash; });
+    if (at != entries.end() && at->first == rom_hash)
+        at->second = profile;
+    else
+        entries.insert(at, {rom_hash, profile});
+}
+
+void QuirkTable::force(quirk_profile profile) {
+    forced = true;
+    forced_profile = profile;
+}
+
+quirk_profile QuirkTable::lookup(unsigned long long rom_hash) const {
+    if (forced)
+        return forced_profile;
+    auto at = std::lower_bound(
+        entries.begin(), entries.end(), rom_hash,
+        [](const std::pair<unsigned long long, quirk_profile> &entry,
+           unsigned long long hash) { return entry.first < hash; });
+    if (at != entries.end() && at->first == rom_hash)
+        return at->second;
+    return QUIRKS_DEFAULT;
+}
@@ -0,0 +1,204 @@
+#include "Rewind.h"
+#include <string.h>
+
+static void put_varint(std::vector<unsigned char> &out, size_t value) {
+    while (value >= 0x80) {
+        out.push_back((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    out.push_back(value);
+}
+
+static size_t get_varint(const unsigned char *&in) {
+    size_t value = 0;
+    int shift = 0;
+    while (*in & 0x80) {
+        value |= (size_t)(*in++ & 0x7F) << shift;
+        shift += 7;
+    }
+    value |= (size_t)*in++ << shift;
+    return value;
+}
+
+// Run-length encodes `data` XOR `base` (just `data` if `base` is nullptr).
+// A literal only ends at three zero bytes in a row, shorter gaps are cheaper
+// to copy than to start a new run for.
+static void encode(const unsigned char *data, const unsigned char *base,
+                   size_t size, std::vector<unsigned char> &out) {
+    out.clear();
+    size_t i = 0;
+    while (i < size) {
+        size_t zeros_start = i;
+        if (base != nullptr) {
+            // Unchanged stretches are long, skip them a word at a time
+            while (i + 8 <= size && memcmp(data + i, base + i, 8) == 0)
+                i += 8;
+            while (i < size && data[i] == base[i])
+                i++;
+        } else {
+            while (i < size && data[i] == 0)
+                i++;
+        }
+        size_t literal_start = i;
+        int zero_bytes = 0;
+        while (i < size && zero_bytes < 3) {
+            unsigned char byte = base != nullptr ? data[i] ^ base[i] : data[i];
+            zero_bytes = byte == 0 ? zero_bytes + 1 : 0;
+            i++;
+        }
+        if (zero_bytes == 3)
+            i -= 3;
+        else if (i == size)
+            i -= zero_bytes;
+
+        put_varint(out, literal_start - zeros_start);
+        put_varint(out, i - literal_start);
+        for (size_t j = literal_start; j < i; j++)
+            out.push_back(base != nullptr ? data[j] ^ base[j] : data[j]);
+        if (i - literal_start == 0)
+            break; // only zeros left
+    }
+}
+
+RewindBuffer::RewindBuffer(size_t capacity, unsigned int keyframe_interval)
+    : keyframe_interval(keyframe_interval > 0 ? keyframe_interval : 1) {
+    ring.resize(capacity);
+    keyframe = new SaveState;
+}
+
+size_t RewindBuffer::min_capacity(const SaveState &state) {
+    std::vector<unsigned char> encoded;
+    encode((const unsigned char *)&state, nullptr, sizeof(SaveState),
+           encoded);
+    // The newest keyframe stays while the next one is written
+    return 2 * encoded.size();
+}
+
+RewindBuffer::~RewindBuffer() { delete keyframe; }
+
+void RewindBuffer::clear() {
+    entries.clear();
+    write_offset = 0;
+    since_keyframe = 0;
+}
+
+size_t RewindBuffer::bytes_used() {
+    size_t used = 0;
+    for (const Entry &entry : entries)
+        used += entry.length;
+    return used;
+}
+
+size_t RewindBuffer::allocate(size_t length) {
+    size_t offset = write_offset;
+    if (offset + length > ring.size()) {
+        // Wrap around. Whatever is still stored past `write_offset` is the
+        // oldest history and goes first.
+        while (!entries.empty() && entries.front().offset >= write_offset)
+            entries.pop_front();
+        offset = 0;
+    }
+    while (!entries.empty()) {
+        const Entry &oldest = entries.front();
+        if (oldest.offset >= offset + length ||
+            oldest.offset + oldest.length <= offset)
+            break;
+        entries.pop_front();
+    }
+    drop_orphans();
+    write_offset = offset + length;
+    return offset;
+}
+
+void RewindBuffer::drop_orphans() {
+    while (!entries.empty() && !entries.front().keyframe)
+        entries.pop_front();
+    if (entries.empty())
+        since_keyframe = 0;
+}
+
+void RewindBuffer::push(const SaveState &state) {
+    const unsigned char *data = (const unsigned char *)&state;
+    bool is_keyframe =
+        since_keyframe == 0 || since_keyframe >= keyframe_interval;
+    encode(data, is_keyframe ? nullptr : (const unsigned char *)keyframe,
+           sizeof(SaveState), scratch);
+    if (scratch.size() > ring.size()) {
+        // Doesn't fit even on its own, keeping older snapshots would leave
+        // a gap in the history
+        clear();
+        return;
+    }
+    size_t offset = allocate(scratch.size());
+    if (!is_keyframe && since_keyframe == 0) {
+        // Making room dropped the keyframe this delta was based on
+        is_keyframe = true;
+        encode(data, nullptr, sizeof(SaveState), scratch);
+        if (scratch.size() > ring.size()) {
+            clear();
+            return;
+        }
+        offset = allocate(scratch.size());
+    }
+
+    memcpy(&ring[offset], scratch.data(), scratch.size());
+    entries.push_back({offset, scratch.size(), is_keyframe});
+    if (is_keyframe) {
+        memcpy(keyframe, &state, sizeof(SaveState));
+        since_keyframe = 1;
+    } else {
+        since_keyframe++;
+    }
+}
+
+void RewindBuffer::decode(const Entry &entry, SaveState &state) {
+    unsigned char *out = (unsigned char *)&state;
+    const unsigned char *in = &ring[entry.offset];
+    const unsigned char *end = in + entry.length;
+    size_t i = 0;
+    while (in < end) {
+        size_t zeros = get_varint(in);
+        size_t literals = get_varint(in);
+        if (entry.keyframe)
+            memset(out + i, 0, zeros);
+        i += zeros;
+        if (entry.keyframe) {
+            memcpy(out + i, in, literals);
+        } else {
+            for (size_t j = 0; j < literals; j++)
+                out[i + j] ^= in[j];
+        }
+        in += literals;
+        i += literals;
+    }
+    // Trailing zeros aren't stored
+    if (entry.keyframe)
+        memset(out + i, 0, sizeof(SaveState) - i);
+}
+
+bool RewindBuffer::pop(SaveState &state) {
+    if (entries.empty())
+        return false;
+    Entry newest = entries.back();
+    entries.pop_back();
+    write_offset =
+        entries.empty() ? 0 : entries.back().offset + entries.back().length;
+    if (!newest.keyframe) {
+        memcpy(&state, keyframe, sizeof(SaveState));
+        decode(newest, state);
+        since_keyframe--;
+        return true;
+    }
+
+    decode(newest, state);
+    // The deltas before this keyframe are based on the previous one
+    since_keyframe = 0;
+    for (size_t i = entries.size(); i-- > 0;) {
+        if (entries[i].keyframe) {
+            decode(entries[i], *keyframe);
+            since_keyframe = entries.size() - i;
+            break;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,126 @@
+#include "RomImage.h"
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+// Every live image. A handful of games at a time, a list is enough. Never
+// destroyed: instances with static storage (main.cpp's) release their image
+// after other statics are gone.
+static std::mutex &registry_lock = *new std::mutex;
+static std::vector<RomImage *> &registry = *new std::vector<RomImage *>;
+
+// FNV-1a, like Chip8::rom_hash()
+static unsigned long long hash_bytes(unsigned long long hash,
+                                     const unsigned char *bytes, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// An empty file that lives in memory only.
+static int make_memory_file() {
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+    int memory_fd = memfd_create("chip8-rom", MFD_CLOEXEC);
+    if (memory_fd >= 0)
+        return memory_fd;
+#endif
+    // Elsewhere an unlinked temporary file, which the page cache keeps
+    FILE *file = tmpfile();
+    if (file == nullptr)
+        return -1;
+    int fd = dup(fileno(file));
+    fclose(file);
+    return fd;
+}
+
+static bool write_at(int fd, const unsigned char *bytes, size_t size,
+                     off_t offset) {
+    while (size > 0) {
+        ssize_t written = pwrite(fd, bytes, size, offset);
+        if (written <= 0)
+            return false;
+        bytes += written;
+        size -= written;
+        offset += written;
+    }
+    return true;
+}
+
+RomImage::~RomImage() {
+    if (bytes != nullptr)
+        munmap((void *)bytes, size);
+    if (fd >= 0)
+        close(fd);
+}
+
+RomImage *RomImage::acquire(const unsigned char *base,
+                            const unsigned char *rom, size_t rom_size) {
+    if (rom_size > size - base_size)
+        rom_size = size - base_size;
+    unsigned long long hash = hash_bytes(0xcbf29ce484222325ULL, base,
+                                         base_size);
+    hash = hash_bytes(hash, rom, rom_size);
+
+    std::lock_guard<std::mutex> guard(registry_lock);
+    for (RomImage *image : registry) {
+        if (image->hash == hash && image->rom_size == rom_size &&
+            memcmp(image->bytes, base, base_size) == 0 &&
+            (rom_size == 0 ||
+             memcmp(image->bytes + base_size, rom, rom_size) == 0)) {
+            image->users++;
+            return image;
+        }
+    }
+
+    RomImage *image = new RomImage();
+    image->fd = make_memory_file();
+    if (image->fd < 0 || ftruncate(image->fd, size) != 0 ||
+        !write_at(image->fd, base, base_size, 0) ||
+        !write_at(image->fd, rom, rom_size, base_size)) {
+        delete image;
+        return nullptr;
+    }
+    void *view = mmap(nullptr, size, PROT_READ, MAP_SHARED, image->fd, 0);
+    if (view == MAP_FAILED) {
+        delete image;
+        return nullptr;
+    }
+    image->bytes = (const unsigned char *)view;
+    image->rom_size = rom_size;
+    image->hash = hash;
+    image->users = 1;
+    registry.push_back(image);
+    return image;
+}
+
+void RomImage::release(RomImage *image) {
+    if (image == nullptr)
+        return;
+    std::lock_guard<std::mutex> guard(registry_lock);
+    if (--image->users > 0)
+        return;
+    for (size_t i = 0; i < registry.size(); i++) {
+        if (registry[i] == image) {
+            registry[i] = registry.back();
+            registry.pop_back();
+            break;
+        }
+    }
+    delete image;
+}
+
+unsigned char *RomImage::map() {
+    void *memory =
+        mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    return memory != MAP_FAILED ? (unsigned char *)memory : nullptr;
+}
+
+void RomImage::unmap(unsigned char *memory) {
+    if (memory != nullptr)
+        munmap(memory, size);
+}
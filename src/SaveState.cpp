@@ -0,0 +1,75 @@
+#include "SaveState.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SAVE_STATE_MMAP 1
+#else
+#define SAVE_STATE_MMAP 0
+#endif
+
+uint64_t save_state_checksum(const SaveState &state) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    const unsigned char *bytes = (const unsigned char *)&state;
+    for (size_t i = sizeof(SaveStateHeader); i < sizeof(SaveState); i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+bool save_state_valid(const SaveState &state) {
+    const SaveStateHeader &header = state.header;
+    return memcmp(header.magic, SAVE_STATE_MAGIC, 8) == 0 &&
+           header.version == SAVE_STATE_VERSION &&
+           header.byte_order == SAVE_STATE_BYTE_ORDER &&
+           header.size == sizeof(SaveState) &&
+           header.checksum == save_state_checksum(state);
+}
+
+bool write_save_state(const char *path, const SaveState &state) {
+    FILE *file = fopen(path, "wb");
+    if (file == nullptr)
+        return false;
+    bool written = fwrite(&state, sizeof(state), 1, file) == 1;
+    return fclose(file) == 0 && written;
+}
+
+MappedSaveState::MappedSaveState(const char *path) {
+#if SAVE_STATE_MMAP
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return;
+    struct stat info;
+    void *mapping = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && info.st_size == sizeof(SaveState))
+        mapping = mmap(nullptr, sizeof(SaveState), PROT_READ, MAP_PRIVATE, fd,
+                       0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return;
+    state = (const SaveState *)mapping;
+#else
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr)
+        return;
+    copy = new SaveState;
+    bool read = fread(copy, sizeof(SaveState), 1, file) == 1;
+    fclose(file);
+    if (read)
+        state = copy;
+#endif
+}
+
+MappedSaveState::~MappedSaveState() {
+#if SAVE_STATE_MMAP
+    if (state != nullptr)
+        munmap((void *)state, sizeof(SaveState));
+#endif
+    delete copy;
+}
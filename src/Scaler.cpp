@@ -0,0 +1,272 @@
+#include "Scaler.h"
+#include <iostream>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+const char *scale_filter_name(scale_filter filter) {
+    static const char *const names[] = {"sdl", "nearest", "scale2x",
+                                        "scale3x"};
+    return filter <= FILTER_SCALE3X ? names[filter] : "?";
+}
+
+bool parse_scale_filter(const char *name, scale_filter &filter) {
+    for (int i = FILTER_SDL; i <= FILTER_SCALE3X; i++) {
+        if (strcmp(name, scale_filter_name((scale_filter)i)) == 0) {
+            filter = (scale_filter)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Colors are picked without branches or lookups: with m0 and m1 the masks of
+// the pixels set in plane 0 and plane 1,
+//   color = p0 ^ (m0 & (p0 ^ p1)) ^ (m1 & (p0 ^ p2)) ^ (m0 & m1 & (p0 ^ p1 ^
+//           p2 ^ p3))
+// which comes out as p0, p1, p2 or p3.
+void expand_pixels(const uint64_t *plane0, const uint64_t *plane1, int count,
+                   const uint32_t palette[4], uint32_t *out) {
+    uint32_t d1 = palette[0] ^ palette[1];
+    uint32_t d2 = palette[0] ^ palette[2];
+    uint32_t d3 = palette[0] ^ palette[1] ^ palette[2] ^ palette[3];
+#if defined(__AVX2__)
+    // Eight pixels per byte of each plane, one per lane
+    const __m256i bits = _mm256_setr_epi32(0x80, 0x40, 0x20, 0x10, 0x08, 0x04,
+                                           0x02, 0x01);
+    const __m256i p0 = _mm256_set1_epi32(palette[0]);
+    const __m256i v1 = _mm256_set1_epi32(d1);
+    const __m256i v2 = _mm256_set1_epi32(d2);
+    const __m256i v3 = _mm256_set1_epi32(d3);
+#elif defined(__SSE2__)
+    // Four pixels per half byte
+    const __m128i high = _mm_setr_epi32(0x80, 0x40, 0x20, 0x10);
+    const __m128i low = _mm_setr_epi32(0x08, 0x04, 0x02, 0x01);
+    const __m128i p0 = _mm_set1_epi32(palette[0]);
+    const __m128i v1 = _mm_set1_epi32(d1);
+    const __m128i v2 = _mm_set1_epi32(d2);
+    const __m128i v3 = _mm_set1_epi32(d3);
+#endif
+    for (int x = 0; x < count; x += 8) {
+        int shift = 56 - (x & 63);
+        int b0 = (plane0[x >> 6] >> shift) & 0xFF;
+        int b1 = (plane1[x >> 6] >> shift) & 0xFF;
+#if defined(__AVX2__)
+        __m256i m0 = _mm256_set1_epi32(b0), m1 = _mm256_set1_epi32(b1);
+        m0 = _mm256_cmpeq_epi32(_mm256_and_si256(m0, bits), bits);
+        m1 = _mm256_cmpeq_epi32(_mm256_and_si256(m1, bits), bits);
+        __m256i color = _mm256_xor_si256(p0, _mm256_and_si256(m0, v1));
+        color = _mm256_xor_si256(color, _mm256_and_si256(m1, v2));
+        color = _mm256_xor_si256(
+            color, _mm256_and_si256(_mm256_and_si256(m0, m1), v3));
+        _mm256_storeu_si256((__m256i *)(out + x), color);
+#elif defined(__SSE2__)
+        __m128i s0 = _mm_set1_epi32(b0), s1 = _mm_set1_epi32(b1);
+        for (int half = 0; half < 2; half++) {
+            const __m128i mask = half == 0 ? high : low;
+            __m128i m0 = _mm_cmpeq_epi32(_mm_and_si128(s0, mask), mask);
+            __m128i m1 = _mm_cmpeq_epi32(_mm_and_si128(s1, mask), mask);
+            __m128i color = _mm_xor_si128(p0, _mm_and_si128(m0, v1));
+            color = _mm_xor_si128(color, _mm_and_si128(m1, v2));
+            color = _mm_xor_si128(color,
+                                  _mm_and_si128(_mm_and_si128(m0, m1), v3));
+            _mm_storeu_si128((__m128i *)(out + x + 4 * half), color);
+        }
+#else
+        for (int i = 0; i < 8; i++) {
+            uint32_t m0 = 0u - ((b0 >> (7 - i)) & 1);
+            uint32_t m1 = 0u - ((b1 >> (7 - i)) & 1);
+            out[x + i] = palette[0] ^ (m0 & d1) ^ (m1 & d2) ^ (m0 & m1 & d3);
+        }
+#endif
+    }
+}
+
+void scale_row_nearest(const uint32_t *row, int count, int factor,
+                       uint32_t *out) {
+    for (int x = 0; x < count; x++) {
+        uint32_t color = row[x];
+        int i = 0;
+#if defined(__SSE2__)
+        __m128i block = _mm_set1_epi32(color);
+        for (; i + 4 <= factor; i += 4)
+            _mm_storeu_si128((__m128i *)(out + i), block);
+#endif
+        for (; i < factor; i++)
+            out[i] = color;
+        out += factor;
+    }
+}
+
+// Scale2x, with E the pixel, B/H above/below and D/F left/right:
+//   if B != H and D != F:
+//     E0 = D == B ? D : E    E1 = B == F ? F : E
+//     E2 = D == H ? D : E    E3 = H == F ? F : E
+//   else all four are E.
+void scale2x_row(const uint32_t *above, const uint32_t *row,
+                 const uint32_t *below, int count, uint32_t *out0,
+                 uint32_t *out1) {
+    int x = 0;
+#if defined(__SSE2__)
+    for (; x + 4 <= count; x += 4) {
+        __m128i b = _mm_loadu_si128((const __m128i *)(above + x));
+        __m128i h = _mm_loadu_si128((const __m128i *)(below + x));
+        __m128i d = _mm_loadu_si128((const __m128i *)(row + x - 1));
+        __m128i e = _mm_loadu_si128((const __m128i *)(row + x));
+        __m128i f = _mm_loadu_si128((const __m128i *)(row + x + 1));
+        // Lanes where B != H and D != F
+        __m128i edge = _mm_andnot_si128(
+            _mm_or_si128(_mm_cmpeq_epi32(b, h), _mm_cmpeq_epi32(d, f)),
+            _mm_set1_epi32(-1));
+        __m128i take_d0 = _mm_and_si128(edge, _mm_cmpeq_epi32(d, b));
+        __m128i take_f1 = _mm_and_si128(edge, _mm_cmpeq_epi32(b, f));
+        __m128i take_d2 = _mm_and_si128(edge, _mm_cmpeq_epi32(d, h));
+        __m128i take_f3 = _mm_and_si128(edge, _mm_cmpeq_epi32(h, f));
+        __m128i e0 = _mm_or_si128(_mm_and_si128(take_d0, d),
+                                  _mm_andnot_si128(take_d0, e));
+        __m128i e1 = _mm_or_si128(_mm_and_si128(take_f1, f),
+                                  _mm_andnot_si128(take_f1, e));
+        __m128i e2 = _mm_or_si128(_mm_and_si128(take_d2, d),
+                                  _mm_andnot_si128(take_d2, e));
+        __m128i e3 = _mm_or_si128(_mm_and_si128(take_f3, f),
+                                  _mm_andnot_si128(take_f3, e));
+        // Interleave the left and right halves of each output pixel
+        _mm_storeu_si128((__m128i *)(out0 + 2 * x), _mm_unpacklo_epi32(e0, e1));
+        _mm_storeu_si128((__m128i *)(out0 + 2 * x + 4),
+                         _mm_unpackhi_epi32(e0, e1));
+        _mm_storeu_si128((__m128i *)(out1 + 2 * x), _mm_unpacklo_epi32(e2, e3));
+        _mm_storeu_si128((__m128i *)(out1 + 2 * x + 4),
+                         _mm_unpackhi_epi32(e2, e3));
+    }
+#endif
+    for (; x < count; x++) {
+        uint32_t b = above[x], h = below[x];
+        uint32_t d = row[x - 1], e = row[x], f = row[x + 1];
+        bool edge = b != h && d != f;
+        out0[2 * x] = edge && d == b ? d : e;
+        out0[2 * x + 1] = edge && b == f ? f : e;
+        out1[2 * x] = edge && d == h ? d : e;
+        out1[2 * x + 1] = edge && h == f ? f : e;
+    }
+}
+
+// Scale3x, with the 3x3 neighbourhood
+//   A B C
+//   D E F
+//   G H I
+void scale3x_row(const uint32_t *above, const uint32_t *row,
+                 const uint32_t *below, int count, uint32_t *out0,
+                 uint32_t *out1, uint32_t *out2) {
+    for (int x = 0; x < count; x++) {
+        uint32_t a = above[x - 1], b = above[x], c = above[x + 1];
+        uint32_t d = row[x - 1], e = row[x], f = row[x + 1];
+        uint32_t g = below[x - 1], h = below[x], i = below[x + 1];
+        uint32_t *o0 = out0 + 3 * x, *o1 = out1 + 3 * x, *o2 = out2 + 3 * x;
+        if (b != h && d != f) {
+            o0[0] = d == b ? d : e;
+            o0[1] = (d == b && e != c) || (b == f && e != a) ? b : e;
+            o0[2] = b == f ? f : e;
+            o1[0] = (d == b && e != g) || (d == h && e != a) ? d : e;
+            o1[1] = e;
+            o1[2] = (b == f && e != i) || (h == f && e != c) ? f : e;
+            o2[0] = d == h ? d : e;
+            o2[1] = (d == h && e != i) || (h == f && e != g) ? h : e;
+            o2[2] = h == f ? f : e;
+        } else {
+            o0[0] = o0[1] = o0[2] = e;
+            o1[0] = o1[1] = o1[2] = e;
+            o2[0] = o2[1] = o2[2] = e;
+        }
+    }
+}
+
+FrameScaler::FrameScaler(scale_filter filter, int output_width,
+                         const uint32_t palette[4])
+    : filter(filter), output_width(output_width) {
+    memcpy(this->palette, palette, sizeof(this->palette));
+    expanded = new uint32_t[64 * expanded_stride];
+    smoothed = new uint32_t[3 * 128 * 3];
+    line = new uint32_t[output_width];
+    //* Scale2x/3x run on the framebuffer's own pixels, so they need the
+    //* factor between those and the output to be a multiple of 2 (3), or
+    //* fall back to plain nearest. Low resolution pixels are twice as big,
+    //* which is always enough for Scale2x.
+    int scale = output_width / 128;
+    if (filter == FILTER_SCALE2X && scale % 2 != 0)
+        std::cerr << "WARNING: scale2x needs an even scale, high resolution "
+                     "frames are scaled without it\n";
+    else if (filter == FILTER_SCALE3X && scale % 3 != 0)
+        std::cerr << "WARNING: scale3x needs a scale that is a multiple of 3, "
+                     "frames are scaled without it\n";
+}
+
+FrameScaler::~FrameScaler() {
+    delete[] expanded;
+    delete[] smoothed;
+    delete[] line;
+}
+
+uint64_t FrameScaler::update(const Framebuffer &gfx, uint64_t dirty_rows) {
+    rows = gfx.height();
+    columns = gfx.width();
+    uint64_t all_rows = rows == 64 ? ~(uint64_t)0 : ((uint64_t)1 << rows) - 1;
+    factor = output_width / columns;
+    smooth = 1;
+    if (filter == FILTER_SCALE2X && factor % 2 == 0)
+        smooth = 2;
+    else if (filter == FILTER_SCALE3X && factor % 3 == 0)
+        smooth = 3;
+
+    if (!expanded_valid || expanded_hires != gfx.hires) {
+        dirty_rows = all_rows;
+        expanded_valid = true;
+        expanded_hires = gfx.hires;
+    }
+    dirty_rows &= all_rows;
+    for (int y = 0; y < rows; y++) {
+        if (((dirty_rows >> y) & 1) == 0)
+            continue;
+        uint32_t *row = expanded + y * expanded_stride + 1;
+        expand_pixels(gfx.planes[0][y], gfx.planes[1][y], columns, palette,
+                      row);
+        row[-1] = row[0];
+        row[columns] = row[columns - 1];
+    }
+    // A smoothed row also changes when the row above or below it does
+    if (smooth > 1)
+        dirty_rows = (dirty_rows | dirty_rows << 1 | dirty_rows >> 1) &
+                     all_rows;
+    return dirty_rows;
+}
+
+void FrameScaler::scale_row(int y, uint8_t *out, int pitch) {
+    size_t line_bytes = output_width * sizeof(uint32_t);
+    const uint32_t *row = expanded + y * expanded_stride + 1;
+    if (smooth == 1) {
+        scale_row_nearest(row, columns, factor, line);
+        for (int i = 0; i < factor; i++)
+            memcpy(out + i * pitch, line, line_bytes);
+        return;
+    }
+    const uint32_t *above = y > 0 ? row - expanded_stride : row;
+    const uint32_t *below = y + 1 < rows ? row + expanded_stride : row;
+    int smoothed_width = columns * smooth;
+    if (smooth == 2)
+        scale2x_row(above, row, below, columns, smoothed,
+                    smoothed + smoothed_width);
+    else
+        scale3x_row(above, row, below, columns, smoothed,
+                    smoothed + smoothed_width, smoothed + 2 * smoothed_width);
+    int rest = factor / smooth;
+    for (int s = 0; s < smooth; s++) {
+        scale_row_nearest(smoothed + s * smoothed_width, smoothed_width, rest,
+                          line);
+        for (int i = 0; i < rest; i++)
+            memcpy(out + (s * rest + i) * pitch, line, line_bytes);
+    }
+}
@@ -0,0 +1,81 @@
+#include "Scheduler.h"
+#include <algorithm>
+#include <thread>
+
+Scheduler::Scheduler(const SchedulerOptions &options) : options(options) {
+    tick_start = clock::now();
+    present_start = tick_start;
+}
+
+Scheduler::clock::time_point Scheduler::tick_deadline() {
+    return tick_start + std::chrono::duration_cast<clock::duration>(
+                            std::chrono::nanoseconds(ticks * 1000000000ULL /
+                                                     timer_hz));
+}
+
+Scheduler::clock::time_point Scheduler::present_deadline() {
+    return present_start +
+           std::chrono::duration_cast<clock::duration>(std::chrono::nanoseconds(
+               presents * 1000000000ULL / options.presents_per_second));
+}
+
+void Scheduler::wait() {
+    if (options.unthrottled)
+        return;
+    clock::time_point deadline;
+    if (options.emulate && options.presents_per_second > 0)
+        deadline = std::min(tick_deadline(), present_deadline());
+    else if (options.emulate)
+        deadline = tick_deadline();
+    else if (options.presents_per_second > 0)
+        deadline = present_deadline();
+    else
+        return;
+    // sleep_until returns straight away for deadlines in the past
+    std::this_thread::sleep_until(deadline);
+}
+
+int Scheduler::due_ticks() {
+    if (!options.emulate)
+        return 0;
+    if (options.unthrottled) {
+        ticks++;
+        return 1;
+    }
+
+    clock::time_point now = clock::now();
+    int due = 0;
+    while (due < max_catch_up_ticks && tick_deadline() <= now) {
+        ticks++;
+        due++;
+    }
+    if (tick_deadline() <= now) {
+        // Too far behind to catch up, continue from here.
+        tick_start = now;
+        ticks = 1;
+    }
+    return due;
+}
+
+unsigned int Scheduler::instructions_for_tick() {
+    unsigned int total = options.instructions_per_second + instruction_remainder;
+    instruction_remainder = total % timer_hz;
+    return total / timer_hz;
+}
+
+bool Scheduler::present_due() {
+    if (options.presents_per_second == 0)
+        return false;
+
+    clock::time_point now = clock::now();
+    if (present_deadline() > now)
+        return false;
+    presents++;
+    if (present_deadline() <= now) {
+        // Missed one or more presents, schedule the next one a full period
+        // from now rather than presenting several times in a row.
+        present_start = now;
+        presents = 1;
+    }
+    return true;
+}
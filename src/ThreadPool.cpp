@@ -0,0 +1,61 @@
+#include "ThreadPool.h"
+#include <thread>
+
+WorkStealingPool::WorkStealingPool(unsigned int threads) {
+    if (threads == 0)
+        threads = std::thread::hardware_concurrency();
+    thread_count = threads > 0 ? threads : 1;
+}
+
+bool WorkStealingPool::next_task(std::vector<Worker> &workers,
+                                 unsigned int self, size_t &task) {
+    {
+        std::lock_guard<std::mutex> guard(workers[self].lock);
+        if (!workers[self].tasks.empty()) {
+            task = workers[self].tasks.back();
+            workers[self].tasks.pop_back();
+            return true;
+        }
+    }
+    // Nothing left locally, try everybody else starting with our neighbour.
+    for (unsigned int i = 1; i < workers.size(); i++) {
+        Worker &victim = workers[(self + i) % workers.size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.tasks.empty()) {
+            task = victim.tasks.front();
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    // Tasks are never added while running, so empty queues stay empty.
+    return false;
+}
+
+void WorkStealingPool::run(size_t count,
+                           const std::function<void(size_t)> &task) {
+    unsigned int threads = thread_count;
+    if (count < threads)
+        threads = count > 0 ? count : 1;
+
+    std::vector<Worker> workers(threads);
+    for (unsigned int w = 0; w < threads; w++) {
+        size_t begin = count * w / threads;
+        size_t end = count * (w + 1) / threads;
+        // Owners pop from the back, so push in reverse to run in order.
+        for (size_t i = end; i > begin; i--)
+            workers[w].tasks.push_back(i - 1);
+    }
+
+    auto work = [&](unsigned int self) {
+        size_t index;
+        while (next_task(workers, self, index))
+            task(index);
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned int w = 1; w < threads; w++)
+        pool.emplace_back(work, w);
+    work(0);
+    for (std::thread &thread : pool)
+        thread.join();
+}
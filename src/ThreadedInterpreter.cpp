@@ -0,0 +1,315 @@
+// =====================================================================================
+// Threaded interpreter.
+//
+// A second interpreter core for running many instructions back to back. The
+// opcode is looked up in the compile-time opcode kind table and every
+// instruction body ends by fetching and dispatching the next one itself
+// (computed goto with GCC and Clang), so each instruction gets its own
+// indirect branch and the predictor can learn which instruction tends to
+// follow which. Other compilers get the same bodies behind a switch.
+//
+// Simple instructions are executed inline. Anything with side effects beyond
+// the registers goes through the same handlers as `emulate_cycle()`, so the
+// two cores can't drift apart; the SUPER-CHIP and XO-CHIP instructions only
+// go through the handler table. The whole loop is instantiated once per quirk
+// profile (see Quirks.h) and `run_threaded()` picks one per call.
+// =====================================================================================
+#include "Chip8.h"
+#include "OpcodeTable.h"
+#include "Trace.h"
+
+#if defined(__GNUC__)
+#define THREADED_DISPATCH 1
+// Labels as values are a GNU extension
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#else
+#define THREADED_DISPATCH 0
+#endif
+
+// Operands for the handlers shared with `emulate_cycle()`.
+static inline void decode_operands(unsigned short op, Instruction &ins) {
+    ins.opcode = op;
+    ins.nnn = op & 0x0FFF;
+    ins.nn = op & 0x00FF;
+    ins.n = op & 0x000F;
+    ins.x = (op & 0x0F00) >> 8;
+    ins.y = (op & 0x00F0) >> 4;
+}
+
+unsigned long Chip8::run_threaded(unsigned long count) {
+    switch (quirks) {
+    case QUIRKS_CHIP8:
+        return run_threaded_with<QuirksChip8>(count);
+    case QUIRKS_SUPERCHIP:
+        return run_threaded_with<QuirksSuperChip>(count);
+    case QUIRKS_XOCHIP:
+        return run_threaded_with<QuirksXoChip>(count);
+    default:
+        return run_threaded_with<QuirksDefault>(count);
+    }
+}
+
+template <class Quirks>
+unsigned long Chip8::run_threaded_with(unsigned long count) {
+    if (halted != HALT_NONE) {
+        idle_cycles += count;
+        return count;
+    }
+
+    unsigned long left = count;
+    unsigned short op = 0;
+    Instruction ins;
+    const OpcodeKindTable &kinds =
+        Quirks::super_chip ? opcode_kinds_extended : opcode_kinds;
+
+#define FETCH()                                                                \
+    do {                                                                       \
+        if (left == 0)                                                         \
+            return count;                                                      \
+        left--;                                                                \
+        op = memory[prog_counter & 0xFFF] << 8 |                               \
+             memory[(prog_counter + 1) & 0xFFF];                               \
+        opcode = op;                                                           \
+        CHIP8_TRACE(TRACE_LEVEL_OPCODES, trace_ring, TRACE_OPCODE,             \
+                    prog_counter, op, index_register, stack_current_size);     \
+    } while (0)
+
+#define X ((op & 0x0F00) >> 8)
+#define Y ((op & 0x00F0) >> 4)
+#define NN (op & 0x00FF)
+#define NNN (op & 0x0FFF)
+
+// Runs the shared handler for the current opcode
+#define CALL_HANDLER(handler)                                                  \
+    do {                                                                       \
+        decode_operands(op, ins);                                              \
+        handler(ins);                                                          \
+    } while (0)
+
+// Same fast-forward as `run()` once an instruction halted the CPU
+#define STOP_IF_HALTED()                                                       \
+    do {                                                                       \
+        if (halted != HALT_NONE) {                                             \
+            idle_cycles += left;                                               \
+            return count;                                                      \
+        }                                                                      \
+    } while (0)
+
+#if THREADED_DISPATCH
+    static void *const targets[OP_KIND_COUNT] = {
+        &&do_00E0, &&do_00EE, &&do_1NNN, &&do_2NNN, &&do_3XNN, &&do_4XNN,
+        &&do_5XY0, &&do_6XNN, &&do_7XNN, &&do_8XY0, &&do_8XY1, &&do_8XY2,
+        &&do_8XY3, &&do_8XY4, &&do_8XY5, &&do_8XY6, &&do_8XY7, &&do_8XYE,
+        &&do_9XY0, &&do_ANNN, &&do_BNNN, &&do_CXNN, &&do_DXYN, &&do_EX9E,
+        &&do_EXA1, &&do_FX07, &&do_FX0A, &&do_FX15, &&do_FX18, &&do_FX1E,
+        &&do_FX29, &&do_FX33, &&do_FX55, &&do_FX65,
+        // SUPER-CHIP
+        &&do_extended, &&do_extended, &&do_extended, &&do_extended,
+        &&do_extended, &&do_extended, &&do_extended, &&do_extended,
+        &&do_extended,
+        // XO-CHIP
+        &&do_extended, &&do_extended, &&do_extended, &&do_extended,
+        &&do_extended, &&do_extended, &&do_extended, &&do_unknown};
+#define DISPATCH()                                                             \
+    do {                                                                       \
+        FETCH();                                                               \
+        goto *targets[kinds[op]];                                              \
+    } while (0)
+#else
+#define DISPATCH() goto dispatch
+#endif
+
+    DISPATCH();
+
+#if !THREADED_DISPATCH
+dispatch:
+    FETCH();
+    switch (kinds[op]) {
+    case OP_00E0: goto do_00E0;
+    case OP_00EE: goto do_00EE;
+    case OP_1NNN: goto do_1NNN;
+    case OP_2NNN: goto do_2NNN;
+    case OP_3XNN: goto do_3XNN;
+    case OP_4XNN: goto do_4XNN;
+    case OP_5XY0: goto do_5XY0;
+    case OP_6XNN: goto do_6XNN;
+    case OP_7XNN: goto do_7XNN;
+    case OP_8XY0: goto do_8XY0;
+    case OP_8XY1: goto do_8XY1;
+    case OP_8XY2: goto do_8XY2;
+    case OP_8XY3: goto do_8XY3;
+    case OP_8XY4: goto do_8XY4;
+    case OP_8XY5: goto do_8XY5;
+    case OP_8XY6: goto do_8XY6;
+    case OP_8XY7: goto do_8XY7;
+    case OP_8XYE: goto do_8XYE;
+    case OP_9XY0: goto do_9XY0;
+    case OP_ANNN: goto do_ANNN;
+    case OP_BNNN: goto do_BNNN;
+    case OP_CXNN: goto do_CXNN;
+    case OP_DXYN: goto do_DXYN;
+    case OP_EX9E: goto do_EX9E;
+    case OP_EXA1: goto do_EXA1;
+    case OP_FX07: goto do_FX07;
+    case OP_FX0A: goto do_FX0A;
+    case OP_FX15: goto do_FX15;
+    case OP_FX18: goto do_FX18;
+    case OP_FX1E: goto do_FX1E;
+    case OP_FX29: goto do_FX29;
+    case OP_FX33: goto do_FX33;
+    case OP_FX55: goto do_FX55;
+    case OP_FX65: goto do_FX65;
+    case OP_UNKNOWN: goto do_unknown;
+    default: goto do_extended;
+    }
+#endif
+
+do_00E0:
+    CALL_HANDLER(op_00E0);
+    DISPATCH();
+do_00EE:
+    CALL_HANDLER(op_00EE);
+    STOP_IF_HALTED();
+    DISPATCH();
+do_1NNN:
+    CALL_HANDLER(op_1NNN);
+    STOP_IF_HALTED();
+    DISPATCH();
+do_2NNN:
+    CALL_HANDLER(op_2NNN);
+    STOP_IF_HALTED();
+    DISPATCH();
+do_3XNN:
+    prog_counter += V[X] == NN ? skip_distance<Quirks>() : 2;
+    DISPATCH();
+do_4XNN:
+    prog_counter += V[X] != NN ? skip_distance<Quirks>() : 2;
+    DISPATCH();
+do_5XY0:
+    prog_counter += V[X] == V[Y] ? skip_distance<Quirks>() : 2;
+    DISPATCH();
+do_6XNN:
+    V[X] = NN;
+    prog_counter += 2;
+    DISPATCH();
+do_7XNN:
+    V[X] += NN;
+    prog_counter += 2;
+    DISPATCH();
+do_8XY0:
+    V[X] = V[Y];
+    prog_counter += 2;
+    DISPATCH();
+do_8XY1:
+    V[X] |= V[Y];
+    if (Quirks::vf_reset)
+        V[0xF] = 0;
+    prog_counter += 2;
+    DISPATCH();
+do_8XY2:
+    V[X] &= V[Y];
+    if (Quirks::vf_reset)
+        V[0xF] = 0;
+    prog_counter += 2;
+    DISPATCH();
+do_8XY3:
+    V[X] ^= V[Y];
+    if (Quirks::vf_reset)
+        V[0xF] = 0;
+    prog_counter += 2;
+    DISPATCH();
+do_8XY4:
+    CALL_HANDLER(op_8XY4);
+    DISPATCH();
+do_8XY5:
+    CALL_HANDLER(op_8XY5);
+    DISPATCH();
+do_8XY6:
+    CALL_HANDLER(op_8XY6<Quirks>);
+    DISPATCH();
+do_8XY7:
+    CALL_HANDLER(op_8XY7);
+    DISPATCH();
+do_8XYE:
+    CALL_HANDLER(op_8XYE<Quirks>);
+    DISPATCH();
+do_9XY0:
+    prog_counter += V[X] != V[Y] ? skip_distance<Quirks>() : 2;
+    DISPATCH();
+do_ANNN:
+    index_register = NNN;
+    prog_counter += 2;
+    DISPATCH();
+do_BNNN:
+    CALL_HANDLER(op_BNNN<Quirks>);
+    DISPATCH();
+do_CXNN:
+    CALL_HANDLER(op_CXNN);
+    DISPATCH();
+do_DXYN:
+    CALL_HANDLER(op_DXYN<Quirks>);
+    DISPATCH();
+do_EX9E:
+    prog_counter +=
+        (keys >> (V[X] & 0xF)) & 1 ? skip_distance<Quirks>() : 2;
+    DISPATCH();
+do_EXA1:
+    prog_counter +=
+        (keys >> (V[X] & 0xF)) & 1 ? 2 : skip_distance<Quirks>();
+    DISPATCH();
+do_FX07:
+    V[X] = delay_timer;
+    prog_counter += 2;
+    DISPATCH();
+do_FX0A:
+    CALL_HANDLER(op_FX0A);
+    STOP_IF_HALTED();
+    DISPATCH();
+do_FX15:
+    delay_timer = V[X];
+    prog_counter += 2;
+    DISPATCH();
+do_FX18:
+    sound_timer = V[X];
+    prog_counter += 2;
+    DISPATCH();
+do_FX1E:
+    index_register += V[X];
+    prog_counter += 2;
+    DISPATCH();
+do_FX29:
+    index_register = V[X];
+    prog_counter += 2;
+    DISPATCH();
+do_FX33:
+    CALL_HANDLER(op_FX33);
+    DISPATCH();
+do_FX55:
+    CALL_HANDLER(op_FX55<Quirks>);
+    DISPATCH();
+do_FX65:
+    CALL_HANDLER(op_FX65<Quirks>);
+    DISPATCH();
+do_unknown:
+    CALL_HANDLER(op_unknown);
+    DISPATCH();
+do_extended:
+    // 00FD halts
+    CALL_HANDLER((this->*handlers[kinds[op]]));
+    STOP_IF_HALTED();
+    DISPATCH();
+
+#undef FETCH
+#undef X
+#undef Y
+#undef NN
+#undef NNN
+#undef CALL_HANDLER
+#undef STOP_IF_HALTED
+#undef DISPATCH
+}
+
+#if THREADED_DISPATCH
+#pragma GCC diagnostic pop
+#endif
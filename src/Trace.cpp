@@ -0,0 +1,69 @@
+#include "Trace.h"
+#include <algorithm>
+#include <chrono>
+
+uint32_t TraceRing::drain(FILE *file) {
+    uint32_t t = tail.load(std::memory_order_relaxed);
+    uint32_t h = head.load(std::memory_order_acquire);
+    uint32_t count = h - t;
+    uint64_t lost = dropped.load(std::memory_order_relaxed);
+    if (count == 0)
+        return 0;
+
+    fwrite(&instance, sizeof(instance), 1, file);
+    fwrite(&count, sizeof(count), 1, file);
+    fwrite(&lost, sizeof(lost), 1, file);
+    // The unread records may wrap around the end of the array
+    uint32_t first = t & (capacity - 1);
+    uint32_t until_end = std::min(count, capacity - first);
+    fwrite(&records[first], sizeof(TraceRecord), until_end, file);
+    fwrite(&records[0], sizeof(TraceRecord), count - until_end, file);
+
+    tail.store(h, std::memory_order_release);
+    return count;
+}
+
+TraceWriter::TraceWriter(const char *path) {
+    file = fopen(path, "wb");
+    if (file == nullptr)
+        return;
+    fwrite(TRACE_FILE_MAGIC, 1, 8, file);
+    thread = std::thread(&TraceWriter::drain_loop, this);
+}
+
+TraceWriter::~TraceWriter() {
+    if (file == nullptr)
+        return;
+    stopping.store(true);
+    thread.join();
+    for (TraceRing *ring : rings)
+        ring->drain(file);
+    fclose(file);
+}
+
+void TraceWriter::attach(TraceRing *ring) {
+    std::lock_guard<std::mutex> guard(lock);
+    rings.push_back(ring);
+}
+
+void TraceWriter::detach(TraceRing *ring) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (file != nullptr)
+        ring->drain(file);
+    rings.erase(std::remove(rings.begin(), rings.end(), ring), rings.end());
+}
+
+void TraceWriter::drain_loop() {
+    while (!stopping.load()) {
+        uint32_t written = 0;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            for (TraceRing *ring : rings)
+                written += ring->drain(file);
+        }
+        // Rings hold 64K records, at full speed that's a few milliseconds of
+        // opcode tracing. Poll quickly while there's traffic, back off when
+        // idle.
+        std::this_thread::sleep_for(std::chrono::milliseconds(written ? 1 : 10));
+    }
+}
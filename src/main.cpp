@@ -1,44 +1,398 @@
+#include "Audio.h"
+#include "Batch.h"
 #include "Chip8.h"
+#include "Display.h"
 #include "Graphics.h"
+#include "Jit.h"
+#include "Movie.h"
+#include "Profile.h"
+#include "Quirks.h"
+#include "Rewind.h"
+#include "SaveState.h"
+#include "Scheduler.h"
+#include "Trace.h"
+#include "TripleBuffer.h"
+#include <atomic>
 #include <chrono>
+#include <csignal>
 #include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
 #include <thread>
+#include <time.h>
 
 Chip8 chip8;
 
-void print_gfx(const unsigned char *array);
+// Set by SIGUSR1, asks the emulation thread to write out the profile.
+static volatile std::sig_atomic_t profile_requested = 0;
 
-void run_emulator() {
-    using namespace std::this_thread;
-    using namespace std::chrono;
-    int frame = 0;
+static void request_profile(int) { profile_requested = 1; }
+
+// A finished frame handed from the emulation thread to the window thread.
+struct Frame {
+    Framebuffer gfx;
+};
+
+// Everything the emulation thread and the window thread share. Nothing here
+// takes a lock: frames go through the triple buffer, the keypad and the quit
+// request are atomics.
+struct EmulatorLink {
+    TripleBuffer<Frame> frames;
+    // Keys held in the window, bit n is CHIP-8 key n.
+    std::atomic<uint16_t> keys{0};
+    std::atomic<bool> quit{false};
+    // Where to write the profile (PREFIX.json, PREFIX.csv), nullptr for none.
+    const char *profile_prefix = nullptr;
+    // Save-state hotkey for the emulation thread (Display::state_request)
+    std::atomic<int> state_request{Display::STATE_REQUEST_NONE};
+    // Save-state file, next to the game
+    std::string state_path;
+    // Frame history, nullptr when rewinding is off
+    RewindBuffer *rewind = nullptr;
+    // Held down in the window: step back through `rewind` instead of running
+    std::atomic<bool> rewinding{false};
+    // Input being recorded, nullptr when not recording
+    Movie *movie = nullptr;
+    // Sound output, nullptr when off
+    Chip8Audio *audio = nullptr;
+};
 
-    Chip8Window *screen = new Chip8Window();
+void print_gfx(const Framebuffer &gfx);
+
+// Runs `count` instructions on whichever engine is active. The JIT can run a
+// few instructions past the end of a tick; those are taken off the next one.
+static void run_instructions(engine_type engine, Chip8Jit *jit,
+                             unsigned long count, unsigned long &overshoot) {
+    if (overshoot >= count) {
+        overshoot -= count;
+        return;
+    }
+    count -= overshoot;
+    unsigned long executed;
+    if (jit != nullptr)
+        executed = jit->run(chip8, count);
+    else if (engine == ENGINE_THREADED)
+        executed = chip8.run_threaded(count);
+    else
+        executed = chip8.run(count);
+    overshoot = executed - count;
+}
+
+// Saves to or restores from the save-state file. Runs on the emulation thread,
+// between ticks.
+static void handle_state_request(int request, EmulatorLink &link) {
+    const char *path = link.state_path.c_str();
+    if (request == Display::STATE_REQUEST_SAVE) {
+        SaveState *state = new SaveState;
+        chip8.save_state(*state);
+        if (write_save_state(path, *state))
+            printf("Saved state to %s\n", path);
+        else
+            std::cerr << "ERROR: Can't write save state " << path << "\n";
+        delete state;
+    } else if (request == Display::STATE_REQUEST_LOAD &&
+               link.movie != nullptr) {
+        std::cerr << "WARNING: Can't load states while recording a movie\n";
+    } else if (request == Display::STATE_REQUEST_LOAD) {
+        MappedSaveState mapped(path);
+        if (mapped.get() != nullptr && chip8.load_state(*mapped.get()))
+            printf("Loaded state from %s\n", path);
+        else
+            std::cerr << "ERROR: No valid save state in " << path << "\n";
+    }
+}
+
+// Emulation thread: runs the CPU and the timers on their own schedule and
+// publishes a frame whenever the display changed. Never touches SDL.
+static void emulation_loop(engine_type engine, Chip8Jit *jit,
+                           const SchedulerOptions &timing,
+                           EmulatorLink &link) {
+    SchedulerOptions cpu_timing = timing;
+    cpu_timing.presents_per_second = 0;
+    Scheduler scheduler(cpu_timing);
+    unsigned long overshoot = 0;
+    SaveState *snapshot = link.rewind != nullptr ? new SaveState : nullptr;
+    while (!link.quit.load(std::memory_order_relaxed)) {
+        scheduler.wait();
+        int request = link.state_request.exchange(
+            Display::STATE_REQUEST_NONE, std::memory_order_relaxed);
+        if (request != Display::STATE_REQUEST_NONE)
+            handle_state_request(request, link);
+        // One 60 Hz tick: a slice of instructions, then the timers. While
+        // rewinding each tick goes back one recorded frame instead.
+        for (int ticks = scheduler.due_ticks(); ticks > 0; ticks--) {
+            if (snapshot != nullptr &&
+                link.rewinding.load(std::memory_order_relaxed)) {
+                if (link.rewind->pop(*snapshot))
+                    chip8.load_state(*snapshot);
+            } else {
+                uint16_t keys = link.keys.load(std::memory_order_relaxed);
+                chip8.set_keys(keys);
+                run_instructions(engine, jit, scheduler.instructions_for_tick(),
+                                 overshoot);
+                chip8.update_timers();
+                if (link.movie != nullptr)
+                    link.movie->record_frame(keys, chip8);
+                if (snapshot != nullptr) {
+                    chip8.save_state(*snapshot);
+                    link.rewind->push(*snapshot);
+                }
+            }
+            if (link.audio != nullptr)
+                link.audio->push_tick(chip8.get_sound_timer() > 0,
+                                      chip8.get_audio_pattern(),
+                                      chip8.get_pitch());
+            if (chip8.get_draw_flag() == true && chip8.get_dirty_rows() != 0) {
+                link.frames.write_buffer().gfx = chip8.get_gfx();
+                link.frames.publish();
+                chip8.clear_dirty_rows();
+            }
+            chip8.set_draw_flag(false);
+        }
+        if (profile_requested && link.profile_prefix != nullptr) {
+            profile_requested = 0;
+            if (!chip8.write_profile(link.profile_prefix))
+                std::cerr << "ERROR: Can't write profile "
+                          << link.profile_prefix << "\n";
+        }
+    }
+    delete snapshot;
+}
+
+// Feeds every 60 Hz frame to a headless display (video, snapshots) on the
+// calling thread, unthrottled, until `frame_limit` frames (0 for no limit) or
+// the display stops. There is no input: the keypad stays released. Returns
+// the number of frames run.
+static unsigned long headless_loop(engine_type engine, Chip8Jit *jit,
+                                   const SchedulerOptions &timing,
+                                   Display *screen, unsigned long frame_limit,
+                                   EmulatorLink &link) {
+    SchedulerOptions cpu_timing = timing;
+    cpu_timing.presents_per_second = 0;
+    cpu_timing.unthrottled = true;
+    Scheduler scheduler(cpu_timing);
+    unsigned long overshoot = 0;
+    unsigned long frame = 0;
+    for (; screen->is_running() && (frame_limit == 0 || frame < frame_limit);
+         frame++) {
+        run_instructions(engine, jit, scheduler.instructions_for_tick(),
+                         overshoot);
+        chip8.update_timers();
+        if (link.movie != nullptr)
+            link.movie->record_frame(0, chip8);
+        screen->update_screen_with_buffer(chip8.get_gfx(),
+                                          chip8.get_dirty_rows());
+        chip8.clear_dirty_rows();
+        chip8.set_draw_flag(false);
+        if (profile_requested && link.profile_prefix != nullptr) {
+            profile_requested = 0;
+            if (!chip8.write_profile(link.profile_prefix))
+                std::cerr << "ERROR: Can't write profile "
+                          << link.profile_prefix << "\n";
+        }
+    }
+    return frame;
+}
+
+// The window (SDL) stays on the calling thread and presents the newest frame
+// on its own cadence, while the game runs on an emulation thread. A slow
+// present never holds up the CPU and the other way around. Headless displays
+// get every frame instead, see headless_loop(). Takes ownership of `screen`.
+// Returns the exit status, 1 if the game can't be loaded.
+int run_emulator(const char *rom_path, engine_type engine,
+                 const SchedulerOptions &timing, const QuirkTable &quirk_table,
+                 const char *trace_path, const char *profile_prefix,
+                 size_t rewind_kb, const char *movie_path, int audio_buffer,
+                 Display *screen, unsigned long frame_limit) {
+
+    bool headless = screen->wants_every_frame();
+    // Nobody to hear it, nobody to hold Backspace
+    if (headless) {
+        audio_buffer = 0;
+        rewind_kb = 0;
+    }
     chip8.initialize();
-    chip8.load_game("Cave.ch8");
-    while (screen->is_running()) {
-        sleep_for(milliseconds(100));
+    if (!chip8.load_game(rom_path)) {
+        delete screen;
+        return 1;
+    }
+    Chip8Audio *audio = nullptr;
+    if (audio_buffer > 0) {
+        audio = new Chip8Audio(audio_buffer);
+        if (!audio->is_open()) {
+            delete audio;
+            audio = nullptr;
+        }
+    }
+    chip8.set_quirks(quirk_table.lookup(chip8.rom_hash()));
+    printf("Quirks: %s (ROM hash %016llx)\n",
+           quirk_profile_name(chip8.get_quirks()), chip8.rom_hash());
+
+    // A movie starts from a known seed and plays back on the interpreter
+    // (see Movie.h), and the game can't jump around in time while recording.
+    Movie *movie = nullptr;
+    if (movie_path != nullptr) {
+        movie = new Movie();
+        movie->seed = time(nullptr);
+        movie->rom_hash = chip8.rom_hash();
+        movie->instructions_per_second = timing.instructions_per_second;
+        movie->quirks = chip8.get_quirks();
+        chip8.seed(movie->seed);
+        if (engine == ENGINE_JIT || rewind_kb > 0)
+            std::cerr << "WARNING: Recording can't use the JIT and turns "
+                         "rewinding off\n";
+        if (engine == ENGINE_JIT)
+            engine = ENGINE_INTERPRETER;
+        rewind_kb = 0;
+    }
+
+    Profile *profile = nullptr;
+    if (profile_prefix != nullptr) {
+        profile = new Profile();
+        chip8.attach_profile(profile);
+    }
+
+    Chip8Jit *jit = nullptr;
+    if (engine == ENGINE_JIT) {
+        jit = new Chip8Jit();
+        if (jit->is_supported()) {
+            chip8.attach_jit(jit);
+        } else {
+            std::cerr << "WARNING: JIT not available on this host, using the "
+                         "interpreter\n";
+            delete jit;
+            jit = nullptr;
+        }
+    }
+
+    TraceWriter *tracer = nullptr;
+    TraceRing *trace_ring = nullptr;
+    if (trace_path != nullptr) {
+        tracer = new TraceWriter(trace_path);
+        trace_ring = new TraceRing(0);
+        tracer->attach(trace_ring);
+        chip8.attach_trace(trace_ring);
+    }
+
+    EmulatorLink link;
+    link.profile_prefix = profile_prefix;
+    link.state_path = std::string(rom_path) + ".state";
+    if (rewind_kb > 0) {
+        // The budget has to hold the game's keyframes, which are mostly its
+        // ROM and whatever it keeps in memory
+        SaveState *state = new SaveState();
+        chip8.save_state(*state);
+        size_t needed = RewindBuffer::min_capacity(*state);
+        delete state;
+        if (rewind_kb * 1024 < needed) {
+            size_t kb = (needed + 1023) / 1024;
+            std::cerr << "WARNING: --rewind-kb=" << rewind_kb
+                      << " can't hold two snapshots of this game, using "
+                      << kb << " KB\n";
+            rewind_kb = kb;
+        }
+        link.rewind = new RewindBuffer(rewind_kb * 1024);
+    }
+    link.movie = movie;
+    link.audio = audio;
+    if (headless) {
+        auto start = std::chrono::steady_clock::now();
+        unsigned long frames =
+            headless_loop(engine, jit, timing, screen, frame_limit, link);
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        fprintf(stderr, "Headless: %lu frames in %.3fs (%.0fx real time)\n",
+                frames, elapsed.count(),
+                elapsed.count() > 0 ? frames / 60.0 / elapsed.count() : 0.0);
+    }
+    std::thread emulator;
+    if (!headless)
+        emulator = std::thread(emulation_loop, engine, jit, std::cref(timing),
+                               std::ref(link));
+
+    SchedulerOptions window_timing = timing;
+    window_timing.emulate = false;
+    window_timing.unthrottled = false;
+    Scheduler pacing(window_timing);
+    // What the window currently shows. Frames can be skipped when the window
+    // falls behind, so dirty rows are worked out against this rather than
+    // taken from the emulator.
+    Framebuffer shown = {};
+    bool first_frame = true;
+    while (!headless && screen->is_running()) {
+        pacing.wait();
         screen->handle_input();
-        chip8.emulate_cycle();
-        printf("======================\n", frame);
-        printf("Frame     -> %d\n", frame);
-        if (chip8.get_draw_flag() == true) {
-            printf("      ==> Proceeding to draw screen \n");
-            screen->update_screen_with_buffer(chip8.get_gfx());
-            chip8.set_draw_flag(false);
-            printf("======================\n", frame);
+        link.keys.store(screen->get_keys(), std::memory_order_relaxed);
+        link.rewinding.store(screen->is_rewinding(), std::memory_order_relaxed);
+        Display::state_request request = screen->take_state_request();
+        if (request != Display::STATE_REQUEST_NONE)
+            link.state_request.store(request, std::memory_order_relaxed);
+        if (pacing.present_due() && link.frames.consume()) {
+            const Frame &newest = link.frames.read_buffer();
+            // The window starts out with a test pattern, replace all of it.
+            // A resolution switch changes every texture row.
+            const Framebuffer &gfx = newest.gfx;
+            uint64_t dirty_rows =
+                first_frame || gfx.hires != shown.hires ? ~(uint64_t)0 : 0;
+            for (int y = 0; y < 64; y++) {
+                if (memcmp(gfx.planes[0][y], shown.planes[0][y],
+                           sizeof(gfx.planes[0][y])) != 0 ||
+                    memcmp(gfx.planes[1][y], shown.planes[1][y],
+                           sizeof(gfx.planes[1][y])) != 0)
+                    dirty_rows |= (uint64_t)1 << y;
+            }
+            screen->update_screen_with_buffer(gfx, dirty_rows);
+            shown = gfx;
+            first_frame = false;
         }
-        frame++;
     }
+
+    link.quit.store(true, std::memory_order_relaxed);
+    if (emulator.joinable())
+        emulator.join();
+    delete link.rewind;
+    if (audio != nullptr) {
+        printf("Audio: %llu underruns, %llu ticks skipped in %llu "
+               "callbacks\n",
+               (unsigned long long)audio->get_underruns(),
+               (unsigned long long)audio->get_skipped(),
+               (unsigned long long)audio->get_callbacks());
+        delete audio;
+    }
+    if (movie != nullptr) {
+        if (movie->save(movie_path))
+            printf("Recorded %zu frames to %s\n", movie->keys.size(),
+                   movie_path);
+        else
+            std::cerr << "ERROR: Can't write movie " << movie_path << "\n";
+        delete movie;
+    }
+    if (tracer != nullptr) {
+        chip8.attach_trace(nullptr);
+        tracer->detach(trace_ring);
+        delete trace_ring;
+        delete tracer;
+    }
+    if (profile != nullptr) {
+        if (!chip8.write_profile(profile_prefix))
+            std::cerr << "ERROR: Can't write profile " << profile_prefix
+                      << "\n";
+        chip8.attach_profile(nullptr);
+        delete profile;
+    }
+    chip8.attach_jit(nullptr);
+    delete jit;
     delete screen;
+    return 0;
 }
 
-void run_sdl2_window() {
+void run_sdl2_window(scale_filter filter, int scale) {
     using namespace std::this_thread;
     using namespace std::chrono;
     int frame = 0;
 
-    Chip8Window *screen = new Chip8Window();
+    Chip8Window *screen = new Chip8Window(filter, scale != 0 ? scale : 8);
     while (screen->is_running()) {
         sleep_for(milliseconds(10));
         screen->handle_input();
@@ -48,18 +402,229 @@ void run_sdl2_window() {
     delete screen;
 }
 
-void print_gfx(const unsigned char *array) {
-    for (int i = 0; i < 64 * 32; i++) {
-        if (i % 64 == 0 && i != 0) {
+void print_gfx(const Framebuffer &gfx) {
+    for (int y = 0; y < gfx.height(); y++) {
+        if (y != 0)
             printf("\n");
+        for (int x = 0; x < gfx.width(); x++) {
+            const uint64_t *row = gfx.planes[0][y];
+            printf("%X", (unsigned int)(row[x / 64] >> (63 - x % 64)) & 1);
         }
-        printf("%X", array[i]);
     }
 }
 
+// Usage: final_program [--engine=interpreter|jit|threaded] [--ips=N]
+//                      [--present-hz=N] [--unthrottled] [--trace=FILE]
+//                      [--profile=PREFIX] [--rewind-kb=N] [--record=FILE]
+//                      [--quirks=NAME] [--quirk-table=FILE]
+//                      [--audio-buffer=N]
+//                      [--filter=sdl|nearest|scale2x|scale3x] [--scale=N]
+//                      [--display=SPEC] [--frames=N] [--snapshot-every=N]
+//                      [game.ch8]
+//        final_program --replay=FILE [--display=SPEC] game.ch8
+//        final_program --batch=DIR [--cycles=N] [--runs=N] [--threads=N]
+//                      [--seed=N] [--summary=FILE] [--engine=...] [--ips=N]
+//                      [--trace=FILE] [--profile=PREFIX] [--quirks=NAME]
+//                      [--quirk-table=FILE]
+// Without a game the SDL test pattern is shown. --batch runs every game in DIR
+// headless and writes a summary instead of opening a window. --trace needs a
+// build with tracing compiled in (make TRACE=1 or TRACE=2), --profile one
+// with the profiler (make PROFILE=1). The profile is written on exit and on
+// SIGUSR1. --rewind-kb sets the memory kept for rewinding (Backspace), 0
+// turns it off. --record saves the input to a movie, which --replay runs
+// back headless and unthrottled, checking the framebuffer along the way.
+// Each game runs with the quirk profile (default, chip8, superchip, xochip)
+// --quirks names, or else the one the quirk table (quirks.tsv unless
+// --quirk-table says otherwise) lists for its ROM hash. --audio-buffer sets
+// the samples per audio callback (default 512), 0 turns sound off; the
+// underruns are printed on exit. --scale sets the window pixels per high
+// resolution pixel (default 8) and --filter how they are scaled: by SDL
+// (default) or on the CPU, see Scaler.h. --display sends the frames somewhere
+// else than the window: null, ppm:PREFIX or png:PREFIX (a picture every
+// --snapshot-every frames, default 60, 0 for only the last), y4m:FILE or
+// rgb:FILE (raw video, - for stdout). Those run headless and unthrottled,
+// for --frames frames (0, the default, until the output fails); with
+// --replay they record the movie. Their --scale defaults to 1.
 int main(int argc, char **argv) {
-    // run_emulator();
-    run_sdl2_window();
+    const char *rom_path = nullptr;
+    engine_type engine = ENGINE_INTERPRETER;
+    SchedulerOptions timing;
+    BatchOptions batch;
+    const char *trace_path = nullptr;
+    const char *profile_prefix = nullptr;
+    size_t rewind_kb = 256;
+    const char *movie_path = nullptr;
+    const char *replay_path = nullptr;
+    const char *quirks_name = nullptr;
+    const char *quirk_table_path = nullptr;
+    int audio_buffer = 512;
+    scale_filter filter = FILTER_SDL;
+    // 0 for the display's default
+    int scale = 0;
+    const char *display_spec = nullptr;
+    unsigned long frame_limit = 0;
+    unsigned long snapshot_every = 60;
+    for (int i = 1; i < argc; i++) {
+        const char *value = strchr(argv[i], '=');
+        value = value != nullptr ? value + 1 : "";
+        if (strcmp(argv[i], "--engine=interpreter") == 0) {
+            engine = ENGINE_INTERPRETER;
+        } else if (strcmp(argv[i], "--engine=jit") == 0) {
+            engine = ENGINE_JIT;
+        } else if (strcmp(argv[i], "--engine=threaded") == 0) {
+            engine = ENGINE_THREADED;
+        } else if (strncmp(argv[i], "--ips=", 6) == 0) {
+            timing.instructions_per_second = strtoul(value, nullptr, 10);
+        } else if (strncmp(argv[i], "--present-hz=", 13) == 0) {
+            timing.presents_per_second = strtoul(value, nullptr, 10);
+        } else if (strncmp(argv[i], "--trace=", 8) == 0) {
+            trace_path = value;
+        } else if (strncmp(argv[i], "--profile=", 10) == 0) {
+            profile_prefix = value;
+        } else if (strncmp(argv[i], "--rewind-kb=", 12) == 0) {
+            rewind_kb = strtoul(value, nullptr, 10);
+        } else if (strncmp(argv[i], "--record=", 9) == 0) {
+            movie_path = value;
+        } else if (strncmp(argv[i], "--replay=", 9) == 0) {
+            replay_path = value;
+        } else if (strncmp(argv[i], "--quirks=", 9) == 0) {
+            quirks_name = value;
+        } else if (strncmp(argv[i], "--quirk-table=", 14) == 0) {
+            quirk_table_path = value;
+        } else if (strncmp(argv[i], "--audio-buffer=", 15) == 0) {
+            audio_buffer = atoi(value);
+        } else if (strncmp(argv[i], "--filter=", 9) == 0) {
+            if (!parse_scale_filter(value, filter)) {
+                std::cerr << "ERROR: Unknown filter " << value
+                          << " (sdl, nearest, scale2x or scale3x)\n";
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--scale=", 8) == 0) {
+            scale = atoi(value);
+            if (scale < 1 || scale > 16) {
+                std::cerr << "ERROR: --scale must be between 1 and 16\n";
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--display=", 10) == 0) {
+            display_spec = value;
+        } else if (strncmp(argv[i], "--frames=", 9) == 0) {
+            frame_limit = strtoul(value, nullptr, 10);
+        } else if (strncmp(argv[i], "--snapshot-every=", 17) == 0) {
+            snapshot_every = strtoul(value, nullptr, 10);
+        } else if (strcmp(argv[i], "--unthrottled") == 0) {
+            timing.unthrottled = true;
+        } else if (strncmp(argv[i], "--batch=", 8) == 0) {
+            batch.rom_dir = value;
+        } else if (strncmp(argv[i], "--cycles=", 9) == 0) {
+            batch.cycle_budget = strtoul(value, nullptr, 10);
+        } else if (strncmp(argv[i], "--runs=", 7) == 0) {
+            batch.runs_per_rom = strtoul(value, nullptr, 10);
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            batch.threads = strtoul(value, nullptr, 10);
+        } else if (strncmp(argv[i], "--seed=", 7) == 0) {
+            batch.seed = strtoul(value, nullptr, 10);
+        } else if (strncmp(argv[i], "--summary=", 10) == 0) {
+            batch.summary_path = value;
+        } else if (strncmp(argv[i], "--", 2) == 0) {
+            std::cerr << "ERROR: Unknown option " << argv[i] << "\n";
+            return 1;
+        } else {
+            rom_path = argv[i];
+        }
+    }
 
-    return 0;
+    if (timing.instructions_per_second == 0) {
+        std::cerr << "ERROR: --ips must be at least 1\n";
+        return 1;
+    }
+    if (timing.presents_per_second == 0 && batch.rom_dir == nullptr) {
+        std::cerr << "ERROR: --present-hz must be at least 1\n";
+        return 1;
+    }
+
+    // The default table is optional, one that was asked for isn't
+    QuirkTable quirk_table;
+    if (quirk_table_path != nullptr) {
+        if (!quirk_table.load(quirk_table_path)) {
+            std::cerr << "ERROR: Can't read quirk table " << quirk_table_path
+                      << "\n";
+            return 1;
+        }
+    } else {
+        quirk_table.load("quirks.tsv");
+    }
+    if (quirks_name != nullptr) {
+        quirk_profile profile;
+        if (!parse_quirk_profile(quirks_name, profile)) {
+            std::cerr << "ERROR: Unknown quirk profile " << quirks_name
+                      << " (default, chip8, superchip or xochip)\n";
+            return 1;
+        }
+        quirk_table.force(profile);
+    }
+
+    if (trace_path != nullptr && CHIP8_TRACE_LEVEL == 0)
+        std::cerr << "WARNING: Tracing is compiled out, rebuild with "
+                     "make TRACE=1 (or 2) for --trace to record anything\n";
+
+    if (profile_prefix != nullptr && CHIP8_PROFILE == 0) {
+        std::cerr << "WARNING: The profiler is compiled out, rebuild with "
+                     "make PROFILE=1 for --profile to record anything\n";
+        profile_prefix = nullptr;
+    }
+    if (profile_prefix != nullptr) {
+        std::signal(SIGUSR1, request_profile);
+        // Only the switch interpreter calls the counters
+        if (engine != ENGINE_INTERPRETER) {
+            std::cerr << "WARNING: Profiling uses the interpreter\n";
+            engine = ENGINE_INTERPRETER;
+        }
+    }
+
+    if (replay_path != nullptr) {
+        if (rom_path == nullptr) {
+            std::cerr << "ERROR: --replay needs the game it was recorded "
+                         "with\n";
+            return 1;
+        }
+        Display *display = nullptr;
+        if (display_spec != nullptr) {
+            display = open_display(display_spec, filter, scale,
+                                   snapshot_every);
+            if (display == nullptr)
+                return 1;
+        }
+        int result = replay_movie(replay_path, rom_path, display);
+        delete display;
+        return result;
+    }
+
+    if (batch.rom_dir != nullptr) {
+        batch.trace_path = trace_path;
+        batch.profile_prefix = profile_prefix;
+        batch.engine = engine;
+        batch.quirk_table = &quirk_table;
+        batch.instructions_per_second = timing.instructions_per_second;
+        if (batch.runs_per_rom == 0)
+            batch.runs_per_rom = 1;
+        return run_batch(batch);
+    }
+
+    if (rom_path == nullptr) {
+        if (display_spec != nullptr && strcmp(display_spec, "sdl") != 0) {
+            std::cerr << "ERROR: --display=" << display_spec
+                      << " needs a game\n";
+            return 1;
+        }
+        run_sdl2_window(filter, scale);
+        return 0;
+    }
+    Display *screen =
+        open_display(display_spec != nullptr ? display_spec : "sdl", filter,
+                     scale, snapshot_every);
+    if (screen == nullptr)
+        return 1;
+    return run_emulator(rom_path, engine, timing, quirk_table, trace_path,
+                        profile_prefix, rewind_kb, movie_path, audio_buffer,
+                        screen, frame_limit);
 }
@@ -0,0 +1,324 @@
+// =====================================================================================
+// Static analysis of ROMs (see include/Analyzer.h): which bytes are code and
+// which are data, the basic blocks with their successors, and the call graph.
+//
+// Every PATH is a ROM or a directory of .ch8 files; a whole corpus is spread
+// over all cores. Output is one document per ROM, in the order given (a
+// directory's ROMs sorted by name):
+//   json  one object per line: sizes, a code/data map with a character per
+//         byte (c code, d data, b both, . never reached), blocks,
+//         subroutines, external jump targets, unknown opcodes, BNNN jumps
+//   dot   a Graphviz digraph of the blocks with their disassembly, calls
+//         dashed
+// With --output=DIR every ROM gets DIR/NAME.json or DIR/NAME.dot instead.
+//
+// The quirk profile decides what decodes as an instruction: --quirks=NAME
+// for every ROM, else the one --quirk-table=FILE lists for its hash, else
+// the default.
+//
+// Usage: analyze [--format=json|dot] [--quirks=NAME] [--quirk-table=FILE]
+//                [--threads=N] [--output=DIR] PATH...
+// =====================================================================================
+#include "Analyzer.h"
+#include "Disassembler.h"
+#include "Quirks.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+using analyze_clock = std::chrono::steady_clock;
+
+static const char *edge_names[] = {"fallthrough", "jump", "skip", "call",
+                                   "jump_table"};
+
+static bool read_file(const std::string &path,
+                      std::vector<unsigned char> &bytes) {
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == nullptr)
+        return false;
+    unsigned char buffer[4096];
+    size_t got;
+    while ((got = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        bytes.insert(bytes.end(), buffer, buffer + got);
+    bool failed = ferror(file);
+    fclose(file);
+    return !failed;
+}
+
+// Chip8::rom_hash() of the ROM as it would be loaded
+static unsigned long long rom_hash(const std::vector<unsigned char> &rom) {
+    unsigned long long hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < rom.size() && i < 0x10000 - 0x200; i++) {
+        hash ^= rom[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// printf() onto the end of `out`.
+__attribute__((format(printf, 2, 3))) static void
+append(std::string &out, const char *format, ...) {
+    char text[256];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    if (length > 0)
+        out.append(text, std::min((size_t)length, sizeof(text) - 1));
+}
+
+static void append_json_string(std::string &out, const std::string &text) {
+    out += '"';
+    for (unsigned char c : text) {
+        if (c == '"' || c == '\\')
+            out += '\\';
+        if (c < 0x20)
+            append(out, "\\u%04x", c);
+        else
+            out += c;
+    }
+    out += '"';
+}
+
+static void append_addresses(std::string &out,
+                             const std::vector<uint16_t> &addresses) {
+    out += '[';
+    for (size_t i = 0; i < addresses.size(); i++)
+        append(out, i == 0 ? "%u" : ",%u", addresses[i]);
+    out += ']';
+}
+
+static void write_json(std::string &out, const std::string &path,
+                       unsigned long long hash,
+                       const RomAnalysis &analysis) {
+    static const char map_chars[] = {'.', 'c', 'd', 'b'};
+    size_t used[4] = {};
+    std::string map;
+    for (uint8_t use : analysis.bytes) {
+        used[use]++;
+        map += map_chars[use];
+    }
+
+    out += "{\"rom\":";
+    append_json_string(out, path);
+    append(out,
+           ",\"size\":%zu,\"hash\":\"%016llx\",\"profile\":\"%s\","
+           "\"code_bytes\":%zu,\"data_bytes\":%zu,\"shared_bytes\":%zu,"
+           "\"unknown_bytes\":%zu,\"map\":\"",
+           analysis.bytes.size(), hash,
+           quirk_profile_name(analysis.profile), used[ROM_BYTE_CODE],
+           used[ROM_BYTE_DATA], used[ROM_BYTE_CODE | ROM_BYTE_DATA],
+           used[ROM_BYTE_UNKNOWN]);
+    out += map;
+    out += "\",\"blocks\":[";
+    for (size_t i = 0; i < analysis.blocks.size(); i++) {
+        const BasicBlock &block = analysis.blocks[i];
+        append(out,
+               "%s{\"start\":%u,\"last\":%u,\"end\":%u,\"instructions\":%u,"
+               "\"successors\":[",
+               i == 0 ? "" : ",", block.start, block.last, block.end,
+               block.instructions);
+        for (size_t e = 0; e < block.successors.size(); e++)
+            append(out, "%s{\"to\":%u,\"kind\":\"%s\"}", e == 0 ? "" : ",",
+                   block.successors[e].target,
+                   edge_names[block.successors[e].kind]);
+        out += "]}";
+    }
+    out += "],\"subroutines\":[";
+    for (size_t i = 0; i < analysis.subroutines.size(); i++) {
+        const Subroutine &subroutine = analysis.subroutines[i];
+        append(out, "%s{\"entry\":%u,\"blocks\":", i == 0 ? "" : ",",
+               subroutine.entry);
+        append_addresses(out, subroutine.blocks);
+        out += ",\"calls\":";
+        append_addresses(out, subroutine.calls);
+        out += '}';
+    }
+    out += "],\"external_targets\":";
+    append_addresses(out, analysis.external_targets);
+    out += ",\"unknown_opcodes\":";
+    append_addresses(out, analysis.unknown_opcodes);
+    out += ",\"indirect_jumps\":";
+    append_addresses(out, analysis.indirect_jumps);
+    out += "}\n";
+}
+
+static void write_dot(std::string &out, const std::string &path,
+                      const std::vector<unsigned char> &rom,
+                      const RomAnalysis &analysis) {
+    out += "digraph ";
+    append_json_string(out, std::filesystem::path(path).stem().string());
+    out += " {\n  node [shape=box, fontname=monospace];\n";
+    bool xo_chip = quirk_flags(analysis.profile).xo_chip;
+    for (const BasicBlock &block : analysis.blocks) {
+        append(out, "  b%03X [label=\"", block.start);
+        unsigned int address = block.start;
+        while (address < block.end) {
+            unsigned short op = rom[address - 0x200] << 8 |
+                                rom[address + 1 - 0x200];
+            char text[32];
+            disassemble(op, text, sizeof(text));
+            append(out, "%03X: %04X %s", address, op, text);
+            address += 2;
+            // F000 NNNN, the operand is the next word
+            if (op == 0xF000 && xo_chip) {
+                append(out, " %04X", rom[address - 0x200] << 8 |
+                                         rom[address + 1 - 0x200]);
+                address += 2;
+            }
+            out += "\\l";
+        }
+        out += "\"];\n";
+    }
+    for (const BasicBlock &block : analysis.blocks) {
+        for (const BlockEdge &edge : block.successors) {
+            if (analysis.block_at(edge.target) < 0)
+                append(out, "  x%03X [label=\"%03X\", shape=ellipse];\n",
+                       edge.target, edge.target);
+            append(out, "  b%03X -> %c%03X [label=\"%s\"%s];\n", block.start,
+                   analysis.block_at(edge.target) < 0 ? 'x' : 'b',
+                   edge.target, edge_names[edge.kind],
+                   edge.kind == EDGE_CALL ? ", style=dashed" : "");
+        }
+    }
+    out += "}\n";
+}
+
+int main(int argc, char **argv) {
+    namespace fs = std::filesystem;
+
+    bool dot = false;
+    const char *quirks_name = nullptr;
+    const char *quirk_table_path = nullptr;
+    unsigned int threads = 0;
+    const char *output_dir = nullptr;
+    std::vector<const char *> paths;
+    for (int i = 1; i < argc; i++) {
+        const char *value = strchr(argv[i], '=');
+        value = value != nullptr ? value + 1 : "";
+        if (strncmp(argv[i], "--format=", 9) == 0) {
+            if (strcmp(value, "json") != 0 && strcmp(value, "dot") != 0) {
+                fprintf(stderr, "ERROR: Unknown format %s\n", value);
+                return 1;
+            }
+            dot = strcmp(value, "dot") == 0;
+        } else if (strncmp(argv[i], "--quirks=", 9) == 0) {
+            quirks_name = value;
+        } else if (strncmp(argv[i], "--quirk-table=", 14) == 0) {
+            quirk_table_path = value;
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            threads = strtoul(value, nullptr, 10);
+        } else if (strncmp(argv[i], "--output=", 9) == 0) {
+            output_dir = value;
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "ERROR: Unknown option %s\n", argv[i]);
+            return 1;
+        } else {
+            paths.push_back(argv[i]);
+        }
+    }
+    if (paths.empty()) {
+        fprintf(stderr,
+                "Usage: %s [--format=json|dot] [--quirks=NAME] "
+                "[--quirk-table=FILE] [--threads=N] [--output=DIR] PATH...\n",
+                argv[0]);
+        return 1;
+    }
+
+    QuirkTable quirk_table;
+    if (quirk_table_path != nullptr && !quirk_table.load(quirk_table_path)) {
+        fprintf(stderr, "ERROR: Can't read quirk table %s\n",
+                quirk_table_path);
+        return 1;
+    }
+    if (quirks_name != nullptr) {
+        quirk_profile profile;
+        if (!parse_quirk_profile(quirks_name, profile)) {
+            fprintf(stderr, "ERROR: Unknown quirk profile %s\n", quirks_name);
+            return 1;
+        }
+        quirk_table.force(profile);
+    }
+
+    std::vector<std::string> roms;
+    for (const char *path : paths) {
+        std::error_code error;
+        if (!fs::is_directory(path, error)) {
+            roms.push_back(path);
+            continue;
+        }
+        std::vector<std::string> found;
+        for (const fs::directory_entry &entry :
+             fs::directory_iterator(path, error)) {
+            if (entry.is_regular_file() && entry.path().extension() == ".ch8")
+                found.push_back(entry.path().string());
+        }
+        if (error) {
+            fprintf(stderr, "ERROR: Can't read ROM directory %s: %s\n", path,
+                    error.message().c_str());
+            return 1;
+        }
+        // Directory order is unspecified, sort so outputs can be diffed.
+        std::sort(found.begin(), found.end());
+        roms.insert(roms.end(), found.begin(), found.end());
+    }
+    if (output_dir != nullptr) {
+        std::error_code error;
+        fs::create_directories(output_dir, error);
+        if (error) {
+            fprintf(stderr, "ERROR: Can't create %s: %s\n", output_dir,
+                    error.message().c_str());
+            return 1;
+        }
+    }
+
+    // Documents in ROM order; with --output they go straight to their files
+    std::vector<std::string> documents(roms.size());
+    std::vector<char> failed(roms.size(), 0);
+    analyze_clock::time_point start = analyze_clock::now();
+    WorkStealingPool pool(threads);
+    pool.run(roms.size(), [&](size_t i) {
+        std::vector<unsigned char> rom;
+        if (!read_file(roms[i], rom)) {
+            fprintf(stderr, "ERROR: Can't read %s\n", roms[i].c_str());
+            failed[i] = 1;
+            return;
+        }
+        unsigned long long hash = rom_hash(rom);
+        RomAnalysis analysis;
+        analyze_rom(rom.data(), rom.size(), quirk_table.lookup(hash),
+                    analysis);
+        std::string &out = documents[i];
+        if (dot)
+            write_dot(out, roms[i], rom, analysis);
+        else
+            write_json(out, roms[i], hash, analysis);
+        if (output_dir == nullptr)
+            return;
+
+        fs::path file = fs::path(output_dir) / fs::path(roms[i]).stem();
+        file += dot ? ".dot" : ".json";
+        FILE *output = fopen(file.string().c_str(), "w");
+        if (output == nullptr ||
+            fwrite(out.data(), 1, out.size(), output) != out.size()) {
+            fprintf(stderr, "ERROR: Can't write %s\n", file.string().c_str());
+            failed[i] = 1;
+        }
+        if (output != nullptr)
+            fclose(output);
+        out.clear();
+    });
+    for (const std::string &document : documents)
+        fwrite(document.data(), 1, document.size(), stdout);
+    double seconds =
+        std::chrono::duration<double>(analyze_clock::now() - start).count();
+    fprintf(stderr, "Analyzed %zu ROMs in %.2f s\n", roms.size(), seconds);
+    return std::count(failed.begin(), failed.end(), 1) > 0 ? 1 : 0;
+}
@@ -0,0 +1,345 @@
+// =====================================================================================
+// Benchmark suite. Runs a set of generated ROMs, each hammering one family of
+// opcodes, on every available engine and reports as JSON:
+//   - instructions per second with the CPU unthrottled
+//   - nanoseconds spent per emulated 60 Hz frame at --ips
+//   - latency percentiles of Chip8Window::update_screen_with_buffer() for
+//     every scale filter (SDL dummy video driver unless SDL_VIDEODRIVER is
+//     set)
+//   - instructions per second of --lanes copies of each ROM stepped by a
+//     LockstepBatch, against the same frames on one Chip8 per copy
+//
+// Usage: bench [--cycles=N] [--frames=N] [--ips=N] [--lanes=N] [--output=FILE]
+// =====================================================================================
+#include "Chip8.h"
+#include "Graphics.h"
+#include "Jit.h"
+#include "Lockstep.h"
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+using bench_clock = std::chrono::steady_clock;
+
+struct SyntheticRom {
+    const char *name;
+    std::vector<unsigned char> code;
+};
+
+static void emit(std::vector<unsigned char> &code, unsigned short opcode) {
+    code.push_back(opcode >> 8);
+    code.push_back(opcode & 0xFF);
+}
+
+// Every ROM is an endless loop starting at 0x200.
+static std::vector<SyntheticRom> make_roms() {
+    std::vector<SyntheticRom> roms;
+
+    // 8XYN arithmetic and logic, plus a 7XNN counter
+    SyntheticRom alu = {"alu", {}};
+    for (unsigned short op : {0x6001, 0x6103, 0x6207, 0x630F, 0x8014, 0x8125,
+                              0x8231, 0x8302, 0x8413, 0x8546, 0x864E, 0x8707,
+                              0x8010, 0x7101, 0x1208})
+        emit(alu.code, op);
+    roms.push_back(alu);
+
+    // DXYN at random positions with random font glyphs
+    SyntheticRom sprites = {"sprites", {}};
+    for (unsigned short op : {0x00E0, 0xC03F, 0xC11F, 0xC20F, 0xF229, 0xD015,
+                              0x7301, 0x1202})
+        emit(sprites.code, op);
+    roms.push_back(sprites);
+
+    // 2NNN/00EE chain eight calls deep. Subroutine n sits at 0x204 + 4n.
+    SyntheticRom calls = {"calls", {}};
+    emit(calls.code, 0x2204);
+    emit(calls.code, 0x1200);
+    for (int depth = 0; depth < 7; depth++) {
+        emit(calls.code, 0x2000 | (0x204 + 4 * (depth + 1)));
+        emit(calls.code, 0x00EE);
+    }
+    emit(calls.code, 0x7001);
+    emit(calls.code, 0x00EE);
+    roms.push_back(calls);
+
+    // FX55/FX65 block copies through I
+    SyntheticRom memory = {"memory", {}};
+    for (unsigned short op : {0xA400, 0xFF55, 0xA500, 0xFF65, 0x7001, 0xA400,
+                              0xF065, 0xF01E, 0x1200})
+        emit(memory.code, op);
+    roms.push_back(memory);
+
+    return roms;
+}
+
+struct EngineResult {
+    const char *engine;
+    const char *rom;
+    unsigned long instructions;
+    double seconds;
+    double ns_per_frame;
+};
+
+static const char *engine_name(engine_type engine) {
+    switch (engine) {
+    case ENGINE_JIT:
+        return "jit";
+    case ENGINE_THREADED:
+        return "threaded";
+    default:
+        return "interpreter";
+    }
+}
+
+static unsigned long run_on(engine_type engine, Chip8 &chip8, Chip8Jit *jit,
+                            unsigned long count) {
+    if (jit != nullptr)
+        return jit->run(chip8, count);
+    if (engine == ENGINE_THREADED)
+        return chip8.run_threaded(count);
+    return chip8.run(count);
+}
+
+static EngineResult bench_engine(engine_type engine, const SyntheticRom &rom,
+                                 unsigned long cycles, int frames,
+                                 unsigned long ips) {
+    EngineResult result = {engine_name(engine), rom.name, 0, 0, 0};
+    Chip8 *chip8 = new Chip8();
+    chip8->initialize();
+    chip8->seed(1);
+    chip8->load_rom(rom.code.data(), rom.code.size());
+    Chip8Jit *jit = nullptr;
+    if (engine == ENGINE_JIT) {
+        jit = new Chip8Jit();
+        chip8->attach_jit(jit);
+    }
+
+    // Throughput: big slices with a timer tick in between
+    const unsigned long slice = 10000;
+    bench_clock::time_point start = bench_clock::now();
+    while (result.instructions < cycles) {
+        result.instructions += run_on(engine, *chip8, jit, slice);
+        chip8->update_timers();
+    }
+    result.seconds =
+        std::chrono::duration<double>(bench_clock::now() - start).count();
+
+    // Frames: what the emulation thread does every 60 Hz tick
+    Framebuffer frame;
+    unsigned long per_frame = ips / 60;
+    start = bench_clock::now();
+    for (int i = 0; i < frames; i++) {
+        run_on(engine, *chip8, jit, per_frame);
+        chip8->update_timers();
+        if (chip8->get_draw_flag() && chip8->get_dirty_rows() != 0) {
+            frame = chip8->get_gfx();
+            chip8->clear_dirty_rows();
+        }
+        chip8->set_draw_flag(false);
+    }
+    result.ns_per_frame =
+        std::chrono::duration<double, std::nano>(bench_clock::now() - start)
+            .count() /
+        frames;
+
+    chip8->attach_jit(nullptr);
+    delete jit;
+    delete chip8;
+    return result;
+}
+
+struct LockstepResult {
+    const char *rom;
+    size_t lanes;
+    unsigned long long instructions;
+    double seconds;
+    // The same frames on one interpreter instance per lane
+    double instance_seconds;
+    // Share of the instructions the vector kernels executed
+    double vectorized;
+};
+
+static LockstepResult bench_lockstep(const SyntheticRom &rom, size_t lanes,
+                                     int frames, unsigned long ips) {
+    LockstepResult result = {rom.name, lanes, 0, 0, 0, 0};
+    LockstepBatch *batch = new LockstepBatch(
+        lanes, rom.code.data(), rom.code.size(), QUIRKS_DEFAULT, 1, ips);
+    std::vector<uint16_t> actions(lanes, 0);
+    bench_clock::time_point start = bench_clock::now();
+    for (int i = 0; i < frames; i++)
+        batch->step_batch(actions.data());
+    result.seconds =
+        std::chrono::duration<double>(bench_clock::now() - start).count();
+    result.instructions =
+        batch->get_vector_steps() + batch->get_scalar_steps();
+    result.vectorized =
+        result.instructions > 0
+            ? (double)batch->get_vector_steps() / result.instructions
+            : 0;
+    delete batch;
+
+    std::vector<Chip8 *> machines(lanes);
+    for (size_t lane = 0; lane < lanes; lane++) {
+        machines[lane] = new Chip8();
+        machines[lane]->initialize();
+        machines[lane]->load_rom(rom.code.data(), rom.code.size());
+        machines[lane]->seed(1 + lane);
+    }
+    start = bench_clock::now();
+    for (int i = 0; i < frames; i++) {
+        for (Chip8 *chip8 : machines) {
+            chip8->set_keys(0);
+            chip8->run(ips / 60);
+            chip8->update_timers();
+        }
+    }
+    result.instance_seconds =
+        std::chrono::duration<double>(bench_clock::now() - start).count();
+    for (Chip8 *chip8 : machines)
+        delete chip8;
+    return result;
+}
+
+// Nearest-rank percentile of sorted samples.
+static double percentile(const std::vector<double> &sorted, double p) {
+    size_t rank = (size_t)(p / 100 * sorted.size());
+    return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+// Times update_screen_with_buffer() with `filter` on the frames the sprite ROM
+// produces. Returns false if no window could be opened.
+static bool bench_screen(const SyntheticRom &rom, int frames,
+                         scale_filter filter,
+                         std::vector<double> &latencies_us) {
+    // Headless unless the caller picked a driver
+    setenv("SDL_VIDEODRIVER", "dummy", 0);
+    Chip8Window *screen = new Chip8Window(filter);
+    if (SDL_WasInit(SDL_INIT_VIDEO) == 0) {
+        delete screen;
+        return false;
+    }
+
+    Chip8 *chip8 = new Chip8();
+    chip8->initialize();
+    chip8->seed(1);
+    chip8->load_rom(rom.code.data(), rom.code.size());
+    for (int i = 0; i < frames; i++) {
+        chip8->run(64);
+        bench_clock::time_point start = bench_clock::now();
+        screen->update_screen_with_buffer(chip8->get_gfx(),
+                                          chip8->get_dirty_rows());
+        latencies_us.push_back(std::chrono::duration<double, std::micro>(
+                                   bench_clock::now() - start)
+                                   .count());
+        chip8->clear_dirty_rows();
+    }
+    delete chip8;
+    delete screen;
+    std::sort(latencies_us.begin(), latencies_us.end());
+    return true;
+}
+
+int main(int argc, char **argv) {
+    unsigned long cycles = 20000000;
+    int frames = 6000;
+    unsigned long ips = 700;
+    size_t lanes = 256;
+    const char *output_path = nullptr;
+    for (int i = 1; i < argc; i++) {
+        const char *value = strchr(argv[i], '=');
+        value = value != nullptr ? value + 1 : "";
+        if (strncmp(argv[i], "--cycles=", 9) == 0) {
+            cycles = strtoul(value, nullptr, 10);
+        } else if (strncmp(argv[i], "--frames=", 9) == 0) {
+            frames = atoi(value);
+        } else if (strncmp(argv[i], "--ips=", 6) == 0) {
+            ips = strtoul(value, nullptr, 10);
+        } else if (strncmp(argv[i], "--lanes=", 8) == 0) {
+            lanes = strtoul(value, nullptr, 10);
+        } else if (strncmp(argv[i], "--output=", 9) == 0) {
+            output_path = value;
+        } else {
+            fprintf(stderr, "ERROR: Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (frames < 1 || ips < 60 || lanes < 1) {
+        fprintf(stderr, "ERROR: --frames and --lanes must be at least 1 and "
+                        "--ips at least 60\n");
+        return 1;
+    }
+
+    std::vector<engine_type> engines = {ENGINE_INTERPRETER, ENGINE_THREADED};
+    Chip8Jit probe;
+    if (probe.is_supported())
+        engines.push_back(ENGINE_JIT);
+
+    std::vector<SyntheticRom> roms = make_roms();
+    std::vector<EngineResult> results;
+    for (engine_type engine : engines) {
+        for (const SyntheticRom &rom : roms)
+            results.push_back(bench_engine(engine, rom, cycles, frames, ips));
+    }
+    std::vector<LockstepResult> lockstep;
+    for (const SyntheticRom &rom : roms)
+        lockstep.push_back(bench_lockstep(rom, lanes, frames, ips));
+    const scale_filter filters[] = {FILTER_SDL, FILTER_NEAREST,
+                                    FILTER_SCALE2X, FILTER_SCALE3X};
+    std::vector<double> latencies_us[4];
+    bool have_screen = true;
+    for (int i = 0; i < 4 && have_screen; i++)
+        have_screen = bench_screen(roms[1], frames, filters[i],
+                                   latencies_us[i]);
+
+    FILE *out = output_path != nullptr ? fopen(output_path, "w") : stdout;
+    if (out == nullptr) {
+        fprintf(stderr, "ERROR: Can't write %s\n", output_path);
+        return 1;
+    }
+    fprintf(out, "{\n  \"ips\": %lu,\n  \"results\": [\n", ips);
+    for (size_t i = 0; i < results.size(); i++) {
+        const EngineResult &r = results[i];
+        fprintf(out,
+                "    {\"engine\": \"%s\", \"rom\": \"%s\", "
+                "\"instructions\": %lu, \"seconds\": %.6f, "
+                "\"instructions_per_second\": %.0f, \"ns_per_frame\": %.1f}%s\n",
+                r.engine, r.rom, r.instructions, r.seconds,
+                r.instructions / r.seconds, r.ns_per_frame,
+                i + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "  ],\n  \"lockstep\": [\n");
+    for (size_t i = 0; i < lockstep.size(); i++) {
+        const LockstepResult &r = lockstep[i];
+        fprintf(out,
+                "    {\"rom\": \"%s\", \"lanes\": %zu, "
+                "\"instructions\": %llu, \"instructions_per_second\": %.0f, "
+                "\"instance_instructions_per_second\": %.0f, "
+                "\"vectorized\": %.3f}%s\n",
+                r.rom, r.lanes, r.instructions, r.instructions / r.seconds,
+                r.instructions / r.instance_seconds, r.vectorized,
+                i + 1 < lockstep.size() ? "," : "");
+    }
+    fprintf(out, "  ],\n");
+    if (have_screen) {
+        fprintf(out, "  \"update_screen_us\": {\n");
+        for (int i = 0; i < 4; i++) {
+            const std::vector<double> &l = latencies_us[i];
+            fprintf(out,
+                    "    \"%s\": {\"samples\": %zu, \"p50\": %.2f, "
+                    "\"p90\": %.2f, \"p99\": %.2f, \"max\": %.2f}%s\n",
+                    scale_filter_name(filters[i]), l.size(),
+                    percentile(l, 50), percentile(l, 90), percentile(l, 99),
+                    l.back(), i + 1 < 4 ? "," : "");
+        }
+        fprintf(out, "  }\n");
+    } else {
+        fprintf(out, "  \"update_screen_us\": null\n");
+    }
+    fprintf(out, "}\n");
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
@@ -0,0 +1,751 @@
+// =====================================================================================
+// Engine equivalence check. Generates random games and runs each of them on
+// the interpreter (the reference) and on another engine side by side, frame
+// by frame, comparing the whole SaveState of both after every frame:
+//   threaded  Chip8::run_threaded()
+//   jit       Chip8Jit, the reference running as many instructions as each
+//             of its frames did
+//   reset     a machine reset to a snapshot (Chip8::reset_to_snapshot(), as
+//             the fuzzer does) after running another game first
+//   lockstep  --lanes copies in a LockstepBatch, each next to a Chip8 of its
+//             own; every other lane gets keys of its own, so lanes both stay
+//             together and split up
+//   env       --lanes environments of the C API (Environment.h) on a few
+//             threads, each next to a Chip8 of its own; the observations in
+//             the ring are compared after every step and reset, with random
+//             frame skips, resets of some environments and an episode length
+//
+// The games are what the engines special-case most: mostly 8XYN (with VF as
+// an operand often), 6XNN/7XNN and skips, plus jumps within a main loop,
+// calls of a few subroutines, I and memory access (also over the game's own
+// code), sprites, timers, keys and the instructions of each quirk profile.
+// Fully random opcodes hit an unknown opcode or a stack fault within a few
+// instructions and compare next to nothing. Every game runs under every
+// profile, with keys that change now and then.
+//
+// A mismatch prints the game's seed, the frame (and lane) and the first
+// field that differs; `--seed=S --roms=1` runs that game again. Exits with 1 if any
+// engine mismatched.
+//
+// Usage: engine_check [--roms=N] [--frames=N] [--ips=N] [--lanes=N]
+//                     [--seed=N] [--engines=NAME,...] [--threads=N]
+// =====================================================================================
+#include "Chip8.h"
+#include "Environment.h"
+#include "Jit.h"
+#include "Lockstep.h"
+#include "SaveState.h"
+#include "ThreadPool.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+enum check_engine {
+    CHECK_THREADED,
+    CHECK_JIT,
+    CHECK_RESET,
+    CHECK_LOCKSTEP,
+    CHECK_ENV,
+    CHECK_ENGINE_COUNT,
+};
+
+static const char *check_engine_names[CHECK_ENGINE_COUNT] = {
+    "threaded", "jit", "reset", "lockstep", "env"};
+
+// A generated game: subroutines of `subroutine_instructions` plus a
+// return each, then a main loop of `main_instructions`
+static const unsigned int subroutines = 4;
+static const unsigned int subroutine_instructions = 8;
+static const unsigned int main_instructions = 160;
+// The environment API's setup: threads, ring slots and the memory bytes
+// every observation carries (free memory the games write, and their code)
+static const unsigned int env_threads = 3;
+static const unsigned int env_slots = 3;
+static const uint16_t env_watches[] = {0x200, 0x203, 0x400, 0x401,
+                                       0x402, 0x47F, 0x4FF};
+// Mismatches printed per engine and profile, the rest are only counted
+static const unsigned int max_reports = 5;
+
+struct CheckOptions {
+    unsigned int roms = 50;
+    unsigned int frames = 60;
+    unsigned int ips = 3000;
+    unsigned int lanes = 8;
+    unsigned int seed = 1;
+};
+
+// xorshift32
+static uint32_t next_random(uint32_t &state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+static void emit(std::vector<unsigned char> &code, unsigned short opcode) {
+    code.push_back(opcode >> 8);
+    code.push_back(opcode & 0xFF);
+}
+
+// A random game for `flags`, see the top of the file.
+static std::vector<unsigned char> make_rom(uint32_t &state,
+                                           const QuirkFlags &flags) {
+    static const unsigned short alu_ops[] = {0x0, 0x1, 0x2, 0x3, 0x4,
+                                             0x5, 0x6, 0x7, 0xE};
+    auto random = [&](uint32_t range) { return next_random(state) % range; };
+    // A register, VF a quarter of the time
+    auto reg = [&]() { return random(4) == 0 ? 0xF : random(16); };
+
+    // 0x200 jumps over the subroutines to the main loop
+    std::vector<unsigned char> code;
+    std::vector<unsigned short> entries;
+    unsigned short main_start = 0;
+    // An instruction of the main loop
+    auto target = [&]() { return main_start + 2 * random(main_instructions); };
+    // One instruction. Subroutines don't jump, call or wait, so they return
+    // (or run into the next one when they skip their return).
+    auto instruction = [&](bool in_main) {
+        unsigned int x = reg(), y = reg();
+        unsigned int nn = random(4) == 0 ? random(4) : random(256);
+        unsigned int pick = random(100);
+        if (!in_main && pick >= 70 && pick < 77)
+            pick = random(70);
+        if (pick < 35) {
+            emit(code, 0x8000 | x << 8 | y << 4 | alu_ops[random(9)]);
+        } else if (pick < 45) {
+            emit(code, 0x6000 | x << 8 | nn);
+        } else if (pick < 55) {
+            emit(code, 0x7000 | x << 8 | nn);
+        } else if (pick < 68) {
+            static const unsigned short skips[] = {0x3000, 0x4000, 0x5000,
+                                                   0x9000};
+            unsigned short op = skips[random(4)] | x << 8;
+            emit(code, op < 0x5000 ? op | nn : op | y << 4);
+        } else if (pick < 70) {
+            emit(code, (random(2) ? 0xE09E : 0xE0A1) | x << 8);
+        } else if (pick < 74) {
+            emit(code, 0x1000 | target());
+        } else if (pick < 76) {
+            emit(code, 0x2000 | entries[random(subroutines)]);
+        } else if (pick < 77) {
+            emit(code, random(8) == 0 ? 0xF00A | x << 8 : 0xB000 | target());
+        } else if (pick < 82) {
+            // Mostly the free memory after the game, sometimes the game
+            unsigned int address = 0x200 + 2 * random(code.size() / 2 + 1);
+            emit(code, 0xA000 | (random(4) == 0 ? address : 0x400 + nn));
+        } else if (pick < 84) {
+            emit(code, 0xF000 | x << 8 | (random(2) ? 0x1E : 0x29));
+        } else if (pick < 88) {
+            static const unsigned short stores[] = {0x33, 0x55, 0x65};
+            emit(code, 0xF000 | x << 8 | stores[random(3)]);
+        } else if (pick < 91) {
+            emit(code, 0xD000 | x << 8 | y << 4 | random(16));
+        } else if (pick < 93) {
+            emit(code, 0xC000 | x << 8 | nn);
+        } else if (pick < 97) {
+            static const unsigned short timers[] = {0x07, 0x15, 0x18};
+            emit(code, 0xF000 | x << 8 | timers[random(3)]);
+        } else if (flags.xo_chip) {
+            switch (random(6)) {
+            case 0:
+            case 1:
+                emit(code, (random(2) ? 0x5002 : 0x5003) | x << 8 | y << 4);
+                break;
+            case 2:
+                emit(code, 0xF000);
+                emit(code, 0x400 + nn);
+                break;
+            case 3:
+                emit(code, 0xF001 | random(4) << 8);
+                break;
+            case 4:
+                emit(code, 0xF002);
+                break;
+            default:
+                emit(code, 0xF03A | x << 8);
+                break;
+            }
+        } else if (flags.super_chip) {
+            static const unsigned short super_ops[] = {0x00C2, 0x00FB, 0x00FC,
+                                                       0x00FE, 0x00FF, 0xF030,
+                                                       0xF075, 0xF085};
+            unsigned short op = super_ops[random(8)];
+            emit(code, op >= 0xF000 ? op | (x & 7) << 8 : op);
+        } else {
+            emit(code, 0x00E0);
+        }
+    };
+
+    emit(code, 0x1000);
+    for (unsigned int s = 0; s < subroutines; s++) {
+        entries.push_back(0x200 + code.size());
+        for (unsigned int i = 0; i < subroutine_instructions; i++)
+            instruction(false);
+        emit(code, 0x00EE);
+    }
+    main_start = 0x200 + code.size();
+    code[0] = 0x10 | main_start >> 8;
+    code[1] = main_start & 0xFF;
+    // F000 NNNN takes two words, so the loop may be a word longer
+    for (unsigned int i = 0; i < main_instructions; i++)
+        instruction(true);
+    emit(code, 0x1000 | main_start);
+    return code;
+}
+
+// Keys held in each frame: a random mask that sticks for a while
+static std::vector<uint16_t> make_keys(uint32_t &state, unsigned int frames) {
+    std::vector<uint16_t> keys(frames);
+    uint16_t held = 0;
+    for (uint16_t &mask : keys) {
+        if (next_random(state) % 4 == 0)
+            held = next_random(state) & 0xFFFF;
+        mask = held;
+    }
+    return keys;
+}
+
+// A machine as the emulator sets one up for `rom`.
+static Chip8 *start_machine(const std::vector<unsigned char> &rom,
+                            quirk_profile profile, unsigned int seed) {
+    Chip8 *chip8 = new Chip8();
+    chip8->initialize();
+    chip8->set_quirks(profile);
+    chip8->load_rom(rom.data(), rom.size());
+    chip8->seed(seed);
+    return chip8;
+}
+
+struct StateField {
+    const char *name;
+    size_t offset;
+    size_t size;
+    // Size of one entry of an array, the whole field otherwise
+    size_t element;
+};
+
+#define STATE_FIELD(field, element)                                            \
+    {#field, offsetof(SaveState, field), sizeof(SaveState::field), element}
+
+static const StateField state_fields[] = {
+    STATE_FIELD(memory, 1),
+    STATE_FIELD(gfx, 8),
+    STATE_FIELD(stack, 2),
+    STATE_FIELD(V, 1),
+    STATE_FIELD(flags, 1),
+    STATE_FIELD(audio_pattern, 1),
+    STATE_FIELD(opcode, 2),
+    STATE_FIELD(index_register, 2),
+    STATE_FIELD(prog_counter, 2),
+    STATE_FIELD(sp, 2),
+    STATE_FIELD(stack_current_size, 4),
+    STATE_FIELD(rng_state, 4),
+    STATE_FIELD(keys, 2),
+    STATE_FIELD(delay_timer, 1),
+    STATE_FIELD(sound_timer, 1),
+    STATE_FIELD(halted, 1),
+    STATE_FIELD(wait_key_register, 1),
+    STATE_FIELD(draw_flag, 1),
+    STATE_FIELD(quirks, 1),
+    STATE_FIELD(hires, 1),
+    STATE_FIELD(plane_mask, 1),
+    STATE_FIELD(pitch, 1),
+    STATE_FIELD(audio_pattern_loaded, 1),
+    STATE_FIELD(reserved, 1),
+    STATE_FIELD(idle_cycles, 8),
+    STATE_FIELD(unknown_opcodes, 8),
+};
+
+// The `size` byte entry at `offset`.
+static unsigned long long read_entry(const SaveState &state, size_t offset,
+                                     size_t size) {
+    const unsigned char *bytes = (const unsigned char *)&state + offset;
+    uint8_t byte;
+    uint16_t word;
+    uint32_t dword;
+    uint64_t qword;
+    if (size == 1) {
+        memcpy(&byte, bytes, 1);
+        return byte;
+    }
+    if (size == 2) {
+        memcpy(&word, bytes, 2);
+        return word;
+    }
+    if (size == 4) {
+        memcpy(&dword, bytes, 4);
+        return dword;
+    }
+    memcpy(&qword, bytes, 8);
+    return qword;
+}
+
+// Whether `engine` matches `reference` (the header's checksum aside), and
+// if not the first field that differs, with both values, in `difference`.
+static bool same_state(const SaveState &reference, const SaveState &engine,
+                       std::string &difference) {
+    for (const StateField &field : state_fields) {
+        const unsigned char *a =
+            (const unsigned char *)&reference + field.offset;
+        const unsigned char *b = (const unsigned char *)&engine + field.offset;
+        if (memcmp(a, b, field.size) == 0)
+            continue;
+        size_t index = 0;
+        while (memcmp(a + index * field.element, b + index * field.element,
+                      field.element) == 0)
+            index++;
+        size_t offset = field.offset + index * field.element;
+        char text[128];
+        if (field.size == field.element)
+            snprintf(text, sizeof(text), "%s %llx, reference %llx",
+                     field.name, read_entry(engine, offset, field.element),
+                     read_entry(reference, offset, field.element));
+        else
+            snprintf(text, sizeof(text), "%s[%#zx] %llx, reference %llx",
+                     field.name, index,
+                     read_entry(engine, offset, field.element),
+                     read_entry(reference, offset, field.element));
+        difference = text;
+        return false;
+    }
+    return true;
+}
+
+// Runs `rom` on `engine` and the interpreter. Returns false, with where
+// they first differ in `report`, on a mismatch. Adds the instructions the
+// reference executed (not skipped while halted) to `instructions`.
+static bool check_rom(check_engine engine, const std::vector<unsigned char> &rom,
+                      const std::vector<uint16_t> &keys, quirk_profile profile,
+                      unsigned int seed, const CheckOptions &options,
+                      unsigned long long &instructions, std::string &report) {
+    Chip8 *reference = start_machine(rom, profile, seed);
+    Chip8 *chip8 = nullptr;
+    Chip8Jit *jit = nullptr;
+    std::vector<SaveState> states(2);
+    unsigned long per_frame = options.ips / 60;
+
+    if (engine == CHECK_RESET) {
+        // The fuzzer's machine: a snapshot without a game, then a game that
+        // dirties memory before the one compared is patched in
+        chip8 = new Chip8();
+        chip8->initialize();
+        chip8->set_quirks(profile);
+        chip8->seed(seed);
+        SaveState &pristine = states[1];
+        chip8->save_snapshot(pristine);
+        uint32_t state = seed ^ 0x9E3779B9;
+        std::vector<unsigned char> other =
+            make_rom(state, quirk_flags(profile));
+        chip8->patch_memory(0x200, other.data(), other.size());
+        for (uint16_t mask : keys) {
+            chip8->set_keys(mask ^ 0xFFFF);
+            chip8->run(per_frame);
+            chip8->update_timers();
+        }
+        chip8->reset_to_snapshot(pristine);
+        chip8->patch_memory(0x200, rom.data(), rom.size());
+    } else {
+        chip8 = start_machine(rom, profile, seed);
+        if (engine == CHECK_JIT) {
+            jit = new Chip8Jit();
+            chip8->attach_jit(jit);
+        }
+    }
+
+    // The window takes the first screen before the first frame, and
+    // presents after every frame. Loading or resetting always asks for a
+    // redraw, so draw_flag only compares what the frames drew.
+    reference->set_draw_flag(false);
+    chip8->set_draw_flag(false);
+    unsigned long long ran = 0;
+    bool same = true;
+    for (size_t frame = 0; frame < keys.size() && same; frame++) {
+        reference->set_keys(keys[frame]);
+        chip8->set_keys(keys[frame]);
+        unsigned long count = per_frame;
+        if (engine == CHECK_THREADED)
+            chip8->run_threaded(count);
+        else if (engine == CHECK_JIT)
+            count = jit->run(*chip8, count);
+        else
+            chip8->run(count);
+        ran += reference->run(count);
+        reference->update_timers();
+        chip8->update_timers();
+
+        reference->save_state(states[0]);
+        chip8->save_state(states[1]);
+        std::string difference;
+        if (!same_state(states[0], states[1], difference)) {
+            char text[256];
+            snprintf(text, sizeof(text),
+                     "%-9s %-9s seed %u frame %zu: %s\n",
+                     check_engine_names[engine], quirk_profile_name(profile),
+                     seed, frame, difference.c_str());
+            report = text;
+            same = false;
+        }
+        reference->set_draw_flag(false);
+        chip8->set_draw_flag(false);
+    }
+
+    instructions += ran - reference->get_idle_cycles();
+    chip8->attach_jit(nullptr);
+    delete jit;
+    delete chip8;
+    delete reference;
+    return same;
+}
+
+// check_rom() for --lanes copies of `rom` in a LockstepBatch, lane n seeded
+// with `seed + n` and holding `keys` if n is even.
+static bool check_lockstep(const std::vector<unsigned char> &rom,
+                           const std::vector<uint16_t> &keys,
+                           quirk_profile profile, unsigned int seed,
+                           const CheckOptions &options,
+                           unsigned long long &instructions,
+                           std::string &report) {
+    size_t lanes = options.lanes;
+    LockstepBatch batch(lanes, rom.data(), rom.size(), profile, seed,
+                        options.ips);
+    std::vector<Chip8 *> references(lanes);
+    std::vector<std::vector<uint16_t>> lane_keys(lanes, keys);
+    uint32_t state = seed ^ 0x85EBCA6B;
+    for (size_t lane = 0; lane < lanes; lane++) {
+        references[lane] = start_machine(rom, profile, seed + lane);
+        if (lane % 2 == 1)
+            lane_keys[lane] = make_keys(state, keys.size());
+    }
+    std::vector<SaveState> states(2);
+    std::vector<uint16_t> actions(lanes);
+    unsigned long per_frame = options.ips / 60;
+
+    size_t frame = 0;
+    bool same = true;
+    for (; frame < keys.size() && same; frame++) {
+        for (size_t lane = 0; lane < lanes; lane++)
+            actions[lane] = lane_keys[lane][frame];
+        batch.step_batch(actions.data());
+        for (size_t lane = 0; lane < lanes && same; lane++) {
+            Chip8 &reference = *references[lane];
+            reference.set_keys(actions[lane]);
+            reference.run(per_frame);
+            reference.update_timers();
+
+            reference.save_state(states[0]);
+            batch.get_machine(lane).save_state(states[1]);
+            std::string difference;
+            if (!same_state(states[0], states[1], difference)) {
+                char text[256];
+                snprintf(text, sizeof(text),
+                         "%-9s %-9s seed %u frame %zu lane %zu: %s\n",
+                         check_engine_names[CHECK_LOCKSTEP],
+                         quirk_profile_name(profile), seed, frame, lane,
+                         difference.c_str());
+                report = text;
+                same = false;
+            }
+        }
+    }
+
+    for (Chip8 *reference : references) {
+        instructions += (unsigned long long)per_frame * frame -
+                        reference->get_idle_cycles();
+        delete reference;
+    }
+    return same;
+}
+
+// Whether `observation` is what the API should write for `reference`, and
+// if not the first field that differs in `difference`.
+static bool same_observation(const chip8_env_observation &observation,
+                             Chip8 &reference, uint8_t done,
+                             uint32_t episode_frame, std::string &difference) {
+    const Framebuffer &gfx = reference.get_gfx();
+    char text[128];
+    for (int p = 0; p < 2; p++) {
+        for (int row = 0; row < 64; row++) {
+            if (memcmp(observation.planes[p][row], gfx.planes[p][row], 16) == 0)
+                continue;
+            snprintf(text, sizeof(text), "planes[%d][%d] differ", p, row);
+            difference = text;
+            return false;
+        }
+    }
+    const uint8_t *watched = chip8_env_watched(&observation);
+    for (size_t i = 0; i < sizeof(env_watches) / 2; i++) {
+        uint8_t byte = reference.read_memory(env_watches[i]);
+        if (watched[i] == byte)
+            continue;
+        snprintf(text, sizeof(text), "watched %#x %x, reference %x",
+                 env_watches[i], watched[i], byte);
+        difference = text;
+        return false;
+    }
+    if (observation.hires != gfx.hires)
+        snprintf(text, sizeof(text), "hires %x, reference %x",
+                 observation.hires, gfx.hires);
+    else if (observation.halted != reference.get_halt_state())
+        snprintf(text, sizeof(text), "halted %x, reference %x",
+                 observation.halted, reference.get_halt_state());
+    else if (observation.done != done)
+        snprintf(text, sizeof(text), "done %x, reference %x", observation.done,
+                 done);
+    else if (observation.episode_frame != episode_frame)
+        snprintf(text, sizeof(text), "episode_frame %u, reference %u",
+                 observation.episode_frame, episode_frame);
+    else
+        return true;
+    difference = text;
+    return false;
+}
+
+// check_rom() for --lanes environments of `rom` through the C API, each
+// next to a Chip8 started as chip8_env_create() and chip8_env_reset() say
+// (seed n + 1, then the seed of the reset). Environment n holds `keys` if n
+// is even. Runs --frames frames in steps of 1 to 3 frames, with an episode
+// length of half of that, and now and then resets some environments.
+static bool check_env(const std::vector<unsigned char> &rom,
+                      const std::vector<uint16_t> &keys, quirk_profile profile,
+                      unsigned int seed, const CheckOptions &options,
+                      unsigned long long &instructions, std::string &report) {
+    uint32_t envs = options.lanes;
+    uint32_t watch_count = sizeof(env_watches) / 2;
+    size_t size = chip8_env_ring_size(envs, env_slots, watch_count);
+    void *ring = aligned_alloc(64, (size + 63) / 64 * 64);
+    chip8_env_config config = {};
+    config.rom = rom.data();
+    config.rom_size = rom.size();
+    config.env_count = envs;
+    config.profile = profile;
+    config.instructions_per_second = options.ips;
+    config.slot_count = env_slots;
+    config.threads = env_threads;
+    config.max_episode_frames = options.frames / 2;
+    config.watch_addresses = env_watches;
+    config.watch_count = watch_count;
+    chip8_env *env = chip8_env_create(&config, ring, size);
+    if (env == nullptr) {
+        free(ring);
+        report = "env: chip8_env_create() failed\n";
+        return false;
+    }
+
+    std::vector<Chip8 *> references(envs);
+    std::vector<std::vector<uint16_t>> env_keys(envs, keys);
+    std::vector<uint32_t> episode_frames(envs, 0);
+    std::vector<uint8_t> done(envs, 0);
+    // Frames each reference ran, for the instruction count
+    std::vector<unsigned long long> frames_run(envs, 0);
+    uint32_t state = seed ^ 0xC2B2AE35;
+    for (uint32_t n = 0; n < envs; n++) {
+        references[n] = start_machine(rom, profile, n + 1);
+        if (n % 2 == 1)
+            env_keys[n] = make_keys(state, keys.size());
+    }
+    unsigned long per_frame = options.ips / 60;
+    auto retire = [&](uint32_t n) {
+        instructions += per_frame * frames_run[n] -
+                        references[n]->get_idle_cycles();
+        delete references[n];
+    };
+
+    std::vector<uint16_t> masks(envs);
+    std::vector<uint32_t> seeds(envs);
+    std::vector<uint8_t> selected(envs);
+    char text[256];
+    bool same = true;
+    size_t frame = 0;
+    for (unsigned int call = 1; frame < keys.size() && same; call++) {
+        uint64_t number;
+        uint32_t frame_skip = 0;
+        if (call % 8 == 0) {
+            for (uint32_t n = 0; n < envs; n++) {
+                seeds[n] = next_random(state);
+                selected[n] = next_random(state) % 3 == 0;
+                if (!selected[n])
+                    continue;
+                retire(n);
+                references[n] = start_machine(rom, profile, seeds[n]);
+                frames_run[n] = 0;
+                episode_frames[n] = 0;
+                done[n] = 0;
+            }
+            number = chip8_env_reset(env, seeds.data(), selected.data());
+        } else {
+            frame_skip = 1 + next_random(state) % 3;
+            if (frame_skip > keys.size() - frame)
+                frame_skip = keys.size() - frame;
+            for (uint32_t n = 0; n < envs; n++) {
+                masks[n] = env_keys[n][frame];
+                Chip8 &reference = *references[n];
+                reference.set_keys(masks[n]);
+                for (uint32_t f = 0; f < frame_skip; f++) {
+                    reference.run(per_frame);
+                    reference.update_timers();
+                }
+                frames_run[n] += frame_skip;
+                episode_frames[n] += frame_skip;
+                if (reference.get_halt_state() == HALT_FAULT ||
+                    (config.max_episode_frames > 0 &&
+                     episode_frames[n] >= config.max_episode_frames))
+                    done[n] = 1;
+            }
+            number = chip8_env_step(env, masks.data(), frame_skip);
+            frame += frame_skip;
+        }
+
+        const chip8_env_ring_header &header =
+            *(const chip8_env_ring_header *)ring;
+        const chip8_env_slot_header &slot =
+            *(const chip8_env_slot_header *)((const unsigned char *)ring +
+                                             header.slots_offset +
+                                             (number - 1) % env_slots *
+                                                 header.slot_size);
+        std::string difference;
+        if (number != call || header.published != call ||
+            slot.number != call || slot.frames != frame_skip) {
+            snprintf(text, sizeof(text),
+                     "%-9s %-9s seed %u call %u: numbered %llu, published "
+                     "%llu, slot %llu with %u frames\n",
+                     check_engine_names[CHECK_ENV], quirk_profile_name(profile),
+                     seed, call, (unsigned long long)number,
+                     (unsigned long long)header.published,
+                     (unsigned long long)slot.number, slot.frames);
+            report = text;
+            same = false;
+        }
+        for (uint32_t n = 0; n < envs && same; n++) {
+            if (same_observation(*chip8_env_observation_at(ring, number, n),
+                                 *references[n], done[n], episode_frames[n],
+                                 difference))
+                continue;
+            snprintf(text, sizeof(text),
+                     "%-9s %-9s seed %u call %u (%s) env %u: %s\n",
+                     check_engine_names[CHECK_ENV], quirk_profile_name(profile),
+                     seed, call, frame_skip > 0 ? "step" : "reset", n,
+                     difference.c_str());
+            report = text;
+            same = false;
+        }
+    }
+
+    for (uint32_t n = 0; n < envs; n++)
+        retire(n);
+    chip8_env_destroy(env);
+    free(ring);
+    return same;
+}
+
+int main(int argc, char **argv) {
+    CheckOptions options;
+    unsigned int threads = 0;
+    bool enabled[CHECK_ENGINE_COUNT] = {true, true, true, true, true};
+    for (int i = 1; i < argc; i++) {
+        const char *value = strchr(argv[i], '=');
+        value = value != nullptr ? value + 1 : "";
+        if (strncmp(argv[i], "--roms=", 7) == 0) {
+            options.roms = strtoul(value, nullptr, 10);
+        } else if (strncmp(argv[i], "--frames=", 9) == 0) {
+            options.frames = strtoul(value, nullptr, 10);
+        } else if (strncmp(argv[i], "--ips=", 6) == 0) {
+            options.ips = strtoul(value, nullptr, 10);
+        } else if (strncmp(argv[i], "--lanes=", 8) == 0) {
+            options.lanes = strtoul(value, nullptr, 10);
+        } else if (strncmp(argv[i], "--seed=", 7) == 0) {
+            options.seed = strtoul(value, nullptr, 10);
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            threads = strtoul(value, nullptr, 10);
+        } else if (strncmp(argv[i], "--engines=", 10) == 0) {
+            std::string names = std::string(value) + ",";
+            memset(enabled, 0, sizeof(enabled));
+            for (size_t start = 0, end; start < names.size(); start = end + 1) {
+                end = names.find(',', start);
+                std::string name = names.substr(start, end - start);
+                int e = 0;
+                while (e < CHECK_ENGINE_COUNT && name != check_engine_names[e])
+                    e++;
+                if (e == CHECK_ENGINE_COUNT) {
+                    fprintf(stderr, "ERROR: Unknown engine %s\n", name.c_str());
+                    return 1;
+                }
+                enabled[e] = true;
+            }
+        } else {
+            fprintf(stderr,
+                    "Usage: %s [--roms=N] [--frames=N] [--ips=N] [--lanes=N] "
+                    "[--seed=N] [--engines=NAME,...] [--threads=N]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (options.ips < 60 || options.lanes == 0) {
+        fprintf(stderr, "ERROR: --ips must be at least 60 and --lanes 1\n");
+        return 1;
+    }
+    if (enabled[CHECK_JIT]) {
+        Chip8Jit probe;
+        if (!probe.is_supported()) {
+            fprintf(stderr, "WARNING: JIT not available on this host, "
+                            "skipping it\n");
+            enabled[CHECK_JIT] = false;
+        }
+    }
+
+    // One task per game and profile, results per engine
+    size_t tasks = (size_t)options.roms * QUIRK_PROFILE_COUNT;
+    std::vector<std::string> reports(tasks * CHECK_ENGINE_COUNT);
+    std::vector<char> failed(tasks * CHECK_ENGINE_COUNT, 0);
+    std::vector<unsigned long long> instructions(tasks * CHECK_ENGINE_COUNT);
+    WorkStealingPool pool(threads);
+    pool.run(tasks, [&](size_t task) {
+        unsigned int seed = options.seed + task / QUIRK_PROFILE_COUNT;
+        quirk_profile profile = (quirk_profile)(task % QUIRK_PROFILE_COUNT);
+        // xorshift gets stuck on a zero state
+        uint32_t state = seed * 2654435761u + 1;
+        std::vector<unsigned char> rom = make_rom(state, quirk_flags(profile));
+        std::vector<uint16_t> keys = make_keys(state, options.frames);
+        for (int e = 0; e < CHECK_ENGINE_COUNT; e++) {
+            size_t slot = task * CHECK_ENGINE_COUNT + e;
+            if (!enabled[e])
+                continue;
+            if (e == CHECK_LOCKSTEP)
+                failed[slot] = !check_lockstep(rom, keys, profile, seed,
+                                               options, instructions[slot],
+                                               reports[slot]);
+            else if (e == CHECK_ENV)
+                failed[slot] = !check_env(rom, keys, profile, seed, options,
+                                          instructions[slot], reports[slot]);
+            else
+                failed[slot] = !check_rom((check_engine)e, rom, keys, profile,
+                                          seed, options, instructions[slot],
+                                          reports[slot]);
+        }
+    });
+
+    unsigned int mismatches = 0;
+    for (int e = 0; e < CHECK_ENGINE_COUNT; e++) {
+        if (!enabled[e])
+            continue;
+        for (int p = 0; p < QUIRK_PROFILE_COUNT; p++) {
+            unsigned int bad = 0;
+            unsigned long long executed = 0;
+            for (size_t task = p; task < tasks; task += QUIRK_PROFILE_COUNT) {
+                size_t slot = task * CHECK_ENGINE_COUNT + e;
+                executed += instructions[slot];
+                if (failed[slot] && bad++ < max_reports)
+                    fputs(reports[slot].c_str(), stdout);
+            }
+            printf("%-9s %-9s %u ROMs, %llu instructions, %u mismatches\n",
+                   check_engine_names[e],
+                   quirk_profile_name((quirk_profile)p), options.roms,
+                   executed, bad);
+            mismatches += bad;
+        }
+    }
+    return mismatches > 0 ? 1 : 0;
+}
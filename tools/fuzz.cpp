@@ -0,0 +1,177 @@
+// =====================================================================================
+// In-process fuzzing harness (libFuzzer). Each input is a game plus what the
+// player does while it runs:
+//   byte 0        quirk profile, modulo QUIRK_PROFILE_COUNT
+//   byte 1        number of key events K
+//   K x 2 bytes   key events: frames to wait before the event, then the key
+//                 (low 4 bits), pressed if bit 7 is set and released if not
+//   the rest      the ROM, loaded at 0x200
+//
+// The game runs on the interpreter for at most `max_frames` frames of
+// `cycles_per_frame` instructions, or until it faults or waits for a key
+// that will never come. Which instruction followed which (program counter
+// edges) is reported to libFuzzer as extra coverage, so inputs that reach new
+// code in the ROM are kept even when they run the same emulator code.
+//
+// Every profile has one machine, reset between inputs to a snapshot of it
+// right after `initialize()`. Only the memory the previous input wrote is
+// restored (see `Chip8::reset_to_snapshot()`), which keeps an execution
+// down to the instructions it runs.
+//
+// Built with -DCHIP8_FUZZ_MAIN there's a main() instead of libFuzzer's that
+// replays the inputs given on the command line (crashes, a corpus) and
+// prints the edges each one covers:
+//   fuzz_replay [--runs=N] FILE...
+// =====================================================================================
+#include "Chip8.h"
+#include "SaveState.h"
+#include <chrono>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+static const int max_frames = 64;
+static const int cycles_per_frame = 256;
+
+// Hit counts per (from, to) program counter pair, hashed to 16 bits.
+// libFuzzer picks up everything in this section as coverage and clears it
+// before each input.
+__attribute__((used, section("__libfuzzer_extra_counters")))
+static uint8_t edge_counters[1 << 16];
+
+struct FuzzMachine {
+    Chip8 *chip8 = nullptr;
+    SaveState *pristine = nullptr;
+};
+
+static FuzzMachine &machine_for(quirk_profile profile) {
+    static FuzzMachine machines[QUIRK_PROFILE_COUNT];
+    FuzzMachine &machine = machines[profile];
+    if (machine.chip8 == nullptr) {
+        machine.chip8 = new Chip8();
+        machine.chip8->initialize();
+        machine.chip8->set_quirks(profile);
+        // Inputs have to replay the same way
+        machine.chip8->seed(1);
+        machine.pristine = new SaveState();
+        machine.chip8->save_snapshot(*machine.pristine);
+    }
+    return machine;
+}
+
+static inline void count_edge(unsigned short from, unsigned short to) {
+    uint8_t &counter = edge_counters[((from & 0xFFF) << 4 ^ to) & 0xFFFF];
+    // Saturating, an edge hit 256 times must not look like one never hit
+    if (counter != 255)
+        counter++;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    if (size < 2)
+        return 0;
+    quirk_profile profile = (quirk_profile)(data[0] % QUIRK_PROFILE_COUNT);
+    size_t event_count = data[1];
+    if (size < 2 + 2 * event_count)
+        return 0;
+    const uint8_t *events = data + 2;
+    const uint8_t *rom = events + 2 * event_count;
+    size_t rom_size = size - 2 - 2 * event_count;
+
+    FuzzMachine &machine = machine_for(profile);
+    Chip8 &chip8 = *machine.chip8;
+    chip8.reset_to_snapshot(*machine.pristine);
+    chip8.patch_memory(0x200, rom, rom_size);
+
+    size_t next_event = 0;
+    int wait = event_count > 0 ? events[0] : 0;
+    uint16_t keys = 0;
+    for (int frame = 0; frame < max_frames; frame++) {
+        while (next_event < event_count && wait == 0) {
+            uint8_t key = events[2 * next_event + 1];
+            if (key & 0x80)
+                keys |= 1 << (key & 0xF);
+            else
+                keys &= ~(1 << (key & 0xF));
+            next_event++;
+            if (next_event < event_count)
+                wait = events[2 * next_event];
+        }
+        wait--;
+        chip8.set_keys(keys);
+
+        halt_state halted = chip8.get_halt_state();
+        if (halted == HALT_FAULT ||
+            (halted == HALT_WAIT_KEY && next_event == event_count))
+            break;
+        unsigned short from = chip8.get_prog_counter();
+        for (int i = 0; i < cycles_per_frame; i++) {
+            chip8.emulate_cycle();
+            if (chip8.get_halt_state() != HALT_NONE)
+                break;
+            unsigned short to = chip8.get_prog_counter();
+            count_edge(from, to);
+            from = to;
+        }
+        chip8.update_timers();
+    }
+    return 0;
+}
+
+#ifdef CHIP8_FUZZ_MAIN
+using fuzz_clock = std::chrono::steady_clock;
+
+static bool read_file(const char *path, std::vector<uint8_t> &bytes) {
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr)
+        return false;
+    uint8_t buffer[4096];
+    size_t got;
+    while ((got = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        bytes.insert(bytes.end(), buffer, buffer + got);
+    fclose(file);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    unsigned long runs = 1;
+    std::vector<const char *> paths;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--runs=", 7) == 0) {
+            runs = strtoul(argv[i] + 7, nullptr, 10);
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "ERROR: Unknown option %s\n", argv[i]);
+            return 1;
+        } else {
+            paths.push_back(argv[i]);
+        }
+    }
+    if (paths.empty() || runs == 0) {
+        fprintf(stderr, "Usage: %s [--runs=N] FILE...\n", argv[0]);
+        return 1;
+    }
+
+    for (const char *path : paths) {
+        std::vector<uint8_t> input;
+        if (!read_file(path, input)) {
+            fprintf(stderr, "ERROR: Can't read %s\n", path);
+            return 1;
+        }
+        memset(edge_counters, 0, sizeof(edge_counters));
+        LLVMFuzzerTestOneInput(input.data(), input.size());
+        size_t edges = 0;
+        for (uint8_t counter : edge_counters)
+            edges += counter != 0;
+        fuzz_clock::time_point start = fuzz_clock::now();
+        for (unsigned long run = 0; run < runs; run++)
+            LLVMFuzzerTestOneInput(input.data(), input.size());
+        double seconds =
+            std::chrono::duration<double>(fuzz_clock::now() - start).count();
+        printf("%s: %zu edges, %.0f execs/s\n", path, edges,
+               seconds > 0 ? runs / seconds : 0.0);
+    }
+    return 0;
+}
+#endif
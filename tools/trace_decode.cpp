@@ -0,0 +1,125 @@
+// =====================================================================================
+// Turns a binary trace written with --trace (see include/Trace.h) back into
+// text, one line per record:
+//
+//   <instance> <pc>: <opcode> <disassembly>      [call stack]
+//
+// Call stacks are rebuilt per instance from the CALL/RETURN records, so they
+// are only complete for traces that started with the game.
+//
+// Usage: trace_decode TRACE_FILE [INSTANCE]
+// =====================================================================================
+#include "Disassembler.h"
+#include "Trace.h"
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+// What the decoder knows about one traced Chip8 instance.
+struct InstanceState {
+    std::vector<uint16_t> stack; // return addresses, innermost last
+    uint64_t dropped = 0;
+};
+
+static void print_stack(const InstanceState &state) {
+    printf("  [");
+    for (size_t i = 0; i < state.stack.size(); i++)
+        printf(i == 0 ? "%03X" : " %03X", state.stack[i]);
+    printf("]");
+}
+
+static void print_record(uint32_t instance, const TraceRecord &record,
+                         InstanceState &state) {
+    char text[32];
+    printf("%4u %03X: ", instance, record.pc);
+    switch (record.kind) {
+    case TRACE_OPCODE:
+        disassemble(record.opcode, text, sizeof(text));
+        printf("%04X %-16s I=%03X", record.opcode, text, record.arg);
+        break;
+    case TRACE_CALL:
+        state.stack.push_back(record.arg);
+        printf("%04X call %03X", record.opcode, record.opcode & 0xFFF);
+        break;
+    case TRACE_RETURN:
+        if (!state.stack.empty())
+            state.stack.pop_back();
+        printf("%04X return to %03X", record.opcode, record.arg);
+        break;
+    case TRACE_UNKNOWN:
+        printf("%04X unknown opcode", record.opcode);
+        break;
+    case TRACE_BEEP:
+        printf("     beep");
+        break;
+    case TRACE_KEYS:
+        printf("     keys %04X", record.arg);
+        break;
+    case TRACE_HALT:
+        printf("%04X halt (%s)", record.opcode,
+               record.arg == 1   ? "waiting for key"
+               : record.arg == 2 ? "waiting for timer"
+                                 : "stack fault");
+        break;
+    default:
+        printf("     record of unknown kind %u", record.kind);
+        break;
+    }
+    // The trace's own depth is authoritative; a mismatch means records were
+    // dropped or the trace started mid-game.
+    if (state.stack.size() != record.depth)
+        state.stack.resize(record.depth, 0);
+    print_stack(state);
+    printf("\n");
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s TRACE_FILE [INSTANCE]\n", argv[0]);
+        return 1;
+    }
+    bool only_one = argc > 2;
+    uint32_t wanted = only_one ? strtoul(argv[2], nullptr, 10) : 0;
+
+    FILE *file = fopen(argv[1], "rb");
+    if (file == nullptr) {
+        fprintf(stderr, "ERROR: Can't open %s\n", argv[1]);
+        return 1;
+    }
+    char magic[8];
+    if (fread(magic, 1, 8, file) != 8 ||
+        memcmp(magic, TRACE_FILE_MAGIC, 8) != 0) {
+        fprintf(stderr, "ERROR: %s is not a trace file\n", argv[1]);
+        fclose(file);
+        return 1;
+    }
+
+    std::map<uint32_t, InstanceState> instances;
+    std::vector<TraceRecord> records;
+    uint32_t header[2];
+    uint64_t dropped;
+    while (fread(header, sizeof(uint32_t), 2, file) == 2 &&
+           fread(&dropped, sizeof(dropped), 1, file) == 1) {
+        records.resize(header[1]);
+        if (fread(records.data(), sizeof(TraceRecord), header[1], file) !=
+            header[1]) {
+            fprintf(stderr, "WARNING: Trace ends in the middle of a chunk\n");
+            break;
+        }
+        if (only_one && header[0] != wanted)
+            continue;
+
+        InstanceState &state = instances[header[0]];
+        if (dropped != state.dropped) {
+            printf("%4u ---: %llu records dropped\n", header[0],
+                   (unsigned long long)(dropped - state.dropped));
+            state.dropped = dropped;
+        }
+        for (const TraceRecord &record : records)
+            print_record(header[0], record, state);
+    }
+    fclose(file);
+    return 0;
+}